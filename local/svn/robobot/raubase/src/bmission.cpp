@@ -0,0 +1,559 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include "mpose.h"
+#include "uservice.h"
+#include "uconfig.h"
+#include "cmixer.h"
+#include "cservo.h"
+#include "medge.h"
+#include "sdist.h"
+#include "maruco.h"
+#include "sgpiod.h"
+
+#include "bmission.h"
+
+// create class object
+BMission mission;
+
+
+void BMission::setup()
+{ // ensure there is default values in ini-file
+  config.add("mission", "file", filename, "", "Mission file to run after the compiled plans (empty is none)");
+  config.add("mission", "log", log, true, "Log mission to log_mission.txt");
+  config.add("mission", "print", toConsole, true, "Print mission log to console");
+  //
+  if (log)
+  { // open logfile
+    std::string fn = service.logPath + "log_mission.txt";
+    logfile = fopen(fn.c_str(), "w");
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%% Mission file logfile\n");
+      fprintf(logfile, "%% 1 \tTime (sec)\n");
+      fprintf(logfile, "%% 2 \tMission state\n");
+      fprintf(logfile, "%% 3 \t%% Mission status (mostly for debug)\n");
+    }
+    else
+      printf("# bmission - Failed to create logfile at %s\n", fn.c_str());
+  }
+  setupDone = true;
+}
+
+BMission::~BMission()
+{
+  terminate();
+}
+
+void BMission::run()
+{
+  if (not setupDone)
+    setup();
+  if (filename.empty())
+    return;
+  UMission m(filename.c_str(), logfile, toConsole);
+  int first;
+  if (load(filename.c_str(), m, first))
+    m.run(first);
+}
+
+void BMission::terminate()
+{ //
+  if (logfile != nullptr)
+    fclose(logfile);
+  logfile = nullptr;
+}
+
+bool BMission::parseValue(const std::string & name, Value & v, int & topics)
+{
+  struct Named
+  {
+    const char * name;
+    const float * f;
+    const bool * b;
+    int topic;
+  };
+  const Named named[] = {
+    {"pose.x", &pose.x, nullptr, UEvent::POSE},
+    {"pose.y", &pose.y, nullptr, UEvent::POSE},
+    {"pose.h", &pose.h, nullptr, UEvent::POSE},
+    {"pose.dist", &pose.dist, nullptr, UEvent::POSE},
+    {"pose.turned", &pose.turned, nullptr, UEvent::POSE},
+    {"pose.vel", &pose.robVel, nullptr, UEvent::POSE},
+    {"edge.width", &medge.width, nullptr, UEvent::EDGE},
+    {"edge.left", &medge.leftEdge, nullptr, UEvent::EDGE},
+    {"edge.right", &medge.rightEdge, nullptr, UEvent::EDGE},
+    {"edge.center", &medge.trackCenter, nullptr, UEvent::EDGE},
+    {"edge.valid", nullptr, &medge.edgeValid, UEvent::EDGE},
+    {"edge.track", nullptr, &medge.trackValid, UEvent::EDGE},
+    {"edge.crossing", nullptr, &medge.crossing, UEvent::EDGE},
+    {"dist.0", &dist.dist[0], nullptr, UEvent::DIST},
+    {"dist.1", &dist.dist[1], nullptr, UEvent::DIST},
+  };
+  for (auto & n : named)
+  {
+    if (name == n.name)
+    {
+      if (n.b != nullptr)
+      {
+        v.kind = Value::BOOL;
+        v.b = n.b;
+      }
+      else
+      {
+        v.kind = Value::FLOAT;
+        v.f = n.f;
+      }
+      topics |= n.topic;
+      return true;
+    }
+  }
+  if (name.compare(0, 5, "gpio.") == 0)
+  { // gpio.<pin>
+    char * p2;
+    int pin = strtol(name.c_str() + 5, &p2, 10);
+    v.b = gpio.debouncedValue(pin);
+    if (*p2 != '\0' or v.b == nullptr)
+      return false;
+    v.kind = Value::BOOL;
+    topics |= UEvent::GPIO;
+    return true;
+  }
+  if (name.compare(0, 6, "aruco.") == 0)
+  { // aruco.<id>.<field>
+    const char * p1 = name.c_str() + 6;
+    char * p2;
+    v.id = strtol(p1, &p2, 10);
+    if (p2 == p1 or *p2 != '.')
+      return false;
+    const char * fields[] = {"x", "y", "h", "dist", "age"};
+    for (int i = 0; i < 5; i++)
+    {
+      if (strcmp(p2 + 1, fields[i]) == 0)
+      {
+        v.kind = Value::ARUCO;
+        v.field = i;
+        // relative to robot, so pose too
+        topics |= UEvent::ARUCO | UEvent::POSE;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool BMission::parseAction(const std::vector<std::string> & tokens, Action & a)
+{
+  const std::string & cmd = tokens[0];
+  int n = tokens.size();
+  auto num = [&](int i, float & value)
+  {
+    if (i >= n)
+      return false;
+    char * p2;
+    value = strtof(tokens[i].c_str(), &p2);
+    return *p2 == '\0';
+  };
+  if (cmd == "vel" and n == 2)
+  {
+    a.op = Action::VEL;
+    return num(1, a.p[0]);
+  }
+  else if (cmd == "turnrate" and n == 2)
+  {
+    a.op = Action::TURNRATE;
+    return num(1, a.p[0]);
+  }
+  else if (cmd == "heading" and n == 2)
+  {
+    a.op = Action::HEADING;
+    return num(1, a.p[0]);
+  }
+  else if (cmd == "stop" and n == 1)
+  {
+    a.op = Action::STOP;
+    return true;
+  }
+  else if (cmd == "edge" and n == 3 and (tokens[1] == "left" or tokens[1] == "right"))
+  {
+    a.op = Action::EDGE;
+    a.p[0] = tokens[1] == "left";
+    return num(2, a.p[1]);
+  }
+  else if (cmd == "reset" and n == 2)
+  {
+    if (tokens[1] == "pose")
+      a.op = Action::RESET_POSE;
+    else if (tokens[1] == "dist")
+      a.op = Action::RESET_DIST;
+    else if (tokens[1] == "turned")
+      a.op = Action::RESET_TURNED;
+    else
+      return false;
+    return true;
+  }
+  else if (cmd == "servo" and n == 3 and tokens[2] == "off")
+  {
+    a.op = Action::SERVO;
+    a.p[1] = NAN;
+    return num(1, a.p[0]);
+  }
+  else if (cmd == "servo" and n == 4)
+  {
+    a.op = Action::SERVO;
+    return num(1, a.p[0]) and num(2, a.p[1]) and num(3, a.p[2]);
+  }
+  else if (cmd == "log" and n > 1)
+  {
+    a.op = Action::LOG;
+    for (int i = 1; i < n; i++)
+    {
+      if (i > 1)
+        a.text += " ";
+      a.text += tokens[i];
+    }
+    return true;
+  }
+  return false;
+}
+
+bool BMission::parseGoto(const std::vector<std::string> & tokens, int i, int & target, std::string & note)
+{
+  int n = tokens.size();
+  if (i + 1 >= n or tokens[i] != "goto")
+    return false;
+  const std::string & t = tokens[i + 1];
+  if (t == "finished")
+    target = UMission::FINISHED;
+  else if (t == "lost")
+    target = UMission::LOST;
+  else
+  {
+    char * p2;
+    target = strtol(t.c_str(), &p2, 10);
+    if (*p2 != '\0' or target < 0)
+      return false;
+  }
+  note = "";
+  for (int j = i + 2; j < n; j++)
+  {
+    if (j > i + 2)
+      note += " ";
+    note += tokens[j];
+  }
+  if (note.empty())
+    note = "goto " + t;
+  return true;
+}
+
+bool BMission::load(const char * fn, UMission & m, int & first)
+{
+  std::ifstream f(fn);
+  if (not f.is_open())
+  {
+    printf("# BMission::load: could not open mission file '%s'\n", fn);
+    return false;
+  }
+  std::string line;
+  int lineNum = 0;
+  int topics = 0;
+  bool gotState = false;
+  bool err = false;
+  // state being compiled
+  int id = 0;
+  std::string name;
+  std::vector<Action> entry;
+  std::set<int> defined;
+  // target state and line number
+  std::vector<std::pair<int,int>> targets;
+  auto endState = [&]()
+  {
+    if (gotState)
+    {
+      UMission * mp = &m;
+      if (entry.empty())
+        m.state(id, name.c_str());
+      else
+        m.state(id, name.c_str(), [entry, mp](){ act(entry, mp); });
+      entry.clear();
+    }
+  };
+  while (std::getline(f, line))
+  {
+    lineNum++;
+    size_t c = line.find('#');
+    if (c != std::string::npos)
+      line.erase(c);
+    std::istringstream ss(line);
+    std::vector<std::string> tokens;
+    std::string tok;
+    while (ss >> tok)
+      tokens.push_back(tok);
+    if (tokens.empty())
+      continue;
+    const char * msg = nullptr;
+    if (tokens[0] == "state")
+    {
+      char * p2 = nullptr;
+      int newId = -1;
+      if (tokens.size() > 1)
+        newId = strtol(tokens[1].c_str(), &p2, 10);
+      if (newId < 0 or *p2 != '\0')
+        msg = "state needs an id (integer >= 0)";
+      else if (defined.count(newId) > 0)
+        msg = "state is defined already";
+      else
+      {
+        endState();
+        if (not gotState)
+          first = newId;
+        gotState = true;
+        id = newId;
+        defined.insert(id);
+        name = "";
+        for (int i = 2; i < (int)tokens.size(); i++)
+        {
+          if (i > 2)
+            name += " ";
+          name += tokens[i];
+        }
+      }
+    }
+    else if (not gotState)
+      msg = "expected 'state' first";
+    else if (tokens[0] == "if")
+    { // if <cond> [and <cond>] goto <target> [note]
+      std::vector<Cond> conds;
+      int i = 1;
+      int n = tokens.size();
+      while (msg == nullptr and i < n and tokens[i] != "goto")
+      {
+        Cond cond;
+        bool negate = tokens[i] == "not";
+        if (negate)
+          i++;
+        if (i >= n or not parseValue(tokens[i], cond.value, topics))
+        {
+          msg = "unknown value";
+          break;
+        }
+        i++;
+        const char * ops[] = {"<", "<=", ">", ">=", "==", "!="};
+        int op = -1;
+        if (i < n)
+        {
+          for (int j = 0; j < 6; j++)
+            if (tokens[i] == ops[j])
+              op = j;
+        }
+        if (op >= 0 and not negate)
+        { // compare with a number
+          char * p2;
+          if (i + 1 >= n)
+          {
+            msg = "missing number";
+            break;
+          }
+          cond.op = Cond::Op(op);
+          cond.limit = strtof(tokens[i + 1].c_str(), &p2);
+          if (*p2 != '\0')
+          {
+            msg = "not a number";
+            break;
+          }
+          i += 2;
+        }
+        else if (cond.value.kind == Value::BOOL)
+        { // true or false value
+          cond.op = negate ? Cond::EQ : Cond::NE;
+          cond.limit = 0;
+        }
+        else
+        {
+          msg = "expected a compare operator";
+          break;
+        }
+        conds.push_back(cond);
+        if (i < n and tokens[i] == "and")
+          i++;
+      }
+      int target;
+      std::string note;
+      if (msg == nullptr and conds.empty())
+        msg = "no condition";
+      else if (msg == nullptr and not parseGoto(tokens, i, target, note))
+        msg = "expected 'goto <state|finished|lost> [note]'";
+      if (msg == nullptr)
+      {
+        m.when(id, [conds](){ return test(conds); }, target, note.c_str());
+        targets.push_back({target, lineNum});
+      }
+    }
+    else if (tokens[0] == "after")
+    { // after <sec> goto <target> [note]
+      char * p2 = nullptr;
+      float sec = -1;
+      int target;
+      std::string note;
+      if (tokens.size() > 1)
+        sec = strtof(tokens[1].c_str(), &p2);
+      if (sec < 0 or *p2 != '\0')
+        msg = "after needs a time (sec)";
+      else if (not parseGoto(tokens, 2, target, note))
+        msg = "expected 'goto <state|finished|lost> [note]'";
+      else
+      {
+        m.after(id, sec, target, note.c_str());
+        targets.push_back({target, lineNum});
+      }
+    }
+    else
+    {
+      Action a;
+      if (parseAction(tokens, a))
+        entry.push_back(a);
+      else
+        msg = "unknown statement";
+    }
+    if (msg != nullptr)
+    {
+      printf("# BMission::load: %s:%d: %s: '%s'\n", fn, lineNum, msg, line.c_str());
+      err = true;
+    }
+  }
+  endState();
+  if (not gotState)
+  {
+    printf("# BMission::load: %s: no states\n", fn);
+    err = true;
+  }
+  for (auto & t : targets)
+  {
+    if (t.first >= 0 and defined.count(t.first) == 0)
+    {
+      printf("# BMission::load: %s:%d: state %d is not defined\n", fn, t.second, t.first);
+      err = true;
+    }
+  }
+  m.wakeOn(topics);
+  if (not err)
+    printf("# BMission::load: %s compiled, %d states\n", fn, (int)defined.size());
+  return not err;
+}
+
+float BMission::get(const Value & v)
+{
+  switch (v.kind)
+  {
+    case Value::FLOAT:
+      return *v.f;
+    case Value::BOOL:
+      return *v.b;
+    case Value::ARUCO:
+    {
+      ArUcoMarker mk;
+      if (not aruco.getMarker(v.id, mk))
+        // not seen, so just very old
+        return v.field == 4 ? 1e6 : NAN;
+      switch (v.field)
+      {
+        case 0: return mk.robot[0];
+        case 1: return mk.robot[1];
+        case 2: return mk.robotH;
+        case 3: return hypot(mk.robot[0], mk.robot[1]);
+        default: return mk.age;
+      }
+    }
+  }
+  return NAN;
+}
+
+bool BMission::test(const std::vector<Cond> & conds)
+{
+  for (auto & c : conds)
+  {
+    float v = get(c.value);
+    bool ok;
+    switch (c.op)
+    {
+      case Cond::LT: ok = v < c.limit; break;
+      case Cond::LE: ok = v <= c.limit; break;
+      case Cond::GT: ok = v > c.limit; break;
+      case Cond::GE: ok = v >= c.limit; break;
+      case Cond::EQ: ok = v == c.limit; break;
+      default: ok = v != c.limit; break;
+    }
+    if (not ok)
+      return false;
+  }
+  return true;
+}
+
+void BMission::act(const std::vector<Action> & actions, UMission * m)
+{
+  for (auto & a : actions)
+  {
+    switch (a.op)
+    {
+      case Action::VEL:
+        mixer.setVelocity(a.p[0]);
+        break;
+      case Action::TURNRATE:
+        mixer.setTurnrate(a.p[0]);
+        break;
+      case Action::HEADING:
+        mixer.setDesiredHeading(a.p[0]);
+        break;
+      case Action::STOP:
+        mixer.setVelocity(0);
+        mixer.setTurnrate(0);
+        break;
+      case Action::EDGE:
+        mixer.setEdgeMode(a.p[0] > 0.5, a.p[1]);
+        break;
+      case Action::RESET_POSE:
+        pose.resetPose();
+        break;
+      case Action::RESET_DIST:
+        pose.dist = 0;
+        break;
+      case Action::RESET_TURNED:
+        pose.turned = 0;
+        break;
+      case Action::SERVO:
+        if (isnan(a.p[1]))
+          servo.setServo(a.p[0], false);
+        else
+          servo.setServo(a.p[0], true, a.p[1], a.p[2]);
+        break;
+      case Action::LOG:
+        m->toLog(a.text.c_str());
+        break;
+    }
+  }
+}
@@ -0,0 +1,146 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "umission.h"
+
+/**
+ * A mission loaded from a text file (ini: [mission] file),
+ * so a course can be changed without a rebuild.
+ * The file is compiled, when loaded, into the state table of a UMission,
+ * conditions become a list of (value, compare, limit) and
+ * actions a list of simple operations, so the run-time cost is
+ * the same as for a hand-written plan.
+ *
+ * File format (one statement per line, '#' starts a comment):
+ *
+ *   state <id> [name]                  new state, id is an integer
+ *   <action>                           done when the state is entered
+ *   if <cond> [and <cond>] goto <target> [note]
+ *   after <sec> goto <target> [note]
+ *
+ * target is a state id, 'finished' or 'lost'.
+ * cond is '<value> <op> <number>' with op as <, <=, >, >=, ==, !=,
+ * or '[not] <value>' for true/false values.
+ * values:
+ *   pose.x pose.y pose.h pose.dist pose.turned pose.vel
+ *   edge.width edge.left edge.right edge.center edge.valid edge.track edge.crossing
+ *   dist.0 dist.1
+ *   aruco.<id>.x aruco.<id>.y aruco.<id>.h aruco.<id>.dist aruco.<id>.age
+ *   gpio.<pin> (debounced input)
+ * actions:
+ *   vel <m/s>, turnrate <rad/s>, heading <rad>, stop,
+ *   edge left|right <offset m>,
+ *   reset pose|dist|turned,
+ *   servo <n> <position> <velocity>, servo <n> off,
+ *   log <text>
+ *
+ * The first state in the file is the first state run.
+ * Example:
+ *
+ *   state 10 to the line
+ *     reset dist
+ *     vel 0.25
+ *     if edge.width > 0.05 goto 20 found line
+ *     if pose.dist > 1.0 goto lost no line
+ *   state 20 follow line to wall
+ *     edge right -0.03
+ *     if dist.0 < 0.15 goto finished
+ *     after 10 goto lost
+ */
+class BMission
+{
+public:
+  /**
+   * destructor */
+  ~BMission();
+  /** setup and request data */
+  void setup();
+  /**
+   * run the mission file (if any) */
+  void run();
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Compile a mission file into the state table of m
+   * \param first is set to the first state in the file
+   * \returns false on error (printed with line number) */
+  bool load(const char * filename, UMission & m, int & first);
+
+private:
+  /**
+   * A value that can be tested */
+  struct Value
+  {
+    enum Kind {FLOAT, BOOL, ARUCO} kind = FLOAT;
+    const float * f = nullptr;
+    const bool * b = nullptr;
+    /// marker ID and field (x, y, h, dist, age)
+    int id = 0;
+    int field = 0;
+  };
+  struct Cond
+  {
+    Value value;
+    enum Op {LT, LE, GT, GE, EQ, NE} op;
+    float limit;
+  };
+  struct Action
+  {
+    enum Op {VEL, TURNRATE, HEADING, STOP, EDGE,
+             RESET_POSE, RESET_DIST, RESET_TURNED, SERVO, LOG} op;
+    float p[3] = {0};
+    std::string text;
+  };
+  /** get the current value */
+  static float get(const Value & v);
+  /** true if all conditions are true */
+  static bool test(const std::vector<Cond> & conds);
+  /** do all actions */
+  static void act(const std::vector<Action> & actions, UMission * m);
+  /**
+   * Parse a value name, and add the topics that may change it
+   * \returns false if not known */
+  bool parseValue(const std::string & name, Value & v, int & topics);
+  /**
+   * Parse an action from the tokens of a line
+   * \returns false if not an action */
+  bool parseAction(const std::vector<std::string> & tokens, Action & a);
+  /**
+   * Parse 'goto <target> [note]' from token i */
+  bool parseGoto(const std::vector<std::string> & tokens, int i, int & target, std::string & note);
+  // debug print to console
+  bool toConsole = true;
+  // logfile
+  bool log = true;
+  FILE * logfile = nullptr;
+  bool setupDone = false;
+  std::string filename;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern BMission mission;
@@ -25,7 +25,6 @@
 #include <string>
 #include <string.h>
 #include <math.h>
-#include <unistd.h>
 #include "mpose.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -36,6 +35,7 @@
 #include "medge.h"
 #include "cedge.h"
 #include "cmixer.h"
+#include "umission.h"
 
 
 #include "bplan100.h"
@@ -79,85 +79,41 @@ void BPlan100::run()
     setup();
   if (ini["plan100"]["run"] == "false")
     return;
+  UMission m("Plan100", logfile, toConsole);
+  m.wakeOn(UEvent::POSE);
+  // make a shift in heading-mission
+  m.state(11, "reset pose, forward at 0.3m/s",
+          []()
+          {
+            pose.resetPose();
+            mixer.setVelocity(0.3);
+          });
+  m.when(11, [](){ return pose.dist >= 0.3; }, 21, "now turn at 0.5 rad/s and 0 m/s",
+         []()
+         { // reset turned angle
+           pose.turned = 0.0;
+           mixer.setVelocity(0.0);
+           mixer.setTurnrate(0.5);
+         });
+  m.after(11, 10, UMission::LOST, "too slow");
   //
-  UTime t("now");
-  bool finished = false;
-  bool lost = false;
-  state = 10;
-  oldstate = state;
+  m.state(21, "turn pi");
+  m.when(21, [](){ return pose.turned >= M_PI; }, 31, "now go back",
+         []()
+         {
+           mixer.setDesiredHeading(M_PI);
+           mixer.setVelocity(0.3);
+           // reset driven distance
+           pose.dist = 0;
+         });
+  m.after(21, 12, UMission::LOST, "turn too slow");
   //
-  toLog("Plan100 started");
+  m.state(31, "back 0.3m");
+  m.when(31, [](){ return pose.dist >= 0.3; }, UMission::FINISHED, "the end",
+         [](){ mixer.setVelocity(0.0); });
+  m.after(31, 10, UMission::LOST, "too slow");
   //
-  while (not finished and not lost and not service.stop)
-  {
-    switch (state)
-    { // make a shift in heading-mission
-      case 10:
-        toLog("Reset pose");
-        pose.resetPose();
-
-        toLog("forward at 0.3m/s");
-        mixer.setVelocity(0.3);
-        state = 11;
-        break;
-      case 11: // wait for distance
-        if (pose.dist >= 0.3)
-        { // done, and then
-          toLog("now turn at 0.5 rad/s and 0 m/s");
-          // reset turned angle
-          pose.turned = 0.0;
-          mixer.setVelocity(0.0);
-          mixer.setTurnrate(0.5);
-          state = 21;
-        }
-        else if (t.getTimePassed() > 10)
-          lost = true;
-        break;
-      case 21:
-        if (pose.turned >= M_PI)
-        {
-          mixer.setDesiredHeading(M_PI);
-          toLog("now go back");
-          mixer.setVelocity(0.3);
-          // reset driven distance
-          pose.dist = 0;
-          state = 31;
-        }
-        else if (t.getTimePassed() > 12)
-          lost = true;
-        break;
-      case 31: // wait for distance
-        if (pose.dist >= 0.3)
-        { // the end
-          mixer.setVelocity(0.0);
-          finished = true;
-        }
-        else if (t.getTimePassed() > 10)
-          lost = true;
-        break;
-      default:
-        toLog("Unknown state");
-        lost = true;
-        break;
-    }
-    if (state != oldstate)
-    {
-      oldstate = state;
-      toLog("state start");
-      // reset time in new state
-      t.now();
-    }
-    // wait a bit to offload CPU
-    usleep(2000);
-  }
-  if (lost)
-  { // there may be better options, but for now - stop
-    toLog("Plan100 got lost");
-    mixer.setVelocity(0);
-    mixer.setTurnrate(0);
-  }
-  else
-    toLog("Plan100 finished");
+  m.run(11);
 }
 
 
@@ -167,21 +123,3 @@ void BPlan100::terminate()
     fclose(logfile);
   logfile = nullptr;
 }
-
-void BPlan100::toLog(const char* message)
-{
-  UTime t("now");
-  if (logfile != nullptr)
-  {
-    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-            oldstate,
-            message);
-  }
-  if (toConsole)
-  {
-    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-           oldstate,
-           message);
-  }
-}
-
@@ -25,7 +25,6 @@
 #include <string>
 #include <string.h>
 #include <math.h>
-#include <unistd.h>
 #include <opencv2/calib3d.hpp>
 #include "mpose.h"
 #include "steensy.h"
@@ -39,6 +38,7 @@
 #include "cmixer.h"
 #include "maruco.h"
 #include "scam.h"
+#include "umission.h"
 
 
 #include "bplan101.h"
@@ -83,70 +83,38 @@ void BPlan101::run()
     setup();
   if (ini["plan101"]["run"] == "false")
     return;
-  //
-  UTime t("now");
-  bool finished = false;
-  bool lost = false;
-  state = 10;
-  oldstate = state;
-  //
-  toLog("Plan101 started");
+  UMission m("Plan101", logfile, toConsole);
+  // Test ArUco plan
   int count = 0;
-  //
-  while (not finished and not lost and not service.stop)
-  {
-    switch (state)
-    { // Test ArUco plan
-      case 10:
-      { // brackets to allow local variables
-        toLog("get ArUco");
-        UTime t("now");
-        int n = aruco.findAruco(0.1);
-        printf("# plan101: find ArUco took %g sec\n", t.getTimePassed());
-        for (int i = 0; i < n; i++)
-        { // convert to robot coordinates
-          cv::Vec3d pos = cam.getPositionInRobotCoordinates(aruco.arTranslate[i]);
-          // rotation
-          cv::Vec3f re = cam.getOrientationInRobotEulerAngles(aruco.arRotate[i], true);
-          if (logfile != nullptr or toConsole)
+  m.state(10, "get ArUco",
+          [this, &m, &count]()
           {
-            const int MSL = 200;
-            char s[MSL];
-            snprintf(s, MSL, "# ArUco (%d, %d) in robot coordinates (x,y,z) = (%g %g %g)", i, aruco.arCode[i], pos[0], pos[1], pos[2]);
-            toLog(s);
-            snprintf(s, MSL, "# Aruco angles in robot coordinates (roll = %.1f deg, pitch = %.1f deg, yaw = %.1f deg)", re[0], re[1], re[2]);
-            toLog(s);
-          }
-        }
-        count++;
-        // repeat 4 times (to get some statistics)
-        if (count > 3)
-          finished = true;
-        break;
-      }
-      default:
-        toLog("Unknown state");
-        lost = true;
-        break;
-    }
-    if (state != oldstate)
-    {
-      oldstate = state;
-      toLog("state start");
-      // reset time in new state
-      t.now();
-    }
-    // wait a bit to offload CPU
-    usleep(2000);
-  }
-  if (lost)
-  { // there may be better options, but for now - stop
-    toLog("Plan101 got lost");
-    mixer.setVelocity(0);
-    mixer.setTurnrate(0);
-  }
-  else
-    toLog("Plan101 finished");
+            UTime t("now");
+            ArUcoResult found;
+            int n = aruco.findAruco(0.1, found);
+            printf("# plan101: find ArUco took %g sec\n", t.getTimePassed());
+            for (int i = 0; i < n; i++)
+            { // convert to robot coordinates
+              cv::Vec3d pos = cam.getPositionInRobotCoordinates(found.translate[i]);
+              // rotation
+              cv::Vec3f re = cam.getOrientationInRobotEulerAngles(found.rotate[i], true);
+              if (logfile != nullptr or toConsole)
+              {
+                const int MSL = 200;
+                char s[MSL];
+                snprintf(s, MSL, "# ArUco (%d, %d) in robot coordinates (x,y,z) = (%g %g %g)", i, found.code[i], pos[0], pos[1], pos[2]);
+                m.toLog(s);
+                snprintf(s, MSL, "# Aruco angles in robot coordinates (roll = %.1f deg, pitch = %.1f deg, yaw = %.1f deg)", re[0], re[1], re[2]);
+                m.toLog(s);
+              }
+            }
+            count++;
+          });
+  // repeat 4 times (to get some statistics)
+  m.when(10, [&count](){ return count > 3; }, UMission::FINISHED, "done 4 times");
+  m.when(10, [](){ return true; }, 10, "again");
+  //
+  m.run(10);
 }
 
 
@@ -156,21 +124,3 @@ void BPlan101::terminate()
     fclose(logfile);
   logfile = nullptr;
 }
-
-void BPlan101::toLog(const char* message)
-{
-  UTime t("now");
-  if (logfile != nullptr)
-  {
-    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-            oldstate,
-            message);
-  }
-  if (toConsole)
-  {
-    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-           oldstate,
-           message);
-  }
-}
-
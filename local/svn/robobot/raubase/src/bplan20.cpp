@@ -25,7 +25,6 @@
 #include <string>
 #include <string.h>
 #include <math.h>
-#include <unistd.h>
 #include "mpose.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -36,6 +35,7 @@
 #include "medge.h"
 #include "cedge.h"
 #include "cmixer.h"
+#include "umission.h"
 
 #include "bplan20.h"
 
@@ -78,56 +78,19 @@ void BPlan20::run()
     setup();
   if (ini["plan20"]["run"] == "false")
     return;
+  UMission m("Plan20", logfile, toConsole);
+  m.wakeOn(UEvent::POSE);
   //
-  UTime t("now");
-  bool finished = false;
-  bool lost = false;
-  state = 10;
-  oldstate = state;
+  m.state(10, "forward at 0.3m/s",
+          []()
+          {
+            pose.resetPose();
+            mixer.setVelocity(0.01);
+          });
+  m.when(10, [](){ return pose.dist >= 1.0; }, UMission::FINISHED, "driven 1m");
+  m.after(10, 10, UMission::LOST, "too slow");
   //
-  toLog("Plan20 started");
-  //
-  while (not finished and not lost and not service.stop)
-  {
-    switch (state)
-    { // make a shift in heading-mission
-      case 10:
-        pose.resetPose();
-        toLog("forward at 0.3m/s");
-        mixer.setVelocity(0.01);
-        state = 11;
-        break;
-      case 11: // wait for distance
-        if (pose.dist >= 1.0)
-        { // done, and then
-          finished = true;
-        }
-        else if (t.getTimePassed() > 10)
-          lost = true;
-        break;
-      default:
-        toLog("Unknown state");
-        lost = true;
-        break;
-    }
-    if (state != oldstate)
-    {
-      oldstate = state;
-      toLog("state start");
-      // reset time in new state
-      t.now();
-    }
-    // wait a bit to offload CPU
-    usleep(2000);
-  }
-  if (lost)
-  { // there may be better options, but for now - stop
-    toLog("Plan20 got lost");
-    mixer.setVelocity(0);
-    mixer.setTurnrate(0);
-  }
-  else
-    toLog("Plan20 finished");
+  m.run(10);
 }
 
 
@@ -137,21 +100,3 @@ void BPlan20::terminate()
     fclose(logfile);
   logfile = nullptr;
 }
-
-void BPlan20::toLog(const char* message)
-{
-  UTime t("now");
-  if (logfile != nullptr)
-  {
-    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-            oldstate,
-            message);
-  }
-  if (toConsole)
-  {
-    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-           oldstate,
-           message);
-  }
-}
-
@@ -25,7 +25,6 @@
 #include <string>
 #include <string.h>
 #include <math.h>
-#include <unistd.h>
 #include "mpose.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -36,6 +35,7 @@
 #include "medge.h"
 #include "cedge.h"
 #include "cmixer.h"
+#include "umission.h"
 
 #include "bplan21.h"
 
@@ -77,67 +77,29 @@ void BPlan21::run()
     setup();
   if (ini["plan21"]["run"] == "false")
     return;
-  //
-  UTime t;
-  bool finished = false;
-  bool lost = false;
-  state = 10;
-  oldstate = state;
-  //
-  toLog("Plan21 started");
+  UMission m("Plan21", logfile, toConsole);
+  m.wakeOn(UEvent::POSE);
+  // run a square with 4 90 deg turns - CCV
   int turns = 0;
+  m.state(10, "turn to pi/2 rad (90deg) and forward 1m",
+          [&turns]()
+          { // reset turned angle and distance
+            pose.resetPose();
+            mixer.setVelocity(0.3);
+            mixer.setDesiredHeading(M_PI/2);
+            turns++;
+          });
+  m.when(10, [&turns](){ return pose.dist >= 1.0 and turns >= 4; }, UMission::FINISHED,
+         "square done",
+         []()
+         {
+           mixer.setVelocity(0);
+           mixer.setTurnrate(0);
+         });
+  m.when(10, [](){ return pose.dist >= 1.0; }, 10, "side done");
+  m.after(10, 10, UMission::LOST, "too slow");
   //
-  while (not finished and not lost and not service.stop)
-  { // run a square with 4 90 deg turns - CCV
-    switch (state)
-    {
-      case 10:
-        if (pose.dist >= 1.0 or turns == 0)
-        { // done, and then
-          if (turns >= 4)
-          {
-            finished = true;
-            mixer.setVelocity(0);
-            mixer.setTurnrate(0);
-            break;
-          }
-          toLog("now turn to -pi/2 rad (30deg)");
-          // reset turned angle and distance
-          pose.resetPose();
-          mixer.setVelocity(0.3);
-          mixer.setDesiredHeading(M_PI/2);
-          t.now();
-          turns++;
-        }
-        else if (t.getTimePassed() > 10)
-          lost = true;
-        break;
-      default:
-        toLog("Unknown state");
-        lost = true;
-        break;
-    }
-    if (state != oldstate)
-    {
-      const int MSL = 100;
-      char s[MSL];
-      snprintf(s, MSL, "state change %d -> %d", oldstate, state);
-      oldstate = state;
-      toLog(s);
-      // reset time in new state
-      t.now();
-    }
-    // wait a bit to offload CPU
-    usleep(2000);
-  }
-  if (lost)
-  { // there may be better options, but for now - stop
-    toLog("Plan21 got lost");
-    mixer.setVelocity(0);
-    mixer.setTurnrate(0);
-  }
-  else
-    toLog("Plan21 finished");
+  m.run(10);
 }
 
 void BPlan21::terminate()
@@ -146,21 +108,3 @@ void BPlan21::terminate()
     fclose(logfile);
   logfile = nullptr;
 }
-
-void BPlan21::toLog(const char* message)
-{
-  UTime t("now");
-  if (logfile != nullptr)
-  {
-    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-            oldstate,
-            message);
-  }
-  if (toConsole)
-  {
-    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-           oldstate,
-           message);
-  }
-}
-
@@ -25,7 +25,6 @@
 #include <string>
 #include <string.h>
 #include <math.h>
-#include <unistd.h>
 #include "mpose.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -37,6 +36,7 @@
 #include "cedge.h"
 #include "cmixer.h"
 #include "sdist.h"
+#include "umission.h"
 
 #include "bplan40.h"
 
@@ -78,144 +78,77 @@ void BPlan40::run()
     setup();
   if (ini["plan40"]["run"] == "false")
     return;
-  UTime t("now");
-  bool finished = false;
-  bool lost = false;
-  state = 5;
-  oldstate = state;
-  const int MSL = 100;
-  char s[MSL];
+  UMission m("Plan40", logfile, toConsole);
+  // the guards use only these
+  m.wakeOn(UEvent::POSE | UEvent::EDGE | UEvent::DIST);
   //
-  toLog("Plan40 started");
+  m.state(5, "wait for Regbot");
+  m.when(5, [](){ return dist.dist[0] < 0.25; }, 12,
+         "something is close, assume it is the Regbot, forward 0.25 m/sec",
+         []()
+         {
+           pose.resetPose();
+           mixer.setVelocity(0.25);
+           mixer.setTurnrate(0);
+         });
+  m.after(5, 10, UMission::LOST, "Gave up waiting for Regbot");
   //
-  while (not finished and not lost and not service.stop)
-  {
-    switch (state)
-    {
-      case 5: // wait for Regbot, then go forward
-        if (dist.dist[0] < 0.25)
-        { // something is close, assume it is the Regbot
-          // start driving
-          pose.resetPose();
-          toLog("forward 0.1 m/sec");
-          mixer.setVelocity(0.25);
-          mixer.setTurnrate(0);
-          state = 12;
-        }
-        else if (t.getTimePassed() > 10)
-        {
-          toLog("Gave up waiting for Regbot");
-          lost = true;
-        }
-        break;
-      case 12: // forward until distance, then look for edge
-        if (pose.dist > 0.3)
-        {
-          toLog("Continue until edge is found");
-          state = 20;
-          pose.dist = 0;
-        }
-        else if (t.getTimePassed() > 10)
-        { // line should be found within 10 seconds, else lost
-          toLog("failed to find line after 10 sec");
-          lost = true;
-        }
-        break;
-      case 20: // forward looking for line, then turn
-        if (medge.width > 0.05)
-        {
-          toLog("found line, turn left");
-          // set to edge control, left side and 0 offset
-          mixer.setVelocity(0.2); // slow
-          mixer.setTurnrate(1.0); // rad/s
-          state = 30;
-          pose.dist = 0;
-          pose.turned = 0;
-        }
-        else if (t.getTimePassed() > 10 or pose.dist > 0.6)
-        { // line should be found within 10 seconds, else lost
-          toLog("failed to find line after 10 sec / 30cm");
-          lost = true;
-        }
-        break;
-      case 30: // Continue turn until right edge is almost reached, then follow right edge
-        if (medge.edgeValid and medge.rightEdge > -0.04 and pose.turned > 0.3)
-        {
-          toLog("Line detected, that is OK to follow");
-          mixer.setEdgeMode(false /* right */, -0.03 /* offset */);
-          mixer.setVelocity(0.3);
-          state = 40;
-          pose.dist = 0;
-        }
-        else if (t.getTimePassed() > 10)
-        {
-          toLog("Time passed, no crossing line");
-          lost = true;
-        }
-        else if (pose.dist > 1.0)
-        {
-          toLog("Driven too long");
-          state = 90;
-        }
-        break;
-      case 40: // follow edge until crossing line, the go straight
-        if (medge.width > 0.075 and pose.dist > 0.2)
-        { // go straight
-          mixer.setTurnrate(0);
-          pose.dist = 0;
-          state = 50;
-        }
-        else if (t.getTimePassed() > 10)
-        {
-          toLog("too long time");
-          finished = true;
-        }
-        else if (not medge.edgeValid)
-        {
-          toLog("Lost line");
-          state = 80;
-        }
-        break;
-      case 50: // continue straight until wall is close
-        if (dist.dist[0] < 0.15)
-        { // wall found
-          toLog("wall found");
-          mixer.setVelocity(0);
-          finished = true;
-        }
-        else if (t.getTimePassed() > 10)
-        {
-          toLog("too long time");
-          lost = true;
-        }
-        else if (pose.dist > 1.5)
-        {
-          toLog("too far");
-          lost = true;
-        }
-        break;
-      default:
-        lost = true;
-        break;
-    }
-    if (state != oldstate)
-    { // C-type string print
-      snprintf(s, MSL, "State change from %d to %d", oldstate, state);
-      toLog(s);
-      oldstate = state;
-      t.now();
-    }
-    // wait a bit to offload CPU (4000 = 4ms)
-    usleep(4000);
-  }
-  if (lost)
-  { // there may be better options, but for now - stop
-    toLog("Plan40 got lost - stopping");
-    mixer.setVelocity(0);
-    mixer.setTurnrate(0);
-  }
-  else
-    toLog("Plan40 finished");
+  m.state(12, "forward until distance");
+  m.when(12, [](){ return pose.dist > 0.3; }, 20, "Continue until edge is found",
+         [](){ pose.dist = 0; });
+  m.after(12, 10, UMission::LOST, "failed to find line after 10 sec");
+  //
+  m.state(20, "forward looking for line");
+  m.when(20, [](){ return medge.width > 0.05; }, 30, "found line, turn left",
+         []()
+         { // slow and turning
+           mixer.setVelocity(0.2);
+           mixer.setTurnrate(1.0); // rad/s
+           pose.dist = 0;
+           pose.turned = 0;
+         });
+  m.after(20, 10, UMission::LOST, "failed to find line after 10 sec");
+  m.when(20, [](){ return pose.dist > 0.6; }, UMission::LOST, "failed to find line within 60cm");
+  //
+  m.state(30, "turn until right edge");
+  m.when(30, [](){ return medge.edgeValid and medge.rightEdge > -0.04 and pose.turned > 0.3; }, 40,
+         "Line detected, that is OK to follow",
+         []()
+         { // follow right edge with offset
+           mixer.setEdgeMode(false /* right */, -0.03 /* offset */);
+           mixer.setVelocity(0.3);
+           pose.dist = 0;
+         });
+  m.after(30, 10, UMission::LOST, "Time passed, no crossing line");
+  m.when(30, [](){ return pose.dist > 1.0; }, UMission::LOST, "Driven too long");
+  //
+  m.state(40, "follow edge to crossing");
+  m.when(40, []()
+         { // the tracker detects a line wider than the followed line
+           if (cedge.useTracker)
+             return (medge.crossing or medge.branchLeft or medge.branchRight) and pose.dist > 0.2;
+           return medge.width > 0.075 and pose.dist > 0.2;
+         }, 50, "crossing, go straight",
+         []()
+         {
+           mixer.setTurnrate(0);
+           pose.dist = 0;
+         });
+  m.after(40, 10, UMission::FINISHED, "too long time");
+  m.when(40, []()
+         { // the tracker bridges short dropouts
+           if (cedge.useTracker)
+             return not medge.trackValid;
+           return not medge.edgeValid;
+         }, UMission::LOST, "Lost line");
+  //
+  m.state(50, "straight to wall");
+  m.when(50, [](){ return dist.dist[0] < 0.15; }, UMission::FINISHED, "wall found",
+         [](){ mixer.setVelocity(0); });
+  m.after(50, 10, UMission::LOST, "too long time");
+  m.when(50, [](){ return pose.dist > 1.5; }, UMission::LOST, "too far");
+  //
+  m.run(5);
 }
 
 
@@ -225,20 +158,3 @@ void BPlan40::terminate()
     fclose(logfile);
   logfile = nullptr;
 }
-
-void BPlan40::toLog(const char* message)
-{
-  UTime t("now");
-  if (logfile != nullptr)
-  {
-    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-            oldstate,
-            message);
-  }
-  if (toConsole)
-  {
-    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
-           oldstate,
-           message);
-  }
-}
@@ -27,7 +27,8 @@ using namespace std;
 
 /**
  * Class intended to accomplish a short mission,
- * e.g. one challenge or part of a challenge
+ * e.g. one challenge or part of a challenge,
+ * the mission is a state table run by UMission.
  * */
 class BPlan40
 {
@@ -45,12 +46,6 @@ public:
   void terminate();
 
 private:
-  /**
-   * Write a timestamped message to log */
-  void toLog(const char * message);
-  /// added to log
-  int state, oldstate;
-  /// private stuff
   // debug print to console
   bool toConsole = true;
   // logfile
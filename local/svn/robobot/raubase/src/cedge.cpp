@@ -27,9 +27,12 @@
 #include <math.h>
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "sedge.h"
 #include "medge.h"
 #include "cedge.h"
 #include "cmixer.h"
+#include "uevent.h"
 
 // create value
 CEdge cedge;
@@ -38,38 +41,21 @@ CEdge cedge;
 // Bridge class:
 void CEdge::setup()
 { // ensure there is default values in ini-file
-  if (not ini.has("edge") or not ini["edge"].has("printCtrl"))
-  { // motor block is OK, but control parameters are needed too
-    ini["edge"]["kp"] = "40.0"; // unit is (turnrate (m/sec) per sensor error (m))
-    ini["edge"]["lead"] = "0.3 0.5"; // tau_d (sec) and alpha; tau_d = 0.0 means no function
-    ini["edge"]["taui"] = "0.0"; // tau_i (sec) 0.0 is no integrator function
-    ini["edge"]["logCedge"] = "true"; // log from this module - but not all control parameters
-    ini["edge"]["logCtrl"] = "false"; // log all control parameters
-    ini["edge"]["print"] = "false";
-    ini["edge"]["printCtrl"] = "false";
-    ini["edge"]["maxTurnrate"] = "7.0"; // rad/sec
-  }
-  //
-  // get values from ini-file
-  float kp = strtof(ini["edge"]["kp"].c_str(), nullptr);
-  const char * p1 = ini["edge"]["lead"].c_str();
-  // lead
-  float taud = strtof(p1, (char**)&p1);
-  float alpha = strtof(p1, (char**)&p1);
-  // integrator
-  float taui = strtof(ini["edge"]["taui"].c_str(), nullptr);
-  //
-  float sampleTime = strtof(ini["edge"]["rate_ms"].c_str(), nullptr)/1000.0;
-  pid.setup(sampleTime, kp, taud, alpha, taui);
-  // limit turnrate
-  maxTurnrate = strtof(ini["edge"]["maxTurnrate"].c_str(), nullptr);
-  //
-  // should debug print be enabled
-  pid.toConsole = ini["edge"]["printCtrl"] == "true";
-  toConsole = ini["edge"]["print"] == "true";
+  config.add("edge", "kp", kp, 40.0, 0.0, 1000.0, "Edge control gain (turnrate (rad/s) per sensor error (m))");
+  config.add("edge", "lead", lead, 2, "0.3 0.5", 0.0, 100.0, "Lead tau_d (sec) and alpha; tau_d = 0.0 means no lead");
+  config.add("edge", "taui", taui, 0.0, 0.0, 100.0, "Integrator tau_i (sec); 0.0 is no integrator");
+  config.add("edge", "logCedge", logCedge, true, "Save edge control to log_edge_ctrl.txt");
+  config.add("edge", "logCtrl", logCtrl, false, "Save all control parameters to log_edge_pid.txt");
+  config.add("edge", "print", toConsole, false, "Print edge control to console");
+  config.add("edge", "printCtrl", pid.toConsole, false, "Print control values to console");
+  config.add("edge", "maxTurnrate", maxTurnrate, 7.0, 0.0, 100.0, "Max turnrate from edge control (rad/s)");
+  config.add("edge", "useTracker", useTracker, false, "Control on tracked edge (bridges short dropouts)");
+  // new values are applied in run() only
+  config.staged("edge", this);
+  setupPid();
   //
   // initialize logfile
-  if (ini["edge"]["logCtrl"] == "true")
+  if (logCtrl)
   { // open logfile
     std::string fn = service.logPath + "log_edge_pid.txt";
     logfileCtrl = fopen(fn.c_str(), "w");
@@ -82,7 +68,7 @@ void CEdge::setup()
       printf("# cedge - Failed to create logfile at %s\n", fn.c_str());
 
   }
-  if (ini["edge"]["logCedge"] == "true")
+  if (logCedge)
   { // open logfile
     std::string fn = service.logPath + "log_edge_ctrl.txt";
     logfile = fopen(fn.c_str(), "w");
@@ -103,6 +89,12 @@ void CEdge::setup()
   th1 = new std::thread(runObj, this);
 }
 
+void CEdge::setupPid()
+{
+  float sampleTime = sedge.rateMs / 1000.0;
+  pid.setup(sampleTime, kp, lead[0], lead[1], taui);
+}
+
 void CEdge::toLog()
 {
   if (service.stop)
@@ -139,17 +131,39 @@ void CEdge::run()
   int loop = 0;
   bool wasEnabled = false;
   int updateCnt = medge.updateCnt;
+  int configGeneration = config.generation;
+  UEvent::Seen seen;
+  events.current(seen);
   while (not service.stop)
   {
+    if (config.changed("edge", configGeneration, this))
+    { // new control parameters (from ini-file)
+      setupPid();
+      if (logfileCtrl != nullptr)
+        pid.logPIDparams(logfileCtrl, false);
+    }
     if (medge.updateCnt != updateCnt)
     {
       if (mixer.headingMode == CMixer::HM_EDGE)
       { // follow edge
-        if (followLeft)
-          measuredValue = medge.leftEdge;
+        bool valid;
+        if (useTracker)
+        {
+          if (followLeft)
+            measuredValue = medge.trackLeft;
+          else
+            measuredValue = medge.trackRight;
+          valid = medge.trackValid;
+        }
         else
-          measuredValue = medge.rightEdge;
-        if (medge.edgeValid)
+        {
+          if (followLeft)
+            measuredValue = medge.leftEdge;
+          else
+            measuredValue = medge.rightEdge;
+          valid = medge.edgeValid;
+        }
+        if (valid)
         { // when measured are too positive, i.e. too far left
           // we should go clockwise (CV), i.e positive turn-rate.
           u = - pid.pid(followOffset, measuredValue, limited);
@@ -191,7 +205,8 @@ void CEdge::run()
       loop++;
       updateCnt = medge.updateCnt;
     }
-    usleep(2000);
+    // wait for a new edge estimate (max 2ms)
+    events.wait(UEvent::EDGE, seen, 0.002);
   }
 }
 
@@ -56,6 +56,8 @@ public:
   bool followLeft = false;
   // Mid-robot offset from line edge (positive is left)
   float followOffset = 0.0;
+  // use tracked edge from medge (else the raw edge measurement)
+  bool useTracker = false;
   // should control be enabled (default is off)
 //   bool enabled = false;
 
@@ -67,6 +69,15 @@ private:
     obj->run();
   }
   void toLog();
+  /**
+   * Setup PID from parameters (also after a reload) */
+  void setupPid();
+  /// control parameters
+  float kp;
+  float lead[2];
+  float taui;
+  bool logCedge = true;
+  bool logCtrl = false;
   /**
    * PID controller */
   UPID pid;
@@ -32,6 +32,8 @@
 #include "cmixer.h"
 
 #include "cheading.h"
+#include "uevent.h"
+#include "uconfig.h"
 
 // create value
 CHeading heading;
@@ -39,33 +41,20 @@ CHeading heading;
 
 void CHeading::setup()
 { // ensure there is default values in ini-file
-  if (not ini.has("heading"))
-  { // motor block is OK, but control parameters are needed too
-    ini["heading"]["kp"] = "10.0"; // unit is (turnrate (m/sec) per angle error (rad))
-    ini["heading"]["lead"] = "0.0 1.0"; // tau_d (sec) and alpha, tau_d = 0.0 means no function
-    ini["heading"]["taui"] = "0.0"; // tau_i (sec) 0.0 is no integrator function
-    ini["heading"]["maxTurnrate"] = "3.0"; // (rad/s)
+  if (not ini["heading"].has("log"))
     ini["heading"]["log"] = "true";
-    ini["heading"]["print"] = "false";
-  }
-  //
-  // get values from ini-file
-  float kp = strtof(ini["heading"]["kp"].c_str(), nullptr);
-  const char * p1 = ini["heading"]["lead"].c_str();
-  // lead
-  float taud = strtof(p1, (char**)&p1);
-  float alpha = strtof(p1, (char**)&p1);
-  // integrator
-  float taui = strtof(ini["heading"]["taui"].c_str(), nullptr);
-  // output limit
-  maxTurnrate = strtof(ini["heading"]["maxTurnrate"].c_str(), nullptr);
+  // control parameters, reloaded values are applied in run()
+  config.add("heading", "kp", kp, 10.0, 0.0, 1000.0, "Heading control gain (turnrate (rad/s) per angle error (rad))");
+  config.add("heading", "lead", lead, 2, "0.0 1.0", 0.0, 100.0, "Lead tau_d (sec) and alpha; tau_d = 0.0 means no lead");
+  config.add("heading", "taui", taui, 0.0, 0.0, 100.0, "Integrator tau_i (sec); 0.0 is no integrator");
+  config.add("heading", "maxTurnrate", maxTurnrate, 3.0, 0.0, 100.0, "Turnrate limit (rad/s)");
+  config.add("heading", "print", pid.toConsole, false, "Print heading control to console");
+  config.staged("heading", this);
   // sample time from encoder module
-  float sampleTime = strtof(ini["encoder"]["rate_ms"].c_str(), nullptr) / 1000.0;
+  sampleTime = strtof(ini["encoder"]["rate_ms"].c_str(), nullptr) / 1000.0;
   //
-  pid.setup(sampleTime, kp, taud, alpha, taui);
+  pid.setup(sampleTime, kp, lead[0], lead[1], taui);
   pid.doAngleFolding(true);
-  // should debug print be enabled
-  pid.toConsole = ini["heading"]["print"] == "true";
   // initialize logfile
   if (ini["heading"]["log"] == "true")
   { // open logfile
@@ -112,8 +101,17 @@ void CHeading::setRef(bool useTurnrate, float turnrate, float absHeading)
 void CHeading::run()
 {
   int loop = 0;
+  int configGeneration = config.generation;
+  UEvent::Seen seen;
+  events.current(seen);
   while (not service.stop)
   {
+    if (config.changed("heading", configGeneration, this))
+    { // new control parameters (from ini-file)
+      pid.setup(sampleTime, kp, lead[0], lead[1], taui);
+      if (logfile != nullptr)
+        pid.logPIDparams(logfile, false);
+    }
     if (pose.updateCnt != poseUpdateCnt)
     { // do constant rate control
       // that is; every time new encoder data is available,
@@ -158,7 +156,8 @@ void CHeading::run()
 //       mixer.translateToWheelVelocity();
 //     }
     loop++;
-    usleep(2000);
+    // wait for a new pose (max 2ms)
+    events.wait(UEvent::POSE, seen, 0.002);
   }
 }
 
@@ -63,6 +63,10 @@ public:
   inline float getTurnrateRef() { return turnrateRef;  }
 
 protected:
+  /// controller parameters, lead is tau_d and alpha
+  float kp;
+  float lead[2];
+  float taui;
   /// controller output limit (same value positive and negative)
   float maxTurnrate;
   //
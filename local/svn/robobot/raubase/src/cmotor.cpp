@@ -31,6 +31,8 @@
 #include "uservice.h"
 #include "mpose.h"
 #include "cmixer.h"
+#include "uevent.h"
+#include "uconfig.h"
 
 // create value
 CMotor motor;
@@ -38,35 +40,21 @@ CMotor motor;
 
 void CMotor::setup()
 { // ensure there is default values in ini-file
-  if (not ini.has("motor") or not ini["motor"].has("print_m1"))
-  { // motor block is OK, but control parameters are needed too
-    ini["motor"]["kp"] = "7.0"; // unit is (V per (m/sec))
-    ini["motor"]["lead"] = "0 1.0"; // tau_d (sec) and alpha, tau_d = 0.0 means no function
-    ini["motor"]["taui"] = "0.05"; // tau_i (sec) 0.0 is no integrator function
-    ini["motor"]["maxMotV"] = "10.0"; // (volt)
+  if (not ini["motor"].has("log"))
     ini["motor"]["log"] = "true";
-    ini["motor"]["print_m1"] = "false";
-    ini["motor"]["print_m2"] = "false";
-  }
-  //
-  // get ini-values
-  kp = strtof(ini["motor"]["kp"].c_str(), nullptr);
-  const char * p1 = ini["motor"]["lead"].c_str();
-  // lead
-  taud = strtof(p1, (char**)&p1);
-  alpha = strtof(p1, (char**)&p1);
-  // integrator
-  taui = strtof(ini["motor"]["taui"].c_str(), nullptr);
-  // output limit
-  maxMotV = strtof(ini["motor"]["maxMotV"].c_str(), nullptr);
+  // control parameters, reloaded values are applied in run()
+  config.add("motor", "kp", kp, 7.0, 0.0, 1000.0, "Velocity control gain (V per (m/sec))");
+  config.add("motor", "lead", lead, 2, "0 1.0", 0.0, 100.0, "Lead tau_d (sec) and alpha; tau_d = 0.0 means no lead");
+  config.add("motor", "taui", taui, 0.05, 0.0, 100.0, "Integrator tau_i (sec); 0.0 is no integrator");
+  config.add("motor", "maxMotV", maxMotV, 10.0, 0.0, 24.0, "Motor voltage limit (V)");
+  config.add("motor", "print_m1", pid[0].toConsole, false, "Print left motor control to console");
+  config.add("motor", "print_m2", pid[1].toConsole, false, "Print right motor control to console");
+  config.staged("motor", this);
   // sample time from encoder module
   sampleTime = strtof(ini["encoder"]["rate_ms"].c_str(), nullptr) / 1000.0;
   //
-  pid[0].setup(sampleTime, kp, taud, alpha, taui);
-  pid[1].setup(sampleTime, kp, taud, alpha, taui);
-  //
-  pid[0].toConsole = ini["motor"]["print_m1"] == "true";
-  pid[1].toConsole = ini["motor"]["print_m2"] == "true";
+  pid[0].setup(sampleTime, kp, lead[0], lead[1], taui);
+  pid[1].setup(sampleTime, kp, lead[0], lead[1], taui);
   // initialize logfile
   if (ini["motor"]["log"] == "true")
   { // open logfile
@@ -119,8 +107,20 @@ void CMotor::run()
 //   printf("# CMotor::run\n");
   int loop = 0;
   UTime lastPose;
+  int configGeneration = config.generation;
+  UEvent::Seen seen;
+  events.current(seen);
   while (not service.stop)
   {
+    if (config.changed("motor", configGeneration, this))
+    { // new control parameters (from ini-file)
+      for (int i = 0; i < 2; i++)
+      {
+        pid[i].setup(sampleTime, kp, lead[0], lead[1], taui);
+        if (logfile[i] != nullptr)
+          pid[i].logPIDparams(logfile[i], false);
+      }
+    }
     if (false) //useTeensyControl)
     { // send new velocity ref to Teensy
       if (mixer.updateCnt != mixerUpdateCnt)
@@ -180,11 +180,11 @@ void CMotor::run()
       teensy1.send(s, true);
     }
     loop++;
-    // sleep a little while, the sample time is
+    // wait for a new pose (max 2ms), the sample time is
     // determined by the encoder (longer than 2ms)
     // actually determined by the Teensy, so on average
     // a constant sample rate (defined in the robot.ini file)
-    usleep(2000);
+    events.wait(UEvent::POSE, seen, 0.002);
   }
   // stop motors
   teensy1.send("motv 0 0\n");
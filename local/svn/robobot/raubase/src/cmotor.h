@@ -55,14 +55,18 @@ protected:
    * PID values */
   float kp;
   float taui;
-  float taud;
-  float alpha;
+  /// lead tau_d and alpha
+  float lead[2];
   /// controller output limit (same value positive and negative)
   float maxMotV;
   //
 public:
   // is output limited, this may be valuable for other controllers.
   bool limited = false;
+  /**
+   * Get last controller output (motor voltage)
+   * \param i is 0 for left and 1 for right motor */
+  inline float getMotorVoltage(int i) { return u[i]; }
 
 private:
   /// private stuff
@@ -40,9 +40,7 @@ void CServo::setup()
     ini["servo"]["print"] = "true";
   }
   // use values and subscribe to source data
-  // like teensy1.send("sub pose 4\n");
-  std::string s = "sub svo " + ini["servo"]["rate_ms"] + "\n";
-  teensy1.send(s.c_str());
+  teensy1.subscribe("svo", strtol(ini["servo"]["rate_ms"].c_str(), nullptr, 10));
   // debug print
   toConsole = ini["servo"]["print"] == "true";
   // set servo
@@ -36,6 +36,7 @@
 #include "bplan40.h"
 #include "bplan100.h"
 #include "bplan101.h"
+#include "bmission.h"
 
 
 int main (int argc, char **argv)
@@ -53,6 +54,8 @@ int main (int argc, char **argv)
     plan40.run();
     plan100.run();
     plan101.run();
+    // and a mission from file (if any)
+    mission.run();
     //
     mixer.setVelocity(0.0);
     mixer.setTurnrate(0.0);
@@ -31,10 +31,14 @@
 #include <string.h>
 #include <math.h>
 #include <opencv2/aruco.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
 #include <filesystem>
 #include "maruco.h"
 #include "uservice.h"
 #include "scam.h"
+#include "mpose.h"
+#include "uevent.h"
 
 // create value
 MArUco aruco;
@@ -50,11 +54,69 @@ void MArUco::setup()
     ini["aruco"]["log"] = "true";
     ini["aruco"]["print"] = "true";
   }
+  if (not ini["aruco"].has("saveQueue"))
+  { // detector tuning (see cv::aruco::DetectorParameters)
+    ini["aruco"]["saveQueue"] = "4"; // max images waiting to be saved
+    ini["aruco"]["adaptiveWin"] = "3 23 10"; // threshold window min, max, step (pixels)
+    ini["aruco"]["minPerimeterRate"] = "0.03"; // smallest marker relative to image size
+    ini["aruco"]["cornerRefine"] = "none"; // none, subpix or contour
+  }
+  if (not ini["aruco"].has("track"))
+  { // look for known markers near last position only
+    ini["aruco"]["track"] = "false";
+    ini["aruco"]["trackPad"] = "0.5"; // added on each side (fraction of marker size)
+    ini["aruco"]["trackMaxAge"] = "0.5"; // sec
+    ini["aruco"]["trackTurnShift"] = "true"; // move region using robot turnrate
+    ini["aruco"]["trackFullEvery"] = "10"; // full search to find new markers
+    ini["aruco"]["searchScale"] = "0.5"; // downscale full search (1 = no downscale)
+  }
+  if (not ini["aruco"].has("threads"))
+  { // full frame search in tiles using more threads
+    ini["aruco"]["threads"] = "1"; // 1 is no tiles
+    ini["aruco"]["tileOverlap"] = "120"; // pixels (larger markers are found in a downscaled pass)
+  }
+  if (not ini["aruco"].has("service"))
+  { // detect in all frames and keep filtered marker positions
+    ini["aruco"]["service"] = "false";
+    ini["aruco"]["serviceSize"] = "0.1"; // marker size (m)
+    ini["aruco"]["measNoise"] = "0.02 0.1"; // position (m per m distance), heading (rad)
+    ini["aruco"]["driftNoise"] = "0.01"; // odometry drift (m/sqrt(sec))
+  }
   // get values from ini-file
   fs::create_directory(ini["aruco"]["imagepath"]);
   //
   debugSave = ini["aruco"]["save"] == "true";
   toConsole = ini["aruco"]["print"] == "true";
+  saveQueueMax = strtol(ini["aruco"]["saveQueue"].c_str(), nullptr, 10);
+  track = ini["aruco"]["track"] == "true";
+  trackPad = strtof(ini["aruco"]["trackPad"].c_str(), nullptr);
+  trackMaxAge = strtof(ini["aruco"]["trackMaxAge"].c_str(), nullptr);
+  trackTurnShift = ini["aruco"]["trackTurnShift"] == "true";
+  trackFullEvery = strtol(ini["aruco"]["trackFullEvery"].c_str(), nullptr, 10);
+  searchScale = strtof(ini["aruco"]["searchScale"].c_str(), nullptr);
+  if (searchScale <= 0.05 or searchScale > 1.0)
+    searchScale = 1.0;
+  tileOverlap = strtol(ini["aruco"]["tileOverlap"].c_str(), nullptr, 10);
+  int threads = strtol(ini["aruco"]["threads"].c_str(), nullptr, 10);
+  if (threads > 1)
+    pool.setup(threads);
+  // the map is in odometry coordinates
+  pose.onReset([this](float x, float y, float h){ rebaseMap(x, y, h); });
+  //
+  // detector is made once only
+  dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
+  detectorParams = cv::aruco::DetectorParameters::create();
+  const char * p1 = ini["aruco"]["adaptiveWin"].c_str();
+  detectorParams->adaptiveThreshWinSizeMin = strtol(p1, (char**)&p1, 10);
+  detectorParams->adaptiveThreshWinSizeMax = strtol(p1, (char**)&p1, 10);
+  detectorParams->adaptiveThreshWinSizeStep = strtol(p1, (char**)&p1, 10);
+  detectorParams->minMarkerPerimeterRate = strtod(ini["aruco"]["minPerimeterRate"].c_str(), nullptr);
+  if (ini["aruco"]["cornerRefine"] == "subpix")
+    detectorParams->cornerRefinementMethod = cv::aruco::CORNER_REFINE_SUBPIX;
+  else if (ini["aruco"]["cornerRefine"] == "contour")
+    detectorParams->cornerRefinementMethod = cv::aruco::CORNER_REFINE_CONTOUR;
+  else
+    detectorParams->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
   //
   if (ini["aruco"]["log"] == "true")
   { // open logfile
@@ -68,11 +130,41 @@ void MArUco::setup()
     fprintf(logfile, "%% 5,6,7 \tDetected marker position in camera coordinates (x=right, y=down, z=forward)\n");
     fprintf(logfile, "%% 8,9,10 \tDetected marker orientation in Rodrigues notation (vector, rotated)\n");
   }
+  if (debugSave)
+    // start image save thread
+    th1 = new std::thread(runObj, this);
+  //
+  useService = ini["aruco"]["service"] == "true";
+  serviceSize = strtof(ini["aruco"]["serviceSize"].c_str(), nullptr);
+  p1 = ini["aruco"]["measNoise"].c_str();
+  measNoise = strtof(p1, (char**)&p1);
+  measNoiseH = strtof(p1, (char**)&p1);
+  driftNoise = strtof(ini["aruco"]["driftNoise"].c_str(), nullptr);
+  if (useService and cam.isOpen())
+  { // use all frames from camera
+    cam.subscribe();
+    th2 = new std::thread(runServiceObj, this);
+  }
 }
 
 
 void MArUco::terminate()
 { // wait for thread to finish
+  if (th2 != nullptr)
+  {
+    th2->join();
+    th2 = nullptr;
+    cam.unsubscribe();
+  }
+  pool.terminate();
+  if (th1 != nullptr)
+  {
+    saveReady.notify_all();
+    th1->join();
+    th1 = nullptr;
+  }
+  if (saveDropped > 0)
+    printf("# MArUco:: dropped %d debug images (save queue full)\n", saveDropped);
   if (logfile != nullptr)
   {
     fclose(logfile);
@@ -97,19 +189,42 @@ void MArUco::toLog(const char * message)
 
 
 int MArUco::findAruco(float size, cv::Mat * sourcePtr)
+{
+  ArUcoResult result;
+  return findAruco(size, result, sourcePtr);
+}
+
+int MArUco::findAruco(float size, ArUcoResult & result, cv::Mat * sourcePtr)
 { // taken from https://docs.opencv.org
-  int count = 0;
+  std::lock_guard<std::mutex> lock(findLock);
   cv::Mat frame;
-  cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
   if (sourcePtr == nullptr)
   {
-    frame = cam.getFrameRaw();
-    imgTime = cam.imgTime;
+    UCamFrame f = cam.getFrameRaw();
+    frame = f.img;
+    imgTime = f.time;
   }
   else
-  {
-    frame = *sourcePtr;
+  { // the caller may reuse the image, so the save thread needs its own copy
+    if (debugSave)
+      frame = sourcePtr->clone();
+    else
+      frame = *sourcePtr;
+    // no capture time for this image, so use now
+    imgTime.now();
   }
+  int count = detect(size, frame, true);
+  // copy, as the ArUco service may detect again, when the lock is released
+  result.imgTime = imgTime;
+  result.code = arCode;
+  result.translate = arTranslate;
+  result.rotate = arRotate;
+  return count;
+}
+
+int MArUco::detect(float size, cv::Mat & frame, bool always)
+{
+  int count = 0;
   //
   // printf("# MVision::findAruco looking for ArUco of size %.3fm\n", size);
   if (frame.empty())
@@ -117,33 +232,551 @@ int MArUco::findAruco(float size, cv::Mat * sourcePtr)
     printf("MVision::findAruco: Failed to get an image\n");
     return 0;
   }
-  cv::Mat img;
-  if (debugSave)
-    frame.copyTo(img);
-  std::vector<std::vector<cv::Point2f>> markerCorners;
-  cv::aruco::detectMarkers(frame, dictionary, markerCorners, arCode);
+  markerCorners.clear();
+  arCode.clear();
+  if (track)
+  { // near last position (or full search)
+    detectTracked(frame);
+    updateTracks();
+  }
+  else
+    detectFull(frame);
   count = arCode.size();
   // estimate pose of all markers
   cv::aruco::estimatePoseSingleMarkers(markerCorners, size, cam.cameraMatrix, cam.distCoeffs, arRotate, arTranslate);
   //
   if (debugSave)
-  { // paint found markers in image copy 'img'.
+  { // log found markers
     const int MSL = 200;
     char s[MSL];
-    // draw axis for each marker
     for(int i=0; i<count; i++)
     {
-      cv::aruco::drawAxis(img, cam.cameraMatrix, cam.distCoeffs, arRotate[i], arTranslate[i], 0.1);
       snprintf(s, MSL, "%d %d %g %g %g %g  %g %g %g", i, arCode[i], size,
                arTranslate[i][0], arTranslate[i][1], arTranslate[i][2],
                arRotate[i][0], arRotate[i][1], arRotate[i][2]);
       toLog(s);
     }
-    saveImageTimestamped(img, imgTime);
+  }
+  if (debugSave and (always or count > 0))
+  { // painting and saving is done by the save thread,
+    // the service saves only images with markers
+    std::lock_guard<std::mutex> lock(saveLock);
+    if ((int)saveQueue.size() < saveQueueMax)
+    { // the frame is not changed (and not reused), so no copy is needed here
+      saveQueue.push_back({frame, imgTime, arRotate, arTranslate});
+      saveReady.notify_one();
+    }
+    else
+      saveDropped++;
   }
   return count;
 }
 
+int MArUco::detectInRoi(const cv::Mat & frame, cv::Rect roi, float scale)
+{
+  std::vector<std::vector<cv::Point2f>> corners;
+  std::vector<int> ids;
+  // roi is a view into the frame
+  cv::aruco::detectMarkers(frame(roi), dictionary, corners, ids, detectorParams);
+  int n = 0;
+  for (int i = 0; i < (int)ids.size(); i++)
+  {
+    for (auto & c : corners[i])
+    { // to full frame coordinates
+      c.x = (c.x + roi.x) / scale;
+      c.y = (c.y + roi.y) / scale;
+    }
+    // the same ID may be on more markers, so the same ID in another place is new
+    if (findDetected(ids[i], corners[i]) >= 0)
+      continue;
+    markerCorners.push_back(corners[i]);
+    arCode.push_back(ids[i]);
+    n++;
+  }
+  return n;
+}
+
+int MArUco::findDetected(int id, const std::vector<cv::Point2f> & corners)
+{
+  cv::Point2f c = center(corners);
+  float side = cv::norm(corners[0] - corners[1]);
+  for (int j = 0; j < (int)arCode.size(); j++)
+  {
+    if (arCode[j] == id)
+    { // same code, same place?
+      cv::Point2f d = center(markerCorners[j]) - c;
+      if (d.x * d.x + d.y * d.y < side * side * 0.25)
+        return j;
+    }
+  }
+  return -1;
+}
+
+cv::Point2f MArUco::center(const std::vector<cv::Point2f> & corners)
+{
+  cv::Point2f c(0,0);
+  for (auto & p : corners)
+    c += p;
+  return c * 0.25;
+}
+
+void MArUco::detectSearch(const cv::Mat & frame)
+{
+  cv::Rect all(0, 0, frame.cols, frame.rows);
+  if (searchScale >= 1.0)
+  { // full frame, full resolution
+    detectFull(frame);
+    return;
+  }
+  // search in a downscaled image
+  cv::Mat small;
+  cv::resize(frame, small, cv::Size(), searchScale, searchScale, cv::INTER_AREA);
+  detectInRoi(small, cv::Rect(0, 0, small.cols, small.rows), searchScale);
+  // and redo in full resolution near the markers found
+  std::vector<std::vector<cv::Point2f>> coarse;
+  coarse.swap(markerCorners);
+  arCode.clear();
+  for (auto & c : coarse)
+  {
+    cv::Rect box = cv::boundingRect(c);
+    int pad = roundf(trackPad * std::max(box.width, box.height)) + 4;
+    box.x -= pad;
+    box.y -= pad;
+    box.width += 2 * pad;
+    box.height += 2 * pad;
+    box &= all;
+    if (not box.empty())
+      detectInRoi(frame, box);
+  }
+}
+
+void MArUco::detectFull(const cv::Mat & frame)
+{
+  if (pool.size() > 1)
+    detectTiled(frame);
+  else
+    cv::aruco::detectMarkers(frame, dictionary, markerCorners, arCode, detectorParams);
+}
+
+void MArUco::detectTiled(const cv::Mat & frame)
+{
+  int n = pool.size();
+  // tile layout: 2 = 2x1, 3 = 3x1, 4 = 2x2, ...
+  int ny = (n >= 4) ? 2 : 1;
+  int nx = (n + ny - 1) / ny;
+  int tw = (frame.cols + nx - 1) / nx;
+  int th = (frame.rows + ny - 1) / ny;
+  cv::Rect all(0, 0, frame.cols, frame.rows);
+  std::vector<cv::Rect> tiles;
+  for (int y = 0; y < ny; y++)
+    for (int x = 0; x < nx; x++)
+    { // overlap, so that a marker is fully inside at least one tile
+      cv::Rect r(x * tw - tileOverlap/2, y * th - tileOverlap/2,
+                 tw + tileOverlap, th + tileOverlap);
+      tiles.push_back(r & all);
+    }
+  // one detection per tile
+  std::vector<std::vector<std::vector<cv::Point2f>>> corners(tiles.size());
+  std::vector<std::vector<int>> ids(tiles.size());
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < (int)tiles.size(); i++)
+  {
+    done.push_back(pool.add([this, &frame, &tiles, &corners, &ids, i]()
+    {
+      cv::aruco::detectMarkers(frame(tiles[i]), dictionary, corners[i], ids[i], detectorParams);
+    }));
+  }
+  // a marker larger than the overlap may be split by a tile seam,
+  // it is large, so it is found in a downscaled full frame
+  // (a marker of tileOverlap pixels is then about 32 pixels)
+  float scale = std::min(0.5f, 32.0f / std::max(tileOverlap, 1));
+  std::vector<std::vector<cv::Point2f>> bigCorners;
+  std::vector<int> bigIds;
+  done.push_back(pool.add([this, &frame, &bigCorners, &bigIds, scale]()
+  {
+    cv::Mat small;
+    cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    cv::aruco::detectMarkers(small, dictionary, bigCorners, bigIds, detectorParams);
+  }));
+  for (auto & d : done)
+    d.wait();
+  // merge, a marker in the overlap is found in more tiles
+  for (int t = 0; t < (int)tiles.size(); t++)
+  {
+    for (int i = 0; i < (int)ids[t].size(); i++)
+    {
+      for (auto & p : corners[t][i])
+      { // to full frame coordinates
+        p.x += tiles[t].x;
+        p.y += tiles[t].y;
+      }
+      if (findDetected(ids[t][i], corners[t][i]) < 0)
+      {
+        markerCorners.push_back(corners[t][i]);
+        arCode.push_back(ids[t][i]);
+      }
+    }
+  }
+  // markers missed by the tiles, redo in full resolution for precise corners
+  for (int i = 0; i < (int)bigIds.size(); i++)
+  {
+    for (auto & p : bigCorners[i])
+    { // to full frame coordinates
+      p.x /= scale;
+      p.y /= scale;
+    }
+    if (findDetected(bigIds[i], bigCorners[i]) < 0)
+    {
+      cv::Rect box = cv::boundingRect(bigCorners[i]);
+      int pad = box.width / 4 + 4;
+      box.x -= pad;
+      box.y -= pad;
+      box.width += 2 * pad;
+      box.height += 2 * pad;
+      box &= all;
+      if (not box.empty())
+        tileFallbackCnt += detectInRoi(frame, box);
+    }
+  }
+}
+
+void MArUco::detectTracked(const cv::Mat & frame)
+{
+  cv::Rect all(0, 0, frame.cols, frame.rows);
+  // remove old tracks
+  for (int i = tracks.size() - 1; i >= 0; i--)
+  {
+    if (imgTime - tracks[i].seen > trackMaxAge)
+      tracks.erase(tracks.begin() + i);
+  }
+  bool lost = tracks.empty();
+  if (trackFullEvery > 0 and ++trackCnt >= trackFullEvery)
+  { // search all now and then, to find new markers
+    trackCnt = 0;
+    lost = true;
+  }
+  if (not lost)
+  {
+    float fx = cam.cameraMatrix.at<double>(0,0);
+    for (auto & t : tracks)
+    { // predict region - a left turn moves the image to the right
+      cv::Rect box = t.box;
+      if (trackTurnShift)
+        box.x += roundf(pose.turnrate * (imgTime - t.seen) * fx);
+      int pad = roundf(trackPad * std::max(box.width, box.height)) + 4;
+      box.x -= pad;
+      box.y -= pad;
+      box.width += 2 * pad;
+      box.height += 2 * pad;
+      box &= all;
+      if (box.empty() or detectInRoi(frame, box) == 0)
+      { // nothing new in region, may be found from an overlapping region
+        bool found = false;
+        for (int j = 0; j < (int)arCode.size() and not found; j++)
+          found = arCode[j] == t.id and box.contains(center(markerCorners[j]));
+        if (not found)
+          lost = true;
+      }
+    }
+  }
+  if (lost)
+  { // full search, keep markers found already
+    std::vector<std::vector<cv::Point2f>> corners;
+    std::vector<int> ids;
+    corners.swap(markerCorners);
+    ids.swap(arCode);
+    detectSearch(frame);
+    for (int i = 0; i < (int)ids.size(); i++)
+    {
+      if (findDetected(ids[i], corners[i]) < 0)
+      {
+        markerCorners.push_back(corners[i]);
+        arCode.push_back(ids[i]);
+      }
+    }
+  }
+}
+
+void MArUco::updateTracks()
+{
+  std::vector<bool> used(tracks.size(), false);
+  for (int i = 0; i < (int)arCode.size(); i++)
+  { // nearest unused track with this ID, the same ID may be on more markers
+    cv::Point2f c = center(markerCorners[i]);
+    cv::Rect box = cv::boundingRect(markerCorners[i]);
+    // max distance is the padded region used for tracking
+    float maxDist = (1.0 + trackPad) * std::max(box.width, box.height) + 4;
+    if (trackTurnShift)
+      maxDist += fabs(pose.turnrate * trackMaxAge * cam.cameraMatrix.at<double>(0,0));
+    int best = -1;
+    float bestDist = maxDist;
+    for (int j = 0; j < (int)tracks.size(); j++)
+    {
+      if (used[j] or tracks[j].id != arCode[i])
+        continue;
+      cv::Rect & tb = tracks[j].box;
+      cv::Point2f d = c - cv::Point2f(tb.x + tb.width/2.0, tb.y + tb.height/2.0);
+      float dist = sqrt(d.x * d.x + d.y * d.y);
+      if (dist < bestDist)
+      {
+        best = j;
+        bestDist = dist;
+      }
+    }
+    if (best < 0)
+    {
+      tracks.push_back(Track());
+      used.push_back(false);
+      best = tracks.size() - 1;
+      tracks[best].id = arCode[i];
+    }
+    used[best] = true;
+    tracks[best].box = box;
+    tracks[best].seen = imgTime;
+  }
+}
+
+void MArUco::runService()
+{
+  int seq = 0;
+  while (not service.stop)
+  {
+    UCamFrame f;
+    if (cam.waitForNext(f, seq, 0.5))
+    {
+      seq = f.seq;
+      std::lock_guard<std::mutex> lock(findLock);
+      imgTime = f.time;
+      if (detect(serviceSize, f.img, false) > 0)
+        updateMap();
+    }
+  }
+}
+
+void MArUco::updateMap()
+{ // robot pose when the image was taken
+  int resetCnt = pose.resetCnt;
+  float px, py, h;
+  if (not pose.getPoseAt(imgTime, px, py, h))
+    // no pose for this image (e.g. taken before a pose reset)
+    return;
+  float ch = cos(h);
+  float sh = sin(h);
+  std::lock_guard<std::mutex> lock(mapLock);
+  if (resetCnt != pose.resetCnt)
+    // pose is reset since getPoseAt, the map is in new coordinates
+    return;
+  for (int i = 0; i < (int)arCode.size(); i++)
+  {
+    cv::Vec3d pr = cam.getPositionInRobotCoordinates(arTranslate[i]);
+    cv::Vec3d er = cam.getOrientationInRobotEulerAngles(arRotate[i]);
+    // to odometry coordinates
+    cv::Vec3d po(px + ch * pr[0] - sh * pr[1],
+                 py + sh * pr[0] + ch * pr[1],
+                 pr[2]);
+    float ho = h + er[2];
+    // measurement variance grows with distance
+    float dist = sqrt(pr[0] * pr[0] + pr[1] * pr[1]);
+    float sd = measNoise * dist + 0.005;
+    float r = sd * sd;
+    float rh = measNoiseH * measNoiseH;
+    ArUcoMarker * m = nullptr;
+    for (auto & mm : markers)
+    {
+      if (mm.id == arCode[i])
+      {
+        m = &mm;
+        break;
+      }
+    }
+    if (m == nullptr)
+    { // new marker
+      markers.push_back(ArUcoMarker());
+      m = &markers.back();
+      m->id = arCode[i];
+      m->odo = po;
+      m->odoH = ho;
+      m->var = cv::Vec3d(r, r, r);
+      m->varH = rh;
+    }
+    else
+    { // predict - odometry drift since last seen
+      float dt = imgTime - m->seen;
+      float q = driftNoise * driftNoise * fabs(dt);
+      for (int j = 0; j < 3; j++)
+      { // and update (scalar Kalman for each axis)
+        m->var[j] += q;
+        float k = m->var[j] / (m->var[j] + r);
+        m->odo[j] += k * (po[j] - m->odo[j]);
+        m->var[j] *= 1.0 - k;
+      }
+      float k = m->varH / (m->varH + rh);
+      float dh = ho - m->odoH;
+      // shortest angle
+      dh = atan2(sin(dh), cos(dh));
+      m->odoH += k * dh;
+      m->odoH = atan2(sin(m->odoH), cos(m->odoH));
+      m->varH *= 1.0 - k;
+    }
+    m->seen = imgTime;
+    m->count++;
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "map %d %d %.3f %.3f %.3f %.3f  %.2g %.2g", m->id, m->count,
+             m->odo[0], m->odo[1], m->odo[2], m->odoH, sqrt(m->var[0]), sqrt(m->varH));
+    toLog(s);
+  }
+  if (not arCode.empty())
+    events.notify(UEvent::ARUCO);
+}
+
+void MArUco::toRobot(ArUcoMarker & m)
+{ // from odometry to robot coordinates (using current pose)
+  float px, py, ph;
+  pose.getPose(px, py, ph);
+  float ch = cos(ph);
+  float sh = sin(ph);
+  float dx = m.odo[0] - px;
+  float dy = m.odo[1] - py;
+  m.robot = cv::Vec3d(ch * dx + sh * dy, -sh * dx + ch * dy, m.odo[2]);
+  m.robotH = atan2(sin(m.odoH - ph), cos(m.odoH - ph));
+  UTime t("now");
+  m.age = t - m.seen;
+}
+
+void MArUco::rebaseMap(float x, float y, float h)
+{ // the pose (x, y, h) is the new origin
+  std::lock_guard<std::mutex> lock(mapLock);
+  float ch = cos(h);
+  float sh = sin(h);
+  for (auto & m : markers)
+  {
+    float dx = m.odo[0] - x;
+    float dy = m.odo[1] - y;
+    m.odo[0] = ch * dx + sh * dy;
+    m.odo[1] = -sh * dx + ch * dy;
+    m.odoH = atan2(sin(m.odoH - h), cos(m.odoH - h));
+  }
+}
+
+bool MArUco::getMarker(int id, ArUcoMarker & m)
+{
+  std::lock_guard<std::mutex> lock(mapLock);
+  for (auto & mm : markers)
+  {
+    if (mm.id == id)
+    {
+      m = mm;
+      toRobot(m);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<ArUcoMarker> MArUco::getAll(float maxAge)
+{
+  std::vector<ArUcoMarker> result;
+  std::lock_guard<std::mutex> lock(mapLock);
+  for (auto & mm : markers)
+  {
+    ArUcoMarker m = mm;
+    toRobot(m);
+    if (m.age <= maxAge)
+      result.push_back(m);
+  }
+  return result;
+}
+
+void MArUco::run()
+{
+  while (true)
+  {
+    SaveJob job;
+    {
+      std::unique_lock<std::mutex> lock(saveLock);
+      saveReady.wait_for(lock, std::chrono::milliseconds(100),
+                         [this]{ return not saveQueue.empty() or service.stop; });
+      if (saveQueue.empty())
+      {
+        if (service.stop)
+          break;
+        continue;
+      }
+      job = saveQueue.front();
+      saveQueue.pop_front();
+    }
+    // paint found markers in a copy of the image
+    cv::Mat img;
+    job.frame.copyTo(img);
+    // draw axis for each marker
+    for (int i = 0; i < (int)job.rotate.size(); i++)
+      cv::aruco::drawAxis(img, cam.cameraMatrix, cam.distCoeffs, job.rotate[i], job.translate[i], 0.1);
+    saveImageTimestamped(img, job.imgTime);
+  }
+}
+
+void MArUco::bench()
+{
+  if (th2 != nullptr)
+  { // the service uses the thread pool, that is replaced below
+    printf("# MArUco::bench: not while the ArUco service runs (set [aruco] service = false)\n");
+    return;
+  }
+  std::vector<cv::String> images;
+  std::string path = ini["camera"]["imagepath"] + "/*.jpg";
+  cv::glob(path, images);
+  if (images.empty())
+  {
+    printf("# MArUco::bench: no images in %s\n", path.c_str());
+    return;
+  }
+  std::vector<cv::Mat> imgs;
+  for (auto & fn : images)
+  {
+    cv::Mat img = cv::imread(fn);
+    if (not img.empty())
+      imgs.push_back(img);
+  }
+  printf("# MArUco::bench: %d images from %s\n", (int)imgs.size(), path.c_str());
+  // no tracking and no image save
+  bool wasTrack = track;
+  bool wasSave = debugSave;
+  track = false;
+  debugSave = false;
+  const int repeat = 5;
+  float t1 = 0;
+  for (int threads = 1; threads <= 4; threads++)
+  {
+    if (threads > 1)
+      pool.setup(threads);
+    else
+      pool.terminate();
+    int found = 0;
+    tileFallbackCnt = 0;
+    UTime t("now");
+    for (int r = 0; r < repeat; r++)
+      for (auto & img : imgs)
+        found += findAruco(0.1, &img);
+    float dt = t.getTimePassed() / (repeat * imgs.size());
+    if (threads == 1)
+      t1 = dt;
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "# bench aruco threads=%d, %.1f ms per image, speedup %.2f, found %d (%d by large marker pass), overlap %d",
+             threads, dt * 1000, t1/dt, found / repeat, tileFallbackCnt / repeat, tileOverlap);
+    printf("%s\n", s);
+    toLog(s);
+  }
+  track = wasTrack;
+  debugSave = wasSave;
+  int threads = strtol(ini["aruco"]["threads"].c_str(), nullptr, 10);
+  if (threads > 1)
+    pool.setup(threads);
+  else
+    pool.terminate();
+}
+
 void MArUco::saveImageInPath(cv::Mat& img, string name)
 { // Note, file type must be in filename
   const int MSL = 500;
@@ -170,7 +803,9 @@ void MArUco::saveCodeImage(int arucoID)
 {
   cv::Mat markerImage;
   int pixSize = 240;
-  cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
+  if (dictionary == nullptr)
+    // may be called before setup()
+    dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_250);
   cv::aruco::drawMarker(dictionary, arucoID, pixSize, markerImage, 1);
   saveImageInPath(markerImage, string("marker_") + to_string(arucoID) + ".png");
 }
@@ -22,11 +22,50 @@
 
 #pragma once
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <opencv2/core.hpp>
+#include <opencv2/aruco.hpp>
 #include "utime.h"
+#include "uthreadpool.h"
 
 using namespace std;
 
+/**
+ * Filtered estimate of one marker (from the ArUco service) */
+struct ArUcoMarker
+{
+  int id = -1;
+  /// position (x,y,z) and heading in odometry coordinates
+  cv::Vec3d odo;
+  float odoH = 0;
+  /// position and heading relative to robot now (from current pose)
+  cv::Vec3d robot;
+  float robotH = 0;
+  /// variance of odo position (x,y,z) and heading (covariance is diagonal)
+  cv::Vec3d var;
+  float varH = 0;
+  /// time of last detection and age (sec) when queried
+  UTime seen;
+  float age = 0;
+  /// number of detections used
+  int count = 0;
+};
+
+/**
+ * Result of one ArUco detection, a copy that is not changed by later detections */
+struct ArUcoResult
+{
+  /// capture time of the image
+  UTime imgTime;
+  /// marker code, position and orientation (Rodrigues) in camera coordinates
+  std::vector<int> code;
+  std::vector<cv::Vec3d> translate;
+  std::vector<cv::Vec3d> rotate;
+};
+
 /**
  * Class with example of vision processing
  * */
@@ -45,13 +84,33 @@ public:
    * this pointer is a nullptr (default), then a frame is taken from camera.
    * \returns the number of codes found. */
   int findAruco(float size, cv::Mat * sourcePtr = nullptr);
+  /**
+   * Find ArUco code and get a copy of the result.
+   * \param size is the side-size of the code.
+   * \param result is set to the markers found (taken under the detector lock,
+   *               so the ArUco service can not change it)
+   * \param sourcePth is a potential source image, else a frame from camera.
+   * \returns the number of codes found. */
+  int findAruco(float size, ArUcoResult & result, cv::Mat * sourcePtr = nullptr);
   /**
    * Make an image with this ArUco ID */
   void saveCodeImage(int arucoID);
-
-  std::vector<cv::Vec3d> arTranslate;
-  std::vector<cv::Vec3d> arRotate;
-  std::vector<int> arCode;
+  /**
+   * Measure detection time using 1 to 4 threads
+   * on the images in ini[camera][imagepath] (*.jpg) */
+  void bench();
+  /**
+   * Get the filtered estimate for this marker (ArUco service, ini aruco.service)
+   * This does not wait for a camera frame.
+   * \param id is the marker ID
+   * \param m is set to the marker estimate
+   * \returns false if the marker is not seen */
+  bool getMarker(int id, ArUcoMarker & m);
+  /**
+   * Get all markers seen within this time
+   * \param maxAge is max age in seconds
+   * \returns the markers */
+  std::vector<ArUcoMarker> getAll(float maxAge = 1e6);
 
 protected:
   /// PC time of last update
@@ -63,12 +122,140 @@ private:
   /**
    * print to console and logfile */
   void toLog(const char * message);
+  /**
+   * Detect and estimate pose in this frame (findLock must be locked)
+   * \param always save a debug image (if enabled), else only if a marker is found
+   * \returns number of markers found */
+  int detect(float size, cv::Mat & frame, bool always);
+  /// result of last detection (use only with findLock locked)
+  std::vector<cv::Vec3d> arTranslate;
+  std::vector<cv::Vec3d> arRotate;
+  std::vector<int> arCode;
+  /// serialize use of detector state and results
+  std::mutex findLock;
+  /**
+   * ArUco service thread - detect in every camera frame
+   * and update the marker map */
+  void runService();
+  static void runServiceObj(MArUco * obj)
+  {
+    obj->runService();
+  }
+  /** update the marker map from the last detection */
+  void updateMap();
+  /** set robot relative values from current pose */
+  void toRobot(ArUcoMarker & m);
+  /**
+   * Move the map to new odometry coordinates, after a pose reset
+   * \param x, y, h is the pose just before the reset */
+  void rebaseMap(float x, float y, float h);
+  std::thread * th2 = nullptr;
+  std::vector<ArUcoMarker> markers;
+  std::mutex mapLock;
+  /// service settings
+  bool useService = false;
+  float serviceSize = 0.1;
+  /// measurement noise (m per m distance), heading (rad)
+  float measNoise = 0.02;
+  float measNoiseH = 0.1;
+  /// odometry drift (m/sqrt(sec))
+  float driftNoise = 0.01;
   /// Debug print
   bool toConsole = false;
   /// Logfile - most details
   FILE * logfile = nullptr;
   /// save debug images
   bool debugSave = false;
+  /// detector, made once in setup()
+  cv::Ptr<cv::aruco::Dictionary> dictionary;
+  cv::Ptr<cv::aruco::DetectorParameters> detectorParams;
+  /// reused buffer for detected corners
+  std::vector<std::vector<cv::Point2f>> markerCorners;
+  /**
+   * Find a detected marker with this ID at this position
+   * (center within half a side), the same ID may be used on more markers.
+   * \returns index in arCode (and markerCorners), or -1 if not found */
+  int findDetected(int id, const std::vector<cv::Point2f> & corners);
+  /** center of the 4 marker corners */
+  static cv::Point2f center(const std::vector<cv::Point2f> & corners);
+  /**
+   * Detect markers in this region of the frame (a view, not a copy),
+   * corners are converted to full frame coordinates and
+   * added to markerCorners and arCode, if not found at this position already.
+   * \param scale is the scale of frame relative to full image (1 = full resolution)
+   * \returns number of new markers */
+  int detectInRoi(const cv::Mat & frame, cv::Rect roi, float scale = 1.0);
+  /**
+   * Find markers using the tracked regions,
+   * falls back to full (or downscaled) search, if a marker is lost */
+  void detectTracked(const cv::Mat & frame);
+  /**
+   * Search full frame, possibly downscaled and then
+   * refined in full resolution regions */
+  void detectSearch(const cv::Mat & frame);
+  /**
+   * Search full frame, split in overlapping tiles,
+   * one tile for each thread in the pool.
+   * Markers larger than the overlap are found by
+   * a downscaled full frame pass in parallel. */
+  void detectTiled(const cv::Mat & frame);
+  /**
+   * Search the full frame, tiled if more than one thread */
+  void detectFull(const cv::Mat & frame);
+  /// worker threads for tiled detection (ini aruco.threads)
+  UThreadPool pool;
+  /// tile overlap (pixels), larger markers are found by the downscaled pass
+  int tileOverlap = 120;
+  /// markers found by the downscaled pass only (for bench)
+  int tileFallbackCnt = 0;
+  /** update tracked regions from markerCorners (matched by ID and position) */
+  void updateTracks();
+  /**
+   * Tracked marker - image region at last detection */
+  struct Track
+  {
+    int id;
+    cv::Rect box;
+    UTime seen;
+  };
+  std::vector<Track> tracks;
+  /// tracking mode (ini aruco.track)
+  bool track = false;
+  /// padding of tracked region (fraction of marker size on each side)
+  float trackPad = 0.5;
+  /// max age of a track (sec)
+  float trackMaxAge = 0.5;
+  /// shift predicted region using robot turnrate
+  bool trackTurnShift = true;
+  /// full search every this number of frames (to find new markers)
+  int trackFullEvery = 10;
+  int trackCnt = 0;
+  /// downscale for the fallback search (1 = full frame)
+  float searchScale = 1.0;
+  /**
+   * An image to be annotated and saved by the save thread */
+  struct SaveJob
+  {
+    cv::Mat frame;
+    UTime imgTime;
+    std::vector<cv::Vec3d> rotate;
+    std::vector<cv::Vec3d> translate;
+  };
+  /**
+   * Save thread - draws and saves queued images */
+  void run();
+  static void runObj(MArUco * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  std::thread * th1 = nullptr;
+  std::deque<SaveJob> saveQueue;
+  std::mutex saveLock;
+  std::condition_variable saveReady;
+  /// max images waiting to be saved, newer images are dropped when full
+  int saveQueueMax = 4;
+  int saveDropped = 0;
 };
 
 /**
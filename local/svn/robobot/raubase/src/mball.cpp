@@ -0,0 +1,262 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "mball.h"
+#include "uservice.h"
+#include "scam.h"
+#include "uevent.h"
+
+// create value
+MBall ball;
+
+
+void MBall::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("ball"))
+  { // no data yet, so generate some default values
+    ini["ball"]["enabled"] = "false"; // find balls in all camera frames
+    ini["ball"]["hsvLow"] = "5 120 100"; // hue (0..180), saturation, value (orange)
+    ini["ball"]["hsvHigh"] = "25 255 255";
+    ini["ball"]["scale"] = "0.5"; // downscale before detection
+    ini["ball"]["diameter"] = "0.043"; // m
+    ini["ball"]["minArea"] = "20"; // pixels (in downscaled image)
+    ini["ball"]["minRoundness"] = "0.6"; // area relative to circle in bounding box
+    ini["ball"]["log"] = "true";
+    ini["ball"]["print"] = "false";
+  }
+  // get values from ini-file
+  const char * p1 = ini["ball"]["hsvLow"].c_str();
+  for (int i = 0; i < 3; i++)
+    hsvLow.val[i] = strtol(p1, (char**)&p1, 10);
+  p1 = ini["ball"]["hsvHigh"].c_str();
+  for (int i = 0; i < 3; i++)
+    hsvHigh.val[i] = strtol(p1, (char**)&p1, 10);
+  scale = strtof(ini["ball"]["scale"].c_str(), nullptr);
+  if (scale <= 0.05 or scale > 1.0)
+    scale = 1.0;
+  diameter = strtof(ini["ball"]["diameter"].c_str(), nullptr);
+  minArea = strtol(ini["ball"]["minArea"].c_str(), nullptr, 10);
+  minRoundness = strtof(ini["ball"]["minRoundness"].c_str(), nullptr);
+  toConsole = ini["ball"]["print"] == "true";
+  kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(3,3));
+  //
+  if (ini["ball"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_ball.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Ball detection (%s)\n", fn.c_str());
+    fprintf(logfile, "%% HSV from %s to %s, scale %g, diameter %g m\n",
+            ini["ball"]["hsvLow"].c_str(), ini["ball"]["hsvHigh"].c_str(), scale, diameter);
+    fprintf(logfile, "%% 1 \tTime (sec)\n");
+    fprintf(logfile, "%% 2 \tBall number in this image\n");
+    fprintf(logfile, "%% 3,4 \tBall centre in image (pixels)\n");
+    fprintf(logfile, "%% 5 \tBall radius (pixels)\n");
+    fprintf(logfile, "%% 6,7,8 \tBall position in robot coordinates (x=forward, y=left, z=up)\n");
+  }
+  if (ini["ball"]["enabled"] == "true" and cam.isOpen())
+  { // use all frames from camera
+    cam.subscribe();
+    th1 = new std::thread(runObj, this);
+  }
+}
+
+void MBall::terminate()
+{ // wait for thread to finish
+  if (th1 != nullptr)
+  {
+    th1->join();
+    th1 = nullptr;
+    cam.unsubscribe();
+  }
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+void MBall::toLog(const char * message)
+{
+  if (not service.stop)
+  {
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+    if (toConsole)
+    {
+      printf("%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+  }
+}
+
+void MBall::run()
+{
+  int seq = 0;
+  while (not service.stop)
+  {
+    UCamFrame f;
+    if (cam.waitForNext(f, seq, 0.5))
+    {
+      seq = f.seq;
+      find(f.img, f.time);
+    }
+  }
+}
+
+int MBall::findBalls(cv::Mat * sourcePtr)
+{
+  if (sourcePtr == nullptr)
+  {
+    UCamFrame f = cam.getFrameRaw();
+    return find(f.img, f.time);
+  }
+  // no capture time for this image, so use now
+  UTime t("now");
+  return find(*sourcePtr, t);
+}
+
+int MBall::find(cv::Mat & frame, UTime & frameTime)
+{
+  if (frame.empty())
+  {
+    printf("# MBall::findBalls: Failed to get an image\n");
+    return 0;
+  }
+  // image time is part of the result
+  std::lock_guard<std::mutex> lock(findLock);
+  imgTime = frameTime;
+  // segmentation is done on a smaller image
+  if (scale < 1.0)
+    cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+  else
+    small = frame;
+  cv::cvtColor(small, hsv, cv::COLOR_BGR2HSV);
+  // threshold (vectorized in OpenCV)
+  cv::inRange(hsv, hsvLow, hsvHigh, mask);
+  // remove noise pixels
+  cv::morphologyEx(mask, mask, cv::MORPH_OPEN, kernel);
+  int n = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+  std::vector<cv::Point2f> pix;
+  std::vector<float> rad;
+  // label 0 is background
+  for (int i = 1; i < n; i++)
+  {
+    int area = stats.at<int>(i, cv::CC_STAT_AREA);
+    int w = stats.at<int>(i, cv::CC_STAT_WIDTH);
+    int h = stats.at<int>(i, cv::CC_STAT_HEIGHT);
+    if (area < minArea)
+      continue;
+    // round: bounding box is square-ish and filled like a circle
+    float r = (w + h) / 4.0;
+    float roundness = area / (M_PI * r * r);
+    if (w > 2 * h or h > 2 * w or roundness < minRoundness)
+      continue;
+    pix.push_back(cv::Point2f(centroids.at<double>(i, 0) / scale,
+                              centroids.at<double>(i, 1) / scale));
+    rad.push_back(r / scale);
+  }
+  // position from known diameter
+  std::vector<cv::Point2f> rectified;
+  std::vector<cv::Vec3d> pos;
+  if (not pix.empty() and not cam.cameraMatrix.empty())
+  {
+    cam.undistortPoints(pix, rectified);
+    double f = cam.cameraMatrix.at<double>(0,0);
+    double cx = cam.cameraMatrix.at<double>(0,2);
+    double cy = cam.cameraMatrix.at<double>(1,2);
+    for (int i = 0; i < (int)rectified.size(); i++)
+    { // camera coordinates (x=right, y=down, z=forward)
+      double z = f * diameter / (2.0 * rad[i]);
+      cv::Vec3d pc((rectified[i].x - cx) * z / f, (rectified[i].y - cy) * z / f, z);
+      pos.push_back(cam.getPositionInRobotCoordinates(pc));
+    }
+  }
+  ballPixel = pix;
+  ballRadius = rad;
+  ballPos = pos;
+  updateCnt++;
+  events.notify(UEvent::BALL);
+  const int MSL = 200;
+  char s[MSL];
+  for (int i = 0; i < (int)ballPos.size(); i++)
+  {
+    snprintf(s, MSL, "%d %.1f %.1f %.1f %.3f %.3f %.3f", i,
+             ballPixel[i].x, ballPixel[i].y, ballRadius[i],
+             ballPos[i][0], ballPos[i][1], ballPos[i][2]);
+    toLog(s);
+  }
+  return pix.size();
+}
+
+UTime MBall::getBalls(std::vector<cv::Vec3d> & pos, std::vector<cv::Point2f> * pixel,
+                      std::vector<float> * radius, int * cnt)
+{
+  std::lock_guard<std::mutex> lock(findLock);
+  pos = ballPos;
+  if (pixel != nullptr)
+    *pixel = ballPixel;
+  if (radius != nullptr)
+    *radius = ballRadius;
+  if (cnt != nullptr)
+    *cnt = updateCnt;
+  return imgTime;
+}
+
+void MBall::bench()
+{
+  std::vector<cv::String> images;
+  std::string path = ini["camera"]["imagepath"] + "/*.jpg";
+  cv::glob(path, images);
+  std::vector<cv::Mat> imgs;
+  for (auto & fn : images)
+  {
+    cv::Mat img = cv::imread(fn);
+    if (not img.empty())
+      imgs.push_back(img);
+  }
+  if (imgs.empty())
+  {
+    printf("# MBall::bench: no images in %s\n", path.c_str());
+    return;
+  }
+  const int repeat = 5;
+  int found = 0;
+  UTime t("now");
+  for (int r = 0; r < repeat; r++)
+    for (auto & img : imgs)
+      found += findBalls(&img);
+  float dt = t.getTimePassed() / (repeat * imgs.size());
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "# bench ball %d images, %.1f ms per image (scale %g), found %d",
+           (int)imgs.size(), dt * 1000, scale, found / repeat);
+  printf("%s\n", s);
+  // toLog uses imgTime
+  std::lock_guard<std::mutex> lock(findLock);
+  toLog(s);
+}
@@ -0,0 +1,109 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "utime.h"
+
+using namespace std;
+
+/**
+ * Golf ball detection by colour segmentation.
+ * The image is downscaled, converted to HSV and thresholded,
+ * then balls are found as round connected components.
+ * Ball position is found from the known ball diameter
+ * and converted to robot coordinates.
+ * */
+class MBall
+{
+public:
+  /** setup and start service (if enabled) */
+  void setup();
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Find balls in an image
+   * \param sourcePtr is a pointer to a source image, if
+   * this pointer is a nullptr (default), then a frame is taken from camera.
+   * \returns the number of balls found. */
+  int findBalls(cv::Mat * sourcePtr = nullptr);
+  /**
+   * Get balls found in the last image (thread safe copy)
+   * \param pos is set to ball positions in robot coordinates (x=forward, y=left, z=up)
+   * \param pixel, radius (if not nullptr) are set to ball centre and radius in the image (pixels)
+   * \param cnt (if not nullptr) is set to the number of processed images
+   * \returns time of the image */
+  UTime getBalls(std::vector<cv::Vec3d> & pos, std::vector<cv::Point2f> * pixel = nullptr,
+                 std::vector<float> * radius = nullptr, int * cnt = nullptr);
+  /**
+   * Measure detection time on the images in ini[camera][imagepath] (*.jpg) */
+  void bench();
+
+private:
+  /// result of last image (use getBalls())
+  std::vector<cv::Vec3d> ballPos;
+  /// ball centre (pixels in full image) and radius (pixels)
+  std::vector<cv::Point2f> ballPixel;
+  std::vector<float> ballRadius;
+  /// incremented at every processed image
+  int updateCnt = 0;
+  /**
+   * Find balls in this frame, result and imgTime are updated with findLock locked
+   * \returns the number of balls found */
+  int find(cv::Mat & frame, UTime & frameTime);
+  /// time of image with last result (use getBalls())
+  UTime imgTime;
+  /**
+   * service thread - find balls in all camera frames */
+  void run();
+  static void runObj(MBall * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  /**
+   * print to console and logfile */
+  void toLog(const char * message);
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+  std::thread * th1 = nullptr;
+  std::mutex findLock;
+  /// settings (from ini)
+  cv::Scalar hsvLow;
+  cv::Scalar hsvHigh;
+  float scale = 0.5;
+  float diameter = 0.043;
+  int minArea = 20;
+  float minRoundness = 0.6;
+  /// reused buffers
+  cv::Mat small, hsv, mask, labels, stats, centroids;
+  cv::Mat kernel;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern MBall ball;
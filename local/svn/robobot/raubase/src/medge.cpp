@@ -31,52 +31,48 @@
 #include "sencoder.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "mpose.h"
+#include "uevent.h"
 
 // create value
 MEdge medge;
 
 
 void MEdge::setup()
-{ // ensure there is default values in ini-file
-  if (not ini.has("edge") or not ini["edge"].has("calibWhite"))
-  { // no data yet, so generate some default values
-    ini["edge"]["calibWhite"] = "1000 1000 1000 1000 1000 1000 1000 1000"; // A/D value
-    ini["edge"]["calibBlack"] = "0 0 0 0 0 0 0 0"; // A/D value
-    ini["edge"]["whiteThreshold"] = "700"; // of 1000
-    ini["edge"]["sensorWidth"] = "0.12"; // m
-    ini["edge"]["log"] = "true"; // log edge detection items
-    ini["edge"]["logNorm"] = "true"; // log edge detection items
-  }
-  // get values from ini-file
-  const char * p1 = ini["edge"]["calibWhite"].c_str();
-  // white calibration value
-  for (int i = 0; i < 8; i++)
-    calibWhite[i] = strtol(p1, (char**)&p1,10);
-  // black calibration value
-  p1 = ini["edge"]["calibBlack"].c_str();
-  for (int i = 0; i < 8; i++)
-  {
-    calibBlack[i] = strtol(p1, (char**)&p1,10);
-    calibrationValid = (calibWhite[i] - calibBlack[i]) > 10;
-  }
-  if (not calibrationValid)
-  {
-    printf("# ****** MEdge::findEdge: invalid line sensor calibration values.\n");
-    printf("# values white");
-    for (int i = 0; i < 8; i++)
-      printf(" %6d", calibWhite[i]);
-    printf("\n# values black");
-    for (int i = 0; i < 8; i++)
-      printf(" %6d", calibBlack[i]);
-    printf("\n");
-  }
-  // convert per-cent to per-mille
-  whiteThresholdPm = strtol(ini["edge"]["whiteThreshold"].c_str(), nullptr, 10);
-  sensorWidth = strtod(ini["edge"]["sensorWidth"].c_str(), nullptr);
+{ // parameters (default values are added to the ini-file)
+  config.add("edge", "calibWhite", calibWhite, 8, "1000 1000 1000 1000 1000 1000 1000 1000", 0, 4096,
+             "A/D value for white, each sensor");
+  config.add("edge", "calibBlack", calibBlack, 8, "0 0 0 0 0 0 0 0", 0, 4096,
+             "A/D value for black, each sensor");
+  config.add("edge", "whiteThreshold", whiteThresholdPm, 700, 0, 1000, "Edge threshold (of 1000)");
+  config.add("edge", "sensorWidth", sensorWidth, 0.12, 0.01, 1.0, "Distance between outher sensors (m)");
+  config.add("edge", "log", logToFile, true, "Save edge data to log_edge.txt");
+  config.add("edge", "logNorm", logNorm, true, "Save normalized sensor values to log_edge_normalized.txt");
+  config.add("edge", "print", toConsole, false, "Print edge data to console");
+  config.add("edge", "estimator", estimator, "threshold",
+             "'threshold' (interpolate at whiteThreshold) or 'fit' (line-profile fit)");
+  config.add("edge", "fitMinContrast", fitMinContrast, 150, 0, 1000, "Fit estimator: min contrast (of 1000)");
+  config.add("edge", "fitMinConfidence", fitMinConfidence, 0.5, 0.0, 1.0, "Fit estimator: min confidence");
+  config.add("edge", "trackMaxLost", trackMaxLost, 0.3, 0.0, 10.0, "Tracker: max time without line (sec)");
+  config.add("edge", "sensorForward", sensorForward, 0.16, 0.0, 1.0, "Sensor distance in front of driving axle (m)");
+  config.add("edge", "trackNoise", trackNoise, 3, "0.05 0.01 0.005", 0.0, 1.0,
+             "Tracker noise: center (m/sqrt(s)), width (m/sqrt(s)), measurement (m)");
+  config.add("edge", "crossingMargin", crossingMargin, 0.02, 0.0, 0.5, "Crossing: width over tracked line (m)");
+  config.add("edge", "crossingSamples", crossingSamples, 3, 1, 100, "Crossing: samples to detect crossing/branch");
+  config.add("edge", "autoCalib", autoCalib, false, "Online calibration while driving (not saved to ini-file)");
+  config.add("edge", "autoCalibPercentile", autoCalibPercentile, 0.98, 0.5, 1.0, "Online calibration: white level (black is 1 - this)");
+  config.add("edge", "autoCalibRate", autoCalibRate, 0.01, 0.0, 1.0, "Online calibration: step as fraction of range");
+  config.add("edge", "autoCalibMinRange", autoCalibMinRange, 200, 0, 4096, "Online calibration: min white-black A/D range");
+  config.add("edge", "autoCalibHysteresis", autoCalibHysteresis, 0.05, 0.0, 1.0, "Online calibration: hysteresis (fraction of range)");
+  config.add("edge", "autoCalibWarmup", autoCalibWarmup, 500, 0, 100000, "Online calibration: samples before use");
+  // new values are applied in run() only
+  config.staged("edge", this);
+  config.check("edge", validCalibration);
+  applyConfig();
   //
   // initiate data log for this module
-  toConsole = ini["edge"]["print"] == "true";
-  if (ini["edge"]["log"] == "true")
+  if (logToFile)
   { // open logfile
     std::string fn = service.logPath + "log_edge.txt";
     logfile = fopen(fn.c_str(), "w");
@@ -93,16 +89,26 @@ void MEdge::setup()
     fprintf(logfile, "\n");
     //
     fprintf(logfile, "%% \tWhite threshold (of 1000) %d \n", whiteThresholdPm);
+    fprintf(logfile, "%% \tAuto calibration %s\n", autoCalib ? "true" : "false");
+    fprintf(logfile, "%% \tEstimator %s (fit min contrast %d, min confidence %g)\n",
+            estimator.c_str(), fitMinContrast, fitMinConfidence);
     // and extracted values
     fprintf(logfile, "%% 1 \tTime (sec)\n");
     fprintf(logfile, "%% 2 \tEdge valid\n");
     fprintf(logfile, "%% 3 \tLeft edge position(m)\n");
     fprintf(logfile, "%% 4 \tRight edge position (m)\n");
     fprintf(logfile, "%% 5 \tLine width (m)\n");
+    fprintf(logfile, "%% 6 \tFit confidence (0..1, fit estimator only)\n");
+    fprintf(logfile, "%% 7 \tTrack valid\n");
+    fprintf(logfile, "%% 8 \tTracked left edge (m)\n");
+    fprintf(logfile, "%% 9 \tTracked right edge (m)\n");
+    fprintf(logfile, "%% 10 \tTracked line width (m)\n");
+    fprintf(logfile, "%% 11 \tCrossing, branch left, branch right\n");
+    fprintf(logfile, "%% 14 \tCrossing count\n");
     if (not calibrationValid)
       fprintf(logfile, "\n ### Calibration is not valid - see values above\n");
   }
-  if (ini["edge"]["log"] == "true")
+  if (logNorm)
   { // open logfile
     std::string fn = service.logPath + "log_edge_normalized.txt";
     logfileNorm = fopen(fn.c_str(), "w");
@@ -155,10 +161,24 @@ void MEdge::findEdge()
       lineValid = true;
   }
   //
+  if (useFit)
+  { // use all 8 values, not just the two around the threshold
+    float le, re;
+    fitConfidence = fitLineProfile(le, re);
+    lineValid = fitConfidence >= fitMinConfidence;
+    if (lineValid)
+    {
+      leftEdge = le;
+      rightEdge = re;
+    }
+  }
   edgeValid = lineValid;
   //
   // edge position
-  if (lineValid)
+  if (useFit)
+  { // already found by the fit (if valid)
+  }
+  else if (lineValid)
   { // calculate edge position
     // left edge
     // left-most sensors has number 0
@@ -197,7 +217,7 @@ void MEdge::findEdge()
         rightEdge = r - float(eeR)/float(ddR);
     }
   }
-  else
+  if (not lineValid)
   { // line not valid - say (0,0)
     leftEdge = 3.5;
     rightEdge = 3.5;
@@ -208,15 +228,279 @@ void MEdge::findEdge()
   rightEdge = -((rightEdge * sensorWidth / 7.0 ) - sensorWidth/2.0);
   //
   width = leftEdge - rightEdge;
+  // update line tracker
+  trackEdge();
   // finished - log/print as needed
   toLog();
 }
 
+float MEdge::fitLineProfile(float & left, float & right)
+{
+  int lo = 1000, hi = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    if (ls[i] < lo)
+      lo = ls[i];
+    if (ls[i] > hi)
+      hi = ls[i];
+  }
+  if (hi - lo < fitMinContrast)
+    return 0.0;
+  // covered fraction of each sensor using the current levels,
+  // each sensor covers one sensor pitch, so the sum is the line width
+  // (small negative values are noise and are kept to avoid a bias)
+  float w = 0, m = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    float f = (ls[i] - fitBlack)/fitContrast;
+    if (f > 1.0)
+      f = 1.0;
+    else if (f < -0.2)
+      f = 0.0;
+    w += f;
+    m += f * i;
+  }
+  if (w < 0.05)
+    return 0.0;
+  float c = m/w;
+  left = c - w/2.0;
+  right = c + w/2.0;
+  // model coverage of each sensor footprint [i-0.5, i+0.5]
+  float cov[8];
+  float sc = 0, scc = 0, sy = 0, scy = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    cov[i] = fmaxf(fminf(right, i + 0.5) - fmaxf(left, i - 0.5), 0.0);
+    sc += cov[i];
+    scc += cov[i] * cov[i];
+    sy += ls[i];
+    scy += cov[i] * ls[i];
+  }
+  // residual relative to contrast gives the confidence
+  float e2 = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    float e = ls[i] - fitBlack - fitContrast * cov[i];
+    e2 += e * e;
+  }
+  float conf = 1.0 - sqrtf(e2/8)/(0.25 * fitContrast);
+  if (conf < 0.0)
+    conf = 0.0;
+  // least squares for ls = black + contrast * cov (2x2 closed form).
+  // Only well conditioned when some sensors are (almost) fully
+  // covered and some are not - then adjust the levels slowly
+  float det = 8 * scc - sc * sc;
+  if (det > 2.0)
+  {
+    float a = (8 * scy - sc * sy)/det;
+    float b = (sy - a * sc)/8;
+    if (a > fitMinContrast)
+    {
+      fitContrast += 0.1 * (a - fitContrast);
+      fitBlack += 0.1 * (b - fitBlack);
+    }
+  }
+  return conf;
+}
+
+void MEdge::trackEdge()
+{
+  float dt = updTime - trackTime;
+  trackTime = updTime;
+  if (dt < 0.0 or dt > 1.0)
+    dt = 0.0;
+  if (trackValid)
+  { // predict - a turn moves the sensor sideways,
+    // so the line moves the other way (positive is left)
+    trackCenter -= pose.turnrate * dt * sensorForward;
+    trackCenterVar += trackNoise[0] * trackNoise[0] * dt;
+    trackWidthVar += trackNoise[1] * trackNoise[1] * dt;
+  }
+  float measVar = trackNoise[2] * trackNoise[2];
+  if (edgeValid and not trackValid)
+  { // (re)start tracking
+    trackCenter = (leftEdge + rightEdge) / 2.0;
+    trackWidth = width;
+    trackCenterVar = measVar;
+    trackWidthVar = measVar;
+    wideCnt = 0;
+    trackValid = true;
+    trackLastValid = updTime;
+  }
+  else if (edgeValid)
+  { // a line wider than the tracked line is a crossing or branch,
+    // the side is where the edge jumps out
+    bool wideLeft = leftEdge > trackCenter + trackWidth/2.0 + crossingMargin/2.0;
+    bool wideRight = rightEdge < trackCenter - trackWidth/2.0 - crossingMargin/2.0;
+    if (width > trackWidth + crossingMargin)
+    {
+      wideCnt++;
+      wideSides = (wideLeft ? 1 : 0) | (wideRight ? 2 : 0);
+    }
+    else
+      wideCnt = 0;
+    // center measurement from the edges that fits the tracked line
+    float mc = trackCenter;
+    bool useCenter = true;
+    if (wideLeft and wideRight)
+      // no usable edge (crossing or lost)
+      useCenter = false;
+    else if (wideLeft)
+      mc = rightEdge + trackWidth/2.0;
+    else if (wideRight)
+      mc = leftEdge - trackWidth/2.0;
+    else
+    { // both edges usable, so update width too
+      mc = (leftEdge + rightEdge) / 2.0;
+      float k = trackWidthVar / (trackWidthVar + measVar);
+      trackWidth += k * (width - trackWidth);
+      trackWidthVar *= 1.0 - k;
+    }
+    if (useCenter)
+    { // and center (sensor edges are assumed uncorrelated)
+      float k = trackCenterVar / (trackCenterVar + measVar);
+      trackCenter += k * (mc - trackCenter);
+      trackCenterVar *= 1.0 - k;
+    }
+    trackLastValid = updTime;
+  }
+  else if (trackValid and updTime - trackLastValid > trackMaxLost)
+  { // lost for too long
+    trackValid = false;
+    wideCnt = 0;
+  }
+  // detected features, a wide line with no clear side is a crossing
+  bool wasCrossing = crossing;
+  bool wide = wideCnt >= crossingSamples;
+  crossing = wide and (wideSides == 3 or wideSides == 0);
+  branchLeft = wide and wideSides == 1;
+  branchRight = wide and wideSides == 2;
+  if (crossing and not wasCrossing)
+    crossingCnt++;
+  trackLeft = trackCenter + trackWidth/2.0;
+  trackRight = trackCenter - trackWidth/2.0;
+}
+
+void MEdge::autoCalibrate()
+{
+  bool changed = false;
+  autoCalibSamples++;
+  for (int i = 0; i < 8; i++)
+  { // stochastic percentile estimate, the step scales with the seen range
+    // so it converges fast after a lighting change
+    float v = sedge.edgeRaw[i];
+    float step = autoCalibRate * (autoWhite[i] - autoBlack[i]) + 1.0;
+    if (v > autoWhite[i])
+      autoWhite[i] += step * autoCalibPercentile;
+    else
+      autoWhite[i] -= step * (1.0 - autoCalibPercentile);
+    if (v < autoBlack[i])
+      autoBlack[i] -= step * autoCalibPercentile;
+    else
+      autoBlack[i] += step * (1.0 - autoCalibPercentile);
+    float range = autoWhite[i] - autoBlack[i];
+    if (range < 0)
+      range = 0;
+    autoCalibConfidence[i] = fminf(range / autoCalibMinRange, 1.0);
+    if (autoCalibSamples > autoCalibWarmup and autoCalibConfidence[i] >= 1.0)
+    { // estimate is OK, update calibration if changed more than hysteresis
+      float hyst = autoCalibHysteresis * range;
+      if (fabsf(autoWhite[i] - calibWhite[i]) > hyst or
+          fabsf(autoBlack[i] - calibBlack[i]) > hyst)
+      {
+        calibWhite[i] = roundf(autoWhite[i]);
+        calibBlack[i] = roundf(autoBlack[i]);
+        seedWhite[i] = calibWhite[i];
+        seedBlack[i] = calibBlack[i];
+        changed = true;
+      }
+    }
+  }
+  if (changed)
+  {
+    autoCalibCnt++;
+    calibrationValid = true;
+    for (int i = 0; i < 8; i++)
+      calibrationValid &= (calibWhite[i] - calibBlack[i]) > 10;
+    if (logfile != nullptr and not service.stop)
+    {
+      fprintf(logfile, "%% %lu.%04ld auto calibration (%d) white %d %d %d %d %d %d %d %d, black %d %d %d %d %d %d %d %d\n",
+              updTime.getSec(), updTime.getMicrosec()/100, autoCalibCnt,
+              calibWhite[0], calibWhite[1], calibWhite[2], calibWhite[3],
+              calibWhite[4], calibWhite[5], calibWhite[6], calibWhite[7],
+              calibBlack[0], calibBlack[1], calibBlack[2], calibBlack[3],
+              calibBlack[4], calibBlack[5], calibBlack[6], calibBlack[7]);
+    }
+  }
+}
+
+void MEdge::applyConfig()
+{
+  useFit = estimator == "fit";
+  calibrationValid = true;
+  bool newCalib = false;
+  for (int i = 0; i < 8; i++)
+  {
+    calibrationValid &= (calibWhite[i] - calibBlack[i]) > 10;
+    newCalib |= calibWhite[i] != seedWhite[i] or calibBlack[i] != seedBlack[i];
+  }
+  if (newCalib)
+  { // start online calibration from the new (ini-file) values
+    for (int i = 0; i < 8; i++)
+    {
+      autoWhite[i] = calibWhite[i];
+      autoBlack[i] = calibBlack[i];
+      seedWhite[i] = calibWhite[i];
+      seedBlack[i] = calibBlack[i];
+    }
+    autoCalibSamples = 0;
+  }
+  if (not calibrationValid)
+  {
+    printf("# ****** MEdge::findEdge: invalid line sensor calibration values.\n");
+    printf("# values white");
+    for (int i = 0; i < 8; i++)
+      printf(" %6d", calibWhite[i]);
+    printf("\n# values black");
+    for (int i = 0; i < 8; i++)
+      printf(" %6d", calibBlack[i]);
+    printf("\n");
+  }
+}
+
+bool MEdge::validCalibration(mINI::INIStructure & newIni)
+{
+  if (not newIni.has("edge"))
+    return true;
+  // a value not in the new file is the one in use
+  auto & edge = newIni["edge"];
+  const char * p1 = edge.has("calibWhite") ? edge["calibWhite"].c_str() : ini["edge"]["calibWhite"].c_str();
+  const char * p2 = edge.has("calibBlack") ? edge["calibBlack"].c_str() : ini["edge"]["calibBlack"].c_str();
+  bool isOK = true;
+  for (int i = 0; i < 8; i++)
+  {
+    int w = strtol(p1, (char**)&p1, 10);
+    int b = strtol(p2, (char**)&p2, 10);
+    if (w - b <= 10)
+    {
+      printf("# MEdge:: [edge] calibWhite - calibBlack is %d for sensor %d (must be more than 10)\n", w - b, i);
+      isOK = false;
+    }
+  }
+  return isOK;
+}
+
 void MEdge::run()
 {
   int loop = 0;
+  int configGeneration = config.generation;
+  UEvent::Seen seen;
+  events.current(seen);
   while (not service.stop)
   {
+    if (config.changed("edge", configGeneration, this))
+      // new values from ini-file
+      applyConfig();
     if ((sensorCalibrateWhite or sensorCalibrateBlack) and
       sedge.updateCnt > 100      )
     { // start summing calibration values
@@ -235,9 +519,12 @@ void MEdge::run()
       // calculate edge position
       if (not (sensorCalibrateWhite or sensorCalibrateBlack))
       { // regular update
+        if (autoCalib)
+          autoCalibrate();
         findEdge();
         // inform users of update
         updateCnt++;
+        events.notify(UEvent::EDGE);
       }
       else if (sensorCalibrateCount > 0)
       { // calibration active
@@ -283,8 +570,8 @@ void MEdge::run()
       }
     }
     else
-      // no new value; just wait a bit (1000 = 1ms)
-      usleep(2000);
+      // no new value; wait for line sensor data (max 2ms)
+      events.wait(UEvent::LINE, seen, 0.002);
   }
   if (logfile != nullptr)
   {
@@ -303,8 +590,11 @@ void MEdge::toLog()
   {
     if (logfile != nullptr)
     { // log_line sensor detection
-      fprintf(logfile, "%lu.%04ld %d %.3f %.3f %.4f\n", updTime.getSec(), updTime.getMicrosec()/100,
-              edgeValid, leftEdge, rightEdge, leftEdge - rightEdge);
+      fprintf(logfile, "%lu.%04ld %d %.3f %.3f %.4f %.3f  %d %.3f %.3f %.4f %d %d %d %d\n",
+              updTime.getSec(), updTime.getMicrosec()/100,
+              edgeValid, leftEdge, rightEdge, leftEdge - rightEdge, fitConfidence,
+              trackValid, trackLeft, trackRight, trackWidth,
+              crossing, branchLeft, branchRight, crossingCnt);
     }
     if (toConsole)
     { // debug print to console
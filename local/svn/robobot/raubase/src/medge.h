@@ -24,7 +24,9 @@
 #ifndef MEDGE_H
 #define MEDGE_H
 
+#include <thread>
 #include "sedge.h"
+#include "uini.h"
 #include "utime.h"
 
 using namespace std;
@@ -51,6 +53,40 @@ protected:
    * Find left and right edge
    * detect crossing line */
   void findEdge();
+  /**
+   * Fit a line-profile model to the 8 normalized sensor values.
+   * The line is modelled as a white band [left, right] (in sensor index units)
+   * on a darker floor, each sensor sees the part of the band that covers
+   * its footprint (one sensor pitch wide), i.e.
+   *    ls[i] = black + contrast * coverage(i, left, right).
+   * The band is found from the moments of the coverage, and
+   * black and contrast are refined by least squares (2x2 closed form)
+   * when the sample allows it.
+   * \param left, right are set to the edge positions (sensor index units)
+   * \returns confidence of the fit (0..1), 0 if no line is found */
+  float fitLineProfile(float & left, float & right);
+  /**
+   * Track line center and width with a (scalar) Kalman filter.
+   * Prediction uses the robot turnrate (from pose), the update
+   * uses the measured edges (if valid). A measured width over the
+   * tracked width (crossingMargin) for crossingSamples is a crossing,
+   * or a branch if only one edge jumps out; such edges are not fused.
+   * Short dropouts (less than trackMaxLost) are bridged by the prediction. */
+  void trackEdge();
+  /**
+   * Update the running white and black level estimate of each sensor
+   * (percentile trackers over the raw values), and move
+   * calibWhite and calibBlack, when the estimate is confident and
+   * has moved more than the hysteresis. */
+  void autoCalibrate();
+  /**
+   * Update values derived from parameters (also after a reload),
+   * and restart the online calibration estimate from new calibration values */
+  void applyConfig();
+  /**
+   * Check that new calibration values (reload) leave a usable range for all sensors
+   * \returns false if white - black is 10 or less for a sensor */
+  static bool validCalibration(mINI::INIStructure & newIni);
 
 public:
   /// PC time of last update
@@ -67,6 +103,36 @@ public:
   bool edgeValid = false;
   float leftEdge = 0.0;
   float rightEdge = 0.0;
+  // use the fitted line-profile estimator (else threshold interpolation)
+  bool useFit = false;
+  /// edge.estimator: 'threshold' or 'fit'
+  std::string estimator;
+  // confidence of last fit (0..1) - fit estimator only
+  float fitConfidence = 0.0;
+  // tracked line (positive is left, in meters)
+  // valid also during short dropouts of edgeValid
+  bool trackValid = false;
+  float trackLeft = 0.0;
+  float trackRight = 0.0;
+  float trackCenter = 0.0;
+  float trackWidth = 0.0;
+  // line features detected by the tracker
+  // crossing: line wider than tracked line (to both sides)
+  // branchLeft/branchRight: line wider than tracked line to one side
+  bool crossing = false;
+  bool branchLeft = false;
+  bool branchRight = false;
+  // number of crossings detected (incremented when a crossing starts)
+  int crossingCnt = 0;
+  // online calibration (edge.autoCalib)
+  bool autoCalib = false;
+  // running white (high percentile) and black (low percentile) estimate (A/D value)
+  float autoWhite[8];
+  float autoBlack[8];
+  // confidence of each sensor estimate (0..1), based on seen contrast
+  float autoCalibConfidence[8] = {0};
+  // number of calibration values changed by auto calibration
+  int autoCalibCnt = 0;
   // flag for doing a white line sensor calibration
   bool sensorCalibrateWhite = false;
   bool sensorCalibrateBlack = false;
@@ -85,6 +151,8 @@ private:
   int ls[8] = {0};
   int lineUpdateCnt = 0;
   // debug print
+  bool logToFile = true;
+  bool logNorm = true;
   bool toConsole = false;
   FILE * logfile = nullptr;
   FILE * logfileNorm = nullptr;
@@ -92,6 +160,49 @@ private:
   // mostly debug
   int eeL, ddL, eeR, ddR;
   int l, r;
+  // fit estimator limits
+  // minimum contrast white-black (per-mille) to accept a line
+  int fitMinContrast = 150;
+  // minimum fit confidence to accept the line as valid
+  float fitMinConfidence = 0.5;
+  // fitted floor (black) level and line contrast (per-mille)
+  float fitBlack = 0;
+  float fitContrast = 1000;
+  // tracker settings
+  // max time without valid measurement (sec)
+  float trackMaxLost = 0.3;
+  // line sensor distance in front of driving axle (m)
+  float sensorForward = 0.16;
+  // process noise for center and width (m/sqrt(sec)) and measurement noise (m)
+  float trackNoise[3] = {0.05, 0.01, 0.005};
+  // edge jump to be a crossing or branch (m), and samples needed
+  float crossingMargin = 0.02;
+  int crossingSamples = 3;
+  // tracker state
+  float trackCenterVar = 0;
+  float trackWidthVar = 0;
+  UTime trackTime;
+  UTime trackLastValid;
+  // samples with the line wider than the tracked line
+  int wideCnt = 0;
+  // side(s) of the wide line, 1=left, 2=right, 3=both
+  int wideSides = 0;
+  // online calibration settings
+  // percentile for white level (black level uses 1 - this)
+  float autoCalibPercentile = 0.98;
+  // tracker step as fraction of seen range
+  float autoCalibRate = 0.01;
+  // minimum range (A/D) white-black for full confidence
+  float autoCalibMinRange = 200;
+  // change (fraction of range) needed to update calibration
+  float autoCalibHysteresis = 0.05;
+  // samples before calibration is updated
+  int autoCalibWarmup = 500;
+  int autoCalibSamples = 0;
+  // calibration at last applyConfig() or auto update,
+  // to restart the online estimate, when the ini-file values change
+  int seedWhite[8] = {-1,-1,-1,-1,-1,-1,-1,-1};
+  int seedBlack[8] = {-1,-1,-1,-1,-1,-1,-1,-1};
 
   const int sensorCalibrateSamples = 100;
   int sensorCalibrateCount = 0;
@@ -0,0 +1,347 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "mhistline.h"
+#include "uservice.h"
+#include "scam.h"
+
+// create value
+MHistLine histline;
+
+
+void MHistLine::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("histline"))
+  { // no data yet, so generate some default values
+    ini["histline"]["enabled"] = "false"; // find line in all camera frames
+    ini["histline"]["angles"] = "-30 30 2"; // angle sweep min, max, step (degrees)
+    ini["histline"]["scale"] = "0.5"; // downscale before detection
+    ini["histline"]["bright"] = "true"; // line is brighter than background
+    ini["histline"]["minContrast"] = "20"; // gray levels
+    ini["histline"]["threads"] = "2";
+    ini["histline"]["log"] = "true";
+    ini["histline"]["print"] = "false";
+  }
+  // get values from ini-file
+  const char * p1 = ini["histline"]["angles"].c_str();
+  angleMin = strtof(p1, (char**)&p1);
+  angleMax = strtof(p1, (char**)&p1);
+  angleStep = strtof(p1, (char**)&p1);
+  if (angleStep <= 0.0)
+    angleStep = 1.0;
+  scale = strtof(ini["histline"]["scale"].c_str(), nullptr);
+  if (scale <= 0.05 or scale > 1.0)
+    scale = 1.0;
+  findBright = ini["histline"]["bright"] == "true";
+  minContrast = strtof(ini["histline"]["minContrast"].c_str(), nullptr);
+  threads = strtol(ini["histline"]["threads"].c_str(), nullptr, 10);
+  toConsole = ini["histline"]["print"] == "true";
+  if (threads > 1)
+    pool.setup(threads);
+  //
+  if (ini["histline"]["log"] == "true")
+  { // open logfile
+    std::string fn = service.logPath + "log_histline.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Line detection using angled histograms (%s)\n", fn.c_str());
+    fprintf(logfile, "%% angles %s (deg), scale %g, threads %d\n",
+            ini["histline"]["angles"].c_str(), scale, threads);
+    fprintf(logfile, "%% 1 \tTime (sec)\n");
+    fprintf(logfile, "%% 2 \tLine valid\n");
+    fprintf(logfile, "%% 3 \tLine angle (deg)\n");
+    fprintf(logfile, "%% 4 \tLine row at image centre (pixels)\n");
+    fprintf(logfile, "%% 5 \tContrast (gray levels)\n");
+  }
+  if (ini["histline"]["enabled"] == "true" and cam.isOpen())
+  { // use all frames from camera
+    cam.subscribe();
+    th1 = new std::thread(runObj, this);
+  }
+}
+
+void MHistLine::terminate()
+{ // wait for thread to finish
+  if (th1 != nullptr)
+  {
+    th1->join();
+    th1 = nullptr;
+    cam.unsubscribe();
+  }
+  pool.terminate();
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+void MHistLine::toLog(const char * message)
+{
+  if (not service.stop)
+  {
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+    if (toConsole)
+    {
+      printf("%lu.%04ld %s\n", imgTime.getSec(), imgTime.getMicrosec()/100, message);
+    }
+  }
+}
+
+void MHistLine::run()
+{
+  int seq = 0;
+  while (not service.stop)
+  {
+    UCamFrame f;
+    if (cam.waitForNext(f, seq, 0.5))
+    {
+      seq = f.seq;
+      find(f.img, f.time);
+    }
+  }
+}
+
+void MHistLine::sumColumns(const cv::Mat & tg, float drdc, int c0, int c1, cv::Mat & acc)
+{ // image is transposed, so image column c is row c in tg
+  int h = tg.cols;
+  for (int c = c0; c < c1; c++)
+  { // line starting at row r passes row r + o in this column
+    int o = cvRound(c * drdc);
+    int r0 = std::max(0, -o);
+    int r1 = std::min(h, h - o);
+    if (r0 < r1)
+    { // add contiguous segment (vectorized in OpenCV)
+      cv::Mat seg = tg.row(c).colRange(r0 + o, r1 + o);
+      cv::Mat dst = acc.colRange(r0, r1);
+      cv::add(dst, seg, dst, cv::noArray(), CV_32S);
+    }
+  }
+}
+
+void MHistLine::makeProfile(const cv::Mat & tg, float drdc, std::vector<float> & profile)
+{
+  int w = tg.rows;
+  int h = tg.cols;
+  int n = std::max(pool.size(), 1);
+  partial.resize(n);
+  for (auto & p : partial)
+  {
+    p.create(1, h, CV_32S);
+    p.setTo(cv::Scalar(0));
+  }
+  if (n == 1)
+    sumColumns(tg, drdc, 0, w, partial[0]);
+  else
+  { // a range of columns for each thread, each with its own partial sum
+    std::vector<std::future<void>> done;
+    int cols = (w + n - 1) / n;
+    for (int i = 0; i < n; i++)
+    {
+      int c0 = i * cols;
+      int c1 = std::min(w, c0 + cols);
+      cv::Mat & acc = partial[i];
+      done.push_back(pool.add([&tg, drdc, c0, c1, &acc]()
+      {
+        sumColumns(tg, drdc, c0, c1, acc);
+      }));
+    }
+    for (auto & d : done)
+      d.wait();
+    // merge
+    for (int i = 1; i < n; i++)
+      cv::add(partial[0], partial[i], partial[0]);
+  }
+  // number of pixels in each line (difference array)
+  std::vector<int> cnt(h + 1, 0);
+  for (int c = 0; c < w; c++)
+  {
+    int o = cvRound(c * drdc);
+    int r0 = std::max(0, -o);
+    int r1 = std::min(h, h - o);
+    if (r0 < r1)
+    {
+      cnt[r0]++;
+      cnt[r1]--;
+    }
+  }
+  profile.resize(h);
+  const int * sum = partial[0].ptr<int>(0);
+  int k = 0;
+  for (int r = 0; r < h; r++)
+  { // mean value, if line is at least half the image width
+    k += cnt[r];
+    if (k > w / 2)
+      profile[r] = float(sum[r]) / k;
+    else
+      profile[r] = -1;
+  }
+}
+
+bool MHistLine::findLine(cv::Mat * sourcePtr)
+{
+  if (sourcePtr == nullptr)
+  {
+    UCamFrame f = cam.getFrameRaw();
+    return find(f.img, f.time);
+  }
+  // no capture time for this image, so use now
+  UTime t("now");
+  return find(*sourcePtr, t);
+}
+
+bool MHistLine::getLine(float & angle, float & row, UTime & time, float * contrast, int * cnt)
+{
+  std::lock_guard<std::mutex> lock(findLock);
+  angle = lineAngle;
+  row = lineRow;
+  time = imgTime;
+  if (contrast != nullptr)
+    *contrast = lineContrast;
+  if (cnt != nullptr)
+    *cnt = updateCnt;
+  return lineValid;
+}
+
+bool MHistLine::find(cv::Mat & frame, UTime & frameTime)
+{
+  if (frame.empty())
+  {
+    printf("# MHistLine::findLine: Failed to get an image\n");
+    return false;
+  }
+  // image time is part of the result
+  std::lock_guard<std::mutex> lock(findLock);
+  imgTime = frameTime;
+  if (scale < 1.0)
+    cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+  else
+    small = frame;
+  cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+  // columns to contiguous rows
+  cv::transpose(gray, tgray);
+  int w = gray.cols;
+  std::vector<float> profile;
+  float bestContrast = 0;
+  float bestSlope = 0;
+  int bestRow = 0;
+  for (float a = angleMin; a <= angleMax + 1e-3; a += angleStep)
+  {
+    float drdc = tan(a * M_PI / 180.0);
+    makeProfile(tgray, drdc, profile);
+    // peak relative to mean of profile
+    double sum = 0;
+    int n = 0;
+    int peak = -1;
+    for (int r = 0; r < (int)profile.size(); r++)
+    {
+      if (profile[r] < 0)
+        continue;
+      sum += profile[r];
+      n++;
+      if (peak < 0 or (findBright and profile[r] > profile[peak]) or
+                      (not findBright and profile[r] < profile[peak]))
+        peak = r;
+    }
+    if (n == 0)
+      continue;
+    float contrast = fabs(profile[peak] - sum / n);
+    if (contrast > bestContrast)
+    {
+      bestContrast = contrast;
+      bestSlope = drdc;
+      bestRow = peak;
+    }
+  }
+  lineValid = bestContrast >= minContrast;
+  lineContrast = bestContrast;
+  lineAngle = atan(bestSlope);
+  // row at image centre, in full size image
+  lineRow = (bestRow + w / 2 * bestSlope) / scale;
+  updateCnt++;
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "%d %.1f %.1f %.1f", lineValid, lineAngle * 180 / M_PI, lineRow, lineContrast);
+  toLog(s);
+  return lineValid;
+}
+
+void MHistLine::bench()
+{
+  if (th1 != nullptr)
+  { // the service uses the thread pool, that is replaced below
+    printf("# MHistLine::bench: not while the histline service runs (set [histline] enabled = false)\n");
+    return;
+  }
+  std::vector<cv::String> images;
+  std::string path = ini["camera"]["imagepath"] + "/*.jpg";
+  cv::glob(path, images);
+  std::vector<cv::Mat> imgs;
+  for (auto & fn : images)
+  {
+    cv::Mat img = cv::imread(fn);
+    if (not img.empty())
+      imgs.push_back(img);
+  }
+  if (imgs.empty())
+  {
+    printf("# MHistLine::bench: no images in %s\n", path.c_str());
+    return;
+  }
+  printf("# MHistLine::bench: %d images from %s\n", (int)imgs.size(), path.c_str());
+  const int repeat = 3;
+  float t1 = 0;
+  for (int n = 1; n <= 4; n++)
+  {
+    if (n > 1)
+      pool.setup(n);
+    else
+      pool.terminate();
+    int found = 0;
+    UTime t("now");
+    for (int r = 0; r < repeat; r++)
+      for (auto & img : imgs)
+        found += findLine(&img);
+    float dt = t.getTimePassed() / (repeat * imgs.size());
+    if (n == 1)
+      t1 = dt;
+    const int MSL = 200;
+    char s[MSL];
+    snprintf(s, MSL, "# bench histline threads=%d, %.1f ms per image, speedup %.2f, found %d",
+             n, dt * 1000, t1/dt, found / repeat);
+    printf("%s\n", s);
+    // toLog uses imgTime
+    std::lock_guard<std::mutex> lock(findLock);
+    toLog(s);
+  }
+  if (threads > 1)
+    pool.setup(threads);
+  else
+    pool.terminate();
+}
@@ -0,0 +1,124 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "utime.h"
+#include "uthreadpool.h"
+
+using namespace std;
+
+/**
+ * Line (or wire) detection using angled histograms.
+ * For each candidate angle, the gray values are summed along
+ * parallel lines with that angle, one line for each image row.
+ * The angle with the strongest peak in the (mean) profile
+ * gives the line angle and position.
+ * The image is transposed, so that each column is a contiguous row,
+ * then the sums are vector additions of row segments.
+ * The columns are split between threads (partial sums) and merged.
+ * Developed from the multi_cpu prototype.
+ * */
+class MHistLine
+{
+public:
+  /** setup and start service (if enabled) */
+  void setup();
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Find the line in an image
+   * \param sourcePtr is a pointer to a source image, if
+   * this pointer is a nullptr (default), then a frame is taken from camera.
+   * \returns true if a line is found */
+  bool findLine(cv::Mat * sourcePtr = nullptr);
+  /**
+   * Get the line found in the last image (thread safe copy)
+   * \param angle is set to line angle (radians, positive is down to the right in the image)
+   * \param row is set to line row at image centre column (pixels in full image)
+   * \param time is set to the time of the image
+   * \param contrast (if not nullptr) is set to peak value relative to profile mean (gray levels)
+   * \param cnt (if not nullptr) is set to the number of processed images
+   * \returns true if a line was found */
+  bool getLine(float & angle, float & row, UTime & time, float * contrast = nullptr, int * cnt = nullptr);
+  /**
+   * Measure time using 1 to 4 threads
+   * on the images in ini[camera][imagepath] (*.jpg) */
+  void bench();
+
+private:
+  /**
+   * Find the line in this frame, result and imgTime are updated with findLock locked
+   * \returns true if a line is found */
+  bool find(cv::Mat & frame, UTime & frameTime);
+  /// result of last image (use getLine())
+  bool lineValid = false;
+  float lineAngle = 0;
+  float lineRow = 0;
+  float lineContrast = 0;
+  /// incremented at every processed image
+  int updateCnt = 0;
+  UTime imgTime;
+  /**
+   * Make mean profile for this slope (rows per column)
+   * \param tg is the transposed gray image
+   * \param drdc is the line slope
+   * \param profile is set to the mean gray value along each line (one per row) */
+  void makeProfile(const cv::Mat & tg, float drdc, std::vector<float> & profile);
+  /**
+   * sum this range of columns (partial profile) */
+  static void sumColumns(const cv::Mat & tg, float drdc, int c0, int c1, cv::Mat & acc);
+  /**
+   * service thread - use all camera frames */
+  void run();
+  static void runObj(MHistLine * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  /**
+   * print to console and logfile */
+  void toLog(const char * message);
+  bool toConsole = false;
+  FILE * logfile = nullptr;
+  std::thread * th1 = nullptr;
+  std::mutex findLock;
+  UThreadPool pool;
+  /// settings (from ini)
+  float angleMin = -30, angleMax = 30, angleStep = 2;
+  float scale = 0.5;
+  bool findBright = true;
+  float minContrast = 20;
+  int threads = 1;
+  /// reused buffers
+  cv::Mat small, gray, tgray;
+  std::vector<cv::Mat> partial;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern MHistLine histline;
@@ -32,6 +32,7 @@
 #include "steensy.h"
 #include "uservice.h"
 #include "cmixer.h"
+#include "uevent.h"
 
 // create value
 MPose pose;
@@ -104,6 +105,8 @@ void MPose::run()
   encTimeLast[0].now();
   encTimeLast[1].now();
   float dd[2]; // wheel moved since last update
+  UEvent::Seen seen;
+  events.current(seen);
   while (not service.stop)
   {
     if (encoder.updateCnt != encoderUpdateCnt)
@@ -127,6 +130,11 @@ void MPose::run()
       for (int i = 0; i < 2; i++)
       { // find movement in time and distance for each wheel
         dt[i] = t - encTimeLast[i]; // time
+        if (dt[i] < 1e-4)
+        { // more updates in one message block (same time),
+          // e.g. from the simulator at high speedup - avoid infinity
+          dt[i] = 1e-4;
+        }
         if (dt[i] < dtt)
         { // the minimum update time (the other wheel may be stationary)
           dtt = dt[i];
@@ -196,14 +204,22 @@ void MPose::run()
         turnRadius = robVel / minTurnrate * copysignf(1.0, turnrate);
       //
       poseTime = t;
+      { // keep history for getPoseAt()
+        std::lock_guard<std::mutex> lock(historyLock);
+        historyNewest = (historyNewest + 1) % historySize;
+        history[historyNewest] = {t, x, y, h};
+        if (historyCnt < historySize)
+          historyCnt++;
+      }
       updateCnt++;
+      events.notify(UEvent::POSE);
       // finished making a new pose
       toLog();
       loop++;
     }
     else
-      // just wait a bit (1ms)
-      usleep(1000);
+      // wait for new encoder data (max 1ms)
+      events.wait(UEvent::ENCODER, seen, 0.001);
   }
   if (logfile != nullptr)
   {
@@ -213,14 +229,90 @@ void MPose::run()
 
 void MPose::resetPose()
 {
-  x = 0.0;
-  y = 0.0;
-  h = 0.0;
-  dist = 0.0;
-  turned = 0.0;
+  float ox, oy, oh;
+  std::vector<std::function<void(float, float, float)>> handlers;
+  { // old poses are in the old coordinates
+    std::lock_guard<std::mutex> lock(historyLock);
+    ox = x;
+    oy = y;
+    oh = h;
+    x = 0.0;
+    y = 0.0;
+    h = 0.0;
+    dist = 0.0;
+    turned = 0.0;
+    historyCnt = 0;
+    resetTime.now();
+    resetCnt++;
+    handlers = resetHandlers;
+  }
+  for (auto & fn : handlers)
+    fn(ox, oy, oh);
   mixer.setDesiredHeading(0);
 }
 
+void MPose::onReset(std::function<void(float x, float y, float h)> fn)
+{
+  std::lock_guard<std::mutex> lock(historyLock);
+  resetHandlers.push_back(fn);
+}
+
+void MPose::getPose(float & px, float & py, float & ph)
+{
+  std::lock_guard<std::mutex> lock(historyLock);
+  if (historyCnt > 0)
+  { // the newest is a consistent set
+    px = history[historyNewest].x;
+    py = history[historyNewest].y;
+    ph = history[historyNewest].h;
+  }
+  else
+  { // just reset (or no update yet)
+    px = x;
+    py = y;
+    ph = h;
+  }
+}
+
+bool MPose::getPoseAt(UTime t, float & px, float & py, float & ph)
+{
+  std::lock_guard<std::mutex> lock(historyLock);
+  if (historyCnt == 0 or (resetTime.valid and t - resetTime < 0))
+  { // no history, or t is in the coordinates before the reset, use current pose
+    px = x;
+    py = y;
+    ph = h;
+    return false;
+  }
+  // search back from the newest
+  int k = 0;
+  int i = historyNewest;
+  while (k < historyCnt - 1 and history[i].t - t > 0)
+  {
+    k++;
+    i = (i - 1 + historySize) % historySize;
+  }
+  PoseAt & p0 = history[i];
+  if (k == 0 or history[i].t - t > 0)
+  { // newer than newest, or older than oldest
+    px = p0.x;
+    py = p0.y;
+    ph = p0.h;
+    return true;
+  }
+  // interpolate between p0 (before t) and p1 (after t)
+  PoseAt & p1 = history[(i + 1) % historySize];
+  float dt = p1.t - p0.t;
+  float f = 0;
+  if (dt > 1e-6)
+    f = (t - p0.t) / dt;
+  px = p0.x + f * (p1.x - p0.x);
+  py = p0.y + f * (p1.y - p0.y);
+  float dh = atan2(sin(p1.h - p0.h), cos(p1.h - p0.h));
+  ph = p0.h + f * dh;
+  return true;
+}
+
 void MPose::toLog()
 {
   if (not service.stop)
@@ -27,6 +27,10 @@
 #include "sencoder.h"
 #include "utime.h"
 #include "thread"
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
 
 using namespace std;
 
@@ -53,6 +57,24 @@ public:
   /**
    * Set pose to 0,0,0 */
   void resetPose();
+  /**
+   * Get the pose at this time from the recent pose history (about 2 seconds),
+   * interpolated between updates, e.g. the pose when an image was taken.
+   * A time outside the history gives the oldest or newest pose.
+   * \param t is the time of interest
+   * \param px, py, ph are set to the pose (odometry coordinates)
+   * \returns false if there is no history (since start or resetPose),
+   * or if t is before the last resetPose (other coordinates) */
+  bool getPoseAt(UTime t, float & px, float & py, float & ph);
+  /**
+   * Get the newest pose as one consistent set (x, y, h are updated by the pose thread) */
+  void getPose(float & px, float & py, float & ph);
+  /**
+   * Call this function at resetPose(), with the pose just before the reset,
+   * e.g. to move a map to the new coordinates */
+  void onReset(std::function<void(float x, float y, float h)> fn);
+  /// number of resetPose() calls, to detect a reset
+  std::atomic<int> resetCnt{0};
 
 protected:
   // robot geometry
@@ -104,6 +126,20 @@ private:
   float x2 = 0.0, y2 = 0.0, h2 = 0.0;
   float dist2 = 0;
   float turned2 = 0;
+  /// recent poses for getPoseAt()
+  struct PoseAt
+  {
+    UTime t;
+    float x, y, h;
+  };
+  static const int historySize = 256;
+  PoseAt history[historySize];
+  int historyNewest = 0;
+  int historyCnt = 0;
+  /// time of last resetPose()
+  UTime resetTime;
+  std::mutex historyLock;
+  std::vector<std::function<void(float x, float y, float h)>> resetHandlers;
 };
 
 /**
@@ -57,6 +57,16 @@ void UCam::setup()
     ini["camera"]["pos"] = "0.11 0 0.23";
     ini["camera"]["cam_tilt"] = "0.01";
   }
+  if (not ini["camera"].has("backend"))
+  { // capture using 'v4l2' (native mmap) or 'opencv' (cv::VideoCapture)
+    ini["camera"]["backend"] = "v4l2";
+  }
+  if (not ini["camera"].has("ringSize"))
+  { // number of captured frames kept for consumers
+    ini["camera"]["ringSize"] = "4";
+  }
+  int n = strtol(ini["camera"]["ringSize"].c_str(), nullptr, 10);
+  ring.resize(n < 1 ? 1 : n);
   if (ini["camera"]["enabled"] == "true")
   { // create directory for images
     fs::create_directory(ini["camera"]["imagepath"]);
@@ -115,47 +125,68 @@ void UCam::setup()
     toLog("Camera matrix (from robot.ini)", ini["camera"]["matrix"].c_str());
     toLog("Distortion vector (from robot.ini)", ini["camera"]["distortion"].c_str());
     // prepare to open camera
-    int apiID = cv::CAP_V4L2;  //cv::CAP_ANY;  // 0 = autodetect default API
-    // open selected camera using selected API
-    cam.open(device, apiID);
-    // check if we succeeded
-    //
-    if (not cam.isOpened())
-    {
-      printf("# UCam - camera could not open\n");
+    int w = strtol(ini["camera"]["width"].c_str(), nullptr, 0);
+    int h = strtol(ini["camera"]["height"].c_str(), nullptr, 0);
+    int fps = strtol(ini["camera"]["fps"].c_str(), nullptr, 0);
+    uint32_t fourcc = cv::VideoWriter::fourcc('M','J','P','G');
+    if (ini["camera"]["backend"] == "v4l2")
+    { // native capture, the image is decoded only when requested
+      useV4l2 = v4l.open(device, w, h, fps, fourcc);
+      if (useV4l2)
+      {
+        const int MSL = 200;
+        char s[MSL];
+        snprintf(s, MSL, "# Video device %d (v4l2): width=%d, height=%d, format=%c%c%c%c, FPS=%d",
+                 device, v4l.width, v4l.height,
+                 v4l.fourcc & 0xff, (v4l.fourcc >> 8) & 0xff,
+                 (v4l.fourcc >> 16) & 0xff, (v4l.fourcc >> 24) & 0xff,
+                 v4l.fps);
+        printf("%s\n", s);
+        toLog(s);
+      }
+      else
+        printf("# UCam - v4l2 backend failed, trying OpenCV capture\n");
     }
-    else
+    if (not useV4l2)
     {
-      uint32_t fourcc = cv::VideoWriter::fourcc('M','J','P','G');
-      cam.set(cv::CAP_PROP_FOURCC, fourcc);
-      // possible resolutions in JPEG coding
-      // (rows x columns) 320x640 or 720x1280
-      int w = strtol(ini["camera"]["width"].c_str(), nullptr, 0);
-      int h = strtol(ini["camera"]["height"].c_str(), nullptr, 0);
-      toLog("Width", ini["camera"]["width"].c_str());
-      toLog("Width", ini["camera"]["height"].c_str());
-      cam.set(cv::CAP_PROP_FRAME_HEIGHT, h);
-      cam.set(cv::CAP_PROP_FRAME_WIDTH, w);
-      int fps = strtol(ini["camera"]["fps"].c_str(), nullptr, 0);
-      cam.set(cv::CAP_PROP_FPS, fps);
-      union FourChar
+      int apiID = cv::CAP_V4L2;  //cv::CAP_ANY;  // 0 = autodetect default API
+      // open selected camera using selected API
+      cam.open(device, apiID);
+      // check if we succeeded
+      //
+      if (not cam.isOpened())
       {
-        uint32_t cc4;
-        char ccc[4];
-      } fmt;
-      fmt.cc4 = cam.get(cv::CAP_PROP_FOURCC);
-      const int MSL = 200;
-      char s[MSL];
-      snprintf(s, MSL, "# Video device %d: width=%g, height=%g, format=%c%c%c%c, FPS=%g",
-             device,
-             cam.get(cv::CAP_PROP_FRAME_WIDTH),
-             cam.get(cv::CAP_PROP_FRAME_HEIGHT),
-             fmt.ccc[0], fmt.ccc[1], fmt.ccc[2], fmt.ccc[3],
-             cam.get(cv::CAP_PROP_FPS));
-      printf("%s\n", s);
-      toLog(s);
+        printf("# UCam - camera could not open\n");
+      }
+      else
+      {
+        cam.set(cv::CAP_PROP_FOURCC, fourcc);
+        // possible resolutions in JPEG coding
+        // (rows x columns) 320x640 or 720x1280
+        toLog("Width", ini["camera"]["width"].c_str());
+        toLog("Width", ini["camera"]["height"].c_str());
+        cam.set(cv::CAP_PROP_FRAME_HEIGHT, h);
+        cam.set(cv::CAP_PROP_FRAME_WIDTH, w);
+        cam.set(cv::CAP_PROP_FPS, fps);
+        union FourChar
+        {
+          uint32_t cc4;
+          char ccc[4];
+        } fmt;
+        fmt.cc4 = cam.get(cv::CAP_PROP_FOURCC);
+        const int MSL = 200;
+        char s[MSL];
+        snprintf(s, MSL, "# Video device %d: width=%g, height=%g, format=%c%c%c%c, FPS=%g",
+               device,
+               cam.get(cv::CAP_PROP_FRAME_WIDTH),
+               cam.get(cv::CAP_PROP_FRAME_HEIGHT),
+               fmt.ccc[0], fmt.ccc[1], fmt.ccc[2], fmt.ccc[3],
+               cam.get(cv::CAP_PROP_FPS));
+        printf("%s\n", s);
+        toLog(s);
+      }
     }
-    if (cam.isOpened())
+    if (isOpen())
       // start capturing images
       th1 = new std::thread(runObj, this);
   }
@@ -184,18 +215,21 @@ void UCam::run()
 {
   printf("# Camera is running (to stabilize illumination)\n");
   toLog("Camera open");
+  if (useV4l2)
+  { // blocking capture, no busy loop
+    runV4l2();
+    return;
+  }
   while (not service.stop and not stopCam)
   { // wait for reply
-    if (getNewFrame and not gotFrame and frameCnt > 10)
-    {
-      cam.read(frame);
-      if (not frame.empty())
+    if (frameNeeded() and frameCnt > 10)
+    { // a new Mat for every frame, consumers may still use the old
+      cv::Mat img;
+      cam.read(img);
+      if (not img.empty())
       {
-        printf("# UCam::run: read frame %d/%d\n", gotFrameCnt, frameCnt);
-        gotFrameCnt++;
-        imgTime.now();
-        getNewFrame = false;
-        gotFrame = true;
+        UTime t("now");
+        addFrame(img, t);
       }
     }
     else
@@ -204,49 +238,129 @@ void UCam::run()
     }
     frameCnt++;
 //    if (frameCnt % 100 == 3)
-//      printf("# cam got frame %d/%d\n", gotFrameCnt, frameCnt);
+//      printf("# cam got frame %d/%d\n", frameSeq, frameCnt);
   }
   th1 = nullptr;
   cam.release();
   printf("# UCam::run: camera released\n");
 }
 
+void UCam::runV4l2()
+{
+  while (not service.stop and not stopCam)
+  { // wait in poll() for the next frame
+    UV4l2::Frame f;
+    if (v4l.grab(f, 200))
+    {
+      if (frameNeeded() and frameCnt > 10)
+      { // decode once for all consumers
+        cv::Mat img;
+        if (f.decode(img))
+          addFrame(img, f.time);
+      }
+      frameCnt++;
+      // the driver buffer is queued again here
+    }
+  }
+  th1 = nullptr;
+  v4l.close();
+  printf("# UCam::run: camera released\n");
+}
+
+bool UCam::isOpen()
+{
+  return v4l.isOpened() or cam.isOpened();
+}
+
+bool UCam::frameNeeded()
+{
+  return subscribers > 0 or waiters > 0;
+}
+
+void UCam::addFrame(cv::Mat & img, UTime & t)
+{
+  std::lock_guard<std::mutex> lock(frameLock);
+  frameSeq++;
+  ringNewest = (ringNewest + 1) % ring.size();
+  UCamFrame & f = ring[ringNewest];
+  f.img = img;
+  f.time = t;
+  f.seq = frameSeq;
+  frameReady.notify_all();
+}
+
+void UCam::subscribe()
+{
+  subscribers++;
+}
+
+void UCam::unsubscribe()
+{
+  if (subscribers > 0)
+    subscribers--;
+}
 
-cv::Mat UCam::getFrameRaw()
+UCamFrame UCam::getLatest()
+{
+  std::lock_guard<std::mutex> lock(frameLock);
+  if (frameSeq == 0)
+    return UCamFrame();
+  return ring[ringNewest];
+}
+
+bool UCam::waitForNext(UCamFrame & f, int lastSeq, float timeout, bool oldest)
+{
+  std::unique_lock<std::mutex> lock(frameLock);
+  waiters++;
+  bool got = frameReady.wait_for(lock, std::chrono::duration<float>(timeout),
+                                 [this, lastSeq]{ return frameSeq > lastSeq or service.stop; });
+  waiters--;
+  got = got and frameSeq > lastSeq;
+  if (got)
+  { // slot k back from the newest holds frame frameSeq - k
+    int n = ring.size();
+    int k = 0;
+    if (oldest)
+      k = std::min(frameSeq - lastSeq - 1, n - 1);
+    f = ring[(ringNewest - k + n) % n];
+  }
+  return got;
+}
+
+UCamFrame UCam::getFrameRaw()
 { // request new frame
-  if (not cam.isOpened())
+  UCamFrame f;
+  if (not isOpen())
   {
     printf("# camera not open\n");
-    return frame;
+    return f;
   }
 //   printf("Asking for a frame\n");
-  getNewFrame = true;
-  // allow timeout, 1 second from now
-  UTime t;
-  t.now();
-  while (not gotFrame and t.getTimePassed() < 5.0)
-  { // wait for frame (or timeout of 1 second)
-    usleep(3000);
+  int seq;
+  {
+    std::lock_guard<std::mutex> lock(frameLock);
+    seq = frameSeq;
   }
-  if (gotFrame)
-    ; // printf("# Got an image frame\n");
-  else
+  // wait for the next frame (or timeout)
+  if (not waitForNext(f, seq, 5.0))
+  {
     printf("# failed to get an image frame\n");
-  // mark finished with frame
-  gotFrame = false;
-  return frame;
+    f = UCamFrame();
+  }
+  return f;
 }
 
 
 bool UCam::saveImage()
 {
-  if (not cam.isOpened())
+  if (not isOpen())
   {
     printf("# camera not open\n");
     return false;
   }
   toLog("Save image");
-  cv::Mat rgb = getFrameRaw();
+  UCamFrame f = getFrameRaw();
+  cv::Mat & rgb = f.img;
   if (not rgb.empty())
   {
     printf("# ready to save\n");
@@ -257,7 +371,7 @@ bool UCam::saveImage()
     auto p = ini["camera"]["imageName"].find('%');
     if (p != std::string::npos)
     { // make timestamped image filename
-      imgTime.getForFilename(sfn);
+      f.time.getForFilename(sfn);
       printf("# found '%%' in ini[camera][imageName]\n");
     }
     else
@@ -271,8 +385,7 @@ bool UCam::saveImage()
     cv::imwrite(s, rgb);
     printf("# saved image to %s\n", s);
     // save also rectified image
-    cv::Mat rec;
-    cv::undistort(rgb, rec, cameraMatrix, distCoeffs);
+    cv::Mat rec = rectify(rgb);
     // generate filename
     snprintf(s, MSL, "%s/img_rec_%s.jpg", ini["camera"]["imagepath"].c_str(), sfn_ptr);
     cv::imwrite(s, rec);
@@ -410,6 +523,11 @@ bool UCam::calibrate()
             distCoeffs.at<double>(0,4));
     ini["camera"]["distortion"] = s;
     toLog("Distortion vector", s);
+    { // rectify maps must be rebuild
+      std::lock_guard<std::mutex> lock(mapLock);
+      map1.release();
+      map2.release();
+    }
 
     // Show distortion in screen
     const char * kx[] = {"k1","k2","p1","p2","k3"};
@@ -476,15 +594,72 @@ void UCam::toLog(const char * pre, const char * post)
 
 cv::Mat UCam::getFrame()
 {
-  cv::Mat raw;
   cv::Mat rectified;
-  raw = getFrameRaw();
-  cv::undistort(raw, rectified, cameraMatrix, distCoeffs);
+  getFrame(cv::Rect(), rectified);
+  return rectified;
+}
+
+bool UCam::getFrame(cv::Rect roi, cv::Mat & rectified)
+{
+  cv::Mat raw = getFrameRaw().img;
+  if (raw.empty())
+    rectified = cv::Mat();
+  else
+    rectified = rectify(raw, roi);
   // cv::imshow("Rectified image",rectified);
   // cv::waitKey(0);
+  return not rectified.empty();
+}
+
+void UCam::makeRectifyMaps(cv::Size size)
+{ // fixed point maps (CV_16SC2 + CV_16UC1) are faster in remap,
+  // new Mats, as other threads may still use the old maps
+  cv::Mat m1, m2;
+  cv::initUndistortRectifyMap(cameraMatrix, distCoeffs, cv::Mat(),
+                              cameraMatrix, size, CV_16SC2, m1, m2);
+  map1 = m1;
+  map2 = m2;
+  mapSize = size;
+  const int MSL = 100;
+  char s[MSL];
+  snprintf(s, MSL, "%dx%d", size.width, size.height);
+  toLog("Rectify maps made for", s);
+}
+
+cv::Mat UCam::rectify(const cv::Mat & raw, cv::Rect roi)
+{
+  cv::Mat rectified;
+  cv::Mat m1, m2;
+  { // get the maps (reference counted), remap is done without the lock
+    std::lock_guard<std::mutex> lock(mapLock);
+    if (map1.empty() or mapSize != raw.size())
+      makeRectifyMaps(raw.size());
+    m1 = map1;
+    m2 = map2;
+  }
+  if (roi.empty())
+    // full image
+    cv::remap(raw, rectified, m1, m2, cv::INTER_LINEAR);
+  else
+  { // the maps hold the source position for each rectified pixel,
+    // so the rectified roi needs only that part of the maps
+    roi &= cv::Rect(0, 0, m1.cols, m1.rows);
+    if (not roi.empty())
+      cv::remap(raw, rectified, m1(roi), m2(roi), cv::INTER_LINEAR);
+    // else outside image, return empty image
+  }
   return rectified;
 }
 
+void UCam::undistortPoints(const std::vector<cv::Point2f> & raw, std::vector<cv::Point2f> & rectified)
+{
+  if (raw.empty())
+    rectified.clear();
+  else
+    // result in pixels of the rectified image (same camera matrix)
+    cv::undistortPoints(raw, rectified, cameraMatrix, distCoeffs, cv::noArray(), cameraMatrix);
+}
+
 // Checks if a matrix is a valid rotation matrix.
 bool UCam::isRotationMatrix(cv::Matx33d &rot)
 {
@@ -25,14 +25,28 @@
 
 #include <unistd.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 
 #include "utime.h"
+#include "uv4l2.h"
 
 using namespace std;
 
+/**
+ * A captured (raw) frame with capture time and sequence number */
+struct UCamFrame
+{
+  cv::Mat img;
+  UTime time;
+  int seq = 0;
+};
+
 /**
  * Class for interface with vision
  * written in Python
@@ -56,18 +70,61 @@ public:
   /**
    * Calibrate */
   bool calibrate();
-  // get the newest frame
-  cv::Mat getFrameRaw();
+  /**
+   * Wait for the next frame (max 5 sec)
+   * \returns a copy of the frame (image is shared) with capture time,
+   *          the image is empty on failure */
+  UCamFrame getFrameRaw();
+  /**
+   * Tell the camera that frames are used continuously,
+   * i.e. every frame should be decoded into the frame ring.
+   * Call unsubscribe() when no longer needed. */
+  void subscribe();
+  void unsubscribe();
+  /**
+   * Get the newest frame in the ring (no wait)
+   * \returns a copy of the frame, seq is 0 (and image empty) if none yet */
+  UCamFrame getLatest();
+  /**
+   * Wait for a frame newer than lastSeq
+   * \param f is set to the newest frame
+   * \param lastSeq is the sequence number of the last frame used (0 is any)
+   * \param timeout is max wait time (sec)
+   * \param oldest if true, f is set to the oldest frame in the ring newer than lastSeq,
+   *               i.e. a consumer that is behind gets every frame (as long as it is in the ring).
+   * \returns false on timeout */
+  bool waitForNext(UCamFrame & f, int lastSeq, float timeout = 5.0, bool oldest = false);
   // get the newest frame rectified
   // using parameters in regbot.ini
   cv::Mat getFrame();
+  /**
+   * Get newest frame, and rectify this region only
+   * \param roi is the region (in rectified image coordinates) to return,
+   *            an empty roi gives the full image.
+   * \param rectified is set to the rectified region (empty on failure)
+   * \returns false if no frame, or roi is outside the image */
+  bool getFrame(cv::Rect roi, cv::Mat & rectified);
+  /**
+   * Rectify (undistort) an image (or a part of it) using the precomputed maps.
+   * \param raw is the full raw image
+   * \param roi is the region of the rectified image to make, empty is full image.
+   * \returns rectified image (size of roi, clipped to the image),
+   *           empty if roi is outside the image */
+  cv::Mat rectify(const cv::Mat & raw, cv::Rect roi = cv::Rect());
+  /**
+   * Undistort pixel positions (e.g. feature corners) found in a raw image
+   * \param raw are positions in raw image
+   * \param rectified are the positions in the rectified image (pixels) */
+  void undistortPoints(const std::vector<cv::Point2f> & raw, std::vector<cv::Point2f> & rectified);
+  /**
+   * Is camera open (with either backend) */
+  bool isOpen();
   /**
    * Camera matrix (3x3) */
   cv::Mat cameraMatrix;
   /**
    * Lens distortion coefficients (1x5) */
   cv::Mat distCoeffs;
-  UTime imgTime;
   /**
    * Rotation and translation matrix (4x4) from camera-centred coordinates to robot coordinates
    * - all coordinates as is used by robots, i.e x=forward, y=left and z=up) */
@@ -116,13 +173,36 @@ private:
     // transfer to the class run() function.
     obj->run();
   }
+  /**
+   * Build rectification maps (fixed point) for this image size */
+  void makeRectifyMaps(cv::Size size);
+  // precomputed rectification maps
+  cv::Mat map1, map2;
+  cv::Size mapSize;
+  std::mutex mapLock;
   // camera
-  cv::Mat frame;
   cv::VideoCapture cam;
+  // native V4L2 backend (ini camera.backend = v4l2)
+  UV4l2 v4l;
+  bool useV4l2 = false;
+  /**
+   * capture loop for the V4L2 backend */
+  void runV4l2();
+  /**
+   * Add frame to ring and tell waiting consumers */
+  void addFrame(cv::Mat & img, UTime & t);
+  /**
+   * Is a frame needed - by subscribers or waiting consumers */
+  bool frameNeeded();
+  // ring with the newest frames
+  std::vector<UCamFrame> ring;
+  int ringNewest = 0;
+  int frameSeq = 0;
+  std::mutex frameLock;
+  std::condition_variable frameReady;
+  std::atomic<int> subscribers{0};
+  std::atomic<int> waiters{0};
   int frameCnt = 0;
-  int gotFrameCnt = 0;
-  bool getNewFrame = false;
-  bool gotFrame = false;
   // support variables
   std::thread * th1 = nullptr;
   bool stopCam = false;
@@ -27,6 +27,8 @@
 #include "sdist.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "uevent.h"
 // create value
 SIrDist dist;
 
@@ -35,7 +37,6 @@ void SIrDist::setup()
 { // ensure default values
   if (not ini.has("dist"))
   { // no data yet, so generate some default values
-    ini["dist"]["rate_ms"] = "45";
     ini["dist"]["ir13cm"] = "70000 70000"; // sharp sensor calibration
     ini["dist"]["ir50cm"] = "20000 20000";
     ini["dist"]["usCalib"] = "0.00126953125"; // 5.20m / 4096 (m per LSB)
@@ -68,10 +69,12 @@ void SIrDist::setup()
   const int MSL = 100;
   char s[MSL];
   snprintf(s, MSL, "irc %d %d %d %d 1\n", ir13cm[0], ir50cm[0], ir13cm[1], ir50cm[1]);
-  teensy1.send(s);
+  teensy1.setInitCommand("irc", s);
   // subscribe to sensor data
-  std::string ss = "sub ir " + ini["dist"]["rate_ms"] + "\n";
-  teensy1.send(ss.c_str());
+  config.add("dist", "rate_ms", rateMs, 45, 1, 1000, "Distance sensor update interval (ms)");
+  subscribe();
+  // resend, if changed in ini-file
+  config.onChange("dist", [this](){ subscribe(); });
   // logfiles
   toConsole = ini["dist"]["print"] == "true";
   if (ini["dist"]["log"] == "true")
@@ -121,6 +124,7 @@ bool SIrDist::decode(const char* msg, UTime & msgTime)
       dist[1] = distAD[1] * urm09factor;
     // notify users of a new update
     updateCnt++;
+    events.notify(UEvent::DIST);
     // save to log_encoder_pose
     toLog();
     // calibration
@@ -197,3 +201,8 @@ void SIrDist::calibrate(int sensor, int distance_cm)
   calibDist = distance_cm;
   inCalibration = true;
 }
+
+void SIrDist::subscribe()
+{ // kept by teensy1 and renewed after a reconnect
+  teensy1.subscribe("ir", rateMs);
+}
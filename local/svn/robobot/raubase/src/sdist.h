@@ -48,6 +48,8 @@ public:
   void terminate();
 
 public:
+  /// update interval from Teensy (ms)
+  int rateMs = 45;
   int updateCnt = false;
   UTime updTime;
   float dist[2];
@@ -64,6 +66,9 @@ public:
   void calibrate(int sensor, int distance_cm);
   bool inCalibration = false;
 private:
+  /**
+   * Send subscription to Teensy (again) */
+  void subscribe();
   void toLog();
   bool toConsole = false;
   FILE * logfile = nullptr;
@@ -27,6 +27,8 @@
 #include "sedge.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "uevent.h"
 // create value
 SEdge sedge;
 
@@ -35,7 +37,6 @@ void SEdge::setup()
 { // ensure default values
   if (not ini.has("edge") or not ini["edge"].has("printRaw"))
   { // no data yet, so generate some default values
-    ini["edge"]["rate_ms"] = "8";
     ini["edge"]["highPower"] = "true";
     ini["edge"]["logRaw"] = "true";
     ini["edge"]["printRaw"] = "false";
@@ -45,8 +46,10 @@ void SEdge::setup()
   bool high = ini["edge"]["highPower"] == "true";
   setSensor(true, high);
   //
-  std::string s = "sub liv " + ini["edge"]["rate_ms"] + "\n";
-  teensy1.send(s.c_str());
+  config.add("edge", "rate_ms", rateMs, 8, 1, 1000, "Line sensor update interval (ms)");
+  subscribe();
+  // resend, if changed in ini-file
+  config.onChange("edge", [this](){ subscribe(); });
   //
   toConsole = ini["edge"]["printRaw"] == "true";
   // logfile
@@ -88,6 +91,7 @@ bool SEdge::decode(const char* msg, UTime & msgTime)
     }
     // notify users of a new update
     updateCnt++;
+    events.notify(UEvent::LINE);
     // save received data (if desired)
     toLog();
   }
@@ -109,7 +113,8 @@ void SEdge::setSensor(bool on, bool high)
   //lip p w h t xth wi s 	Set sensor basics p=on, w=white, h=high power, t=tilt comp, xth=cross_th, wi=wide, s=swap
   snprintf(s, MSL, "lip %d 0 %d 0 0 0 0\n", on, high);
   if (on)
-    teensy1.send(s);
+    // resend on reconnect too
+    teensy1.setInitCommand("lip", s);
   else
     teensy1.send(s, true);
 }
@@ -147,3 +152,8 @@ void SEdge::toLog()
     }
   }
 }
+
+void SEdge::subscribe()
+{ // kept by teensy1 and renewed after a reconnect
+  teensy1.subscribe("liv", rateMs);
+}
@@ -52,12 +52,17 @@ public:
   void setSensor(bool on, bool high);
 
 public:
+  /// update interval from Teensy (ms)
+  int rateMs = 8;
 //   mutex dataLock; // ensure consistency
   int updateCnt = false;
   UTime updTime;
   int edgeRaw[8];
 
 private:
+  /**
+   * Send subscription to Teensy (again) */
+  void subscribe();
   void toLog();
   bool toConsole = false;
   FILE * logfile = nullptr;
@@ -27,6 +27,8 @@
 #include "sencoder.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "uevent.h"
 // create value
 SEncoder encoder;
 
@@ -35,7 +37,6 @@ void SEncoder::setup()
 { // ensure default values
   if (not ini.has("encoder"))
   { // no data yet, so generate some default values
-    ini["encoder"]["rate_ms"] = "8";
     ini["encoder"]["log"] = "true";
     ini["encoder"]["print"] = "false";
     ini["encoder"]["encoder_reversed"] = "true";
@@ -43,8 +44,10 @@ void SEncoder::setup()
   // reset encoder and pose
   teensy1.send("enc0\n");
   // use values and subscribe to source data
-  std::string s = "sub enc " + ini["encoder"]["rate_ms"] + "\n";
-  teensy1.send(s.c_str());
+  config.add("encoder", "rate_ms", rateMs, 8, 1, 1000, "Encoder update interval (ms)");
+  subscribe();
+  // resend, if changed in ini-file
+  config.onChange("encoder", [this](){ subscribe(); });
   toConsole = ini["encoder"]["print"] == "true";
   // ensure default is true if no 'encoder_reversed' entry is available
   // Robobot motors has reversed encoders (encoder A and B is swapped)
@@ -53,10 +56,9 @@ void SEncoder::setup()
   if (ini["encoder"].has("encoder_reversed"))
     encoder_reversed = ini["encoder"]["encoder_reversed"] == "true";
   if (encoder_reversed)
-    s = "encrev 1\n";
+    teensy1.setInitCommand("encrev", "encrev 1\n");
   else
-    s = "encrev 0\n";
-  teensy1.send(s.c_str());
+    teensy1.setInitCommand("encrev", "encrev 0\n");
 
   if (ini["encoder"]["log"] == "true")
   { // open logfile
@@ -92,6 +94,7 @@ bool SEncoder::decode(const char* msg, UTime & msgTime)
     enc[1] = strtoll(p1, (char**)&p1, 10);
     // notify users of a new update
     updateCnt++;
+    events.notify(UEvent::ENCODER);
     // save to log_encoder_pose
     toLog();
     // save new value as old value
@@ -120,3 +123,8 @@ void SEncoder::toLog()
   }
 }
 
+
+void SEncoder::subscribe()
+{ // kept by teensy1 and renewed after a reconnect
+  teensy1.subscribe("enc", rateMs);
+}
@@ -58,12 +58,17 @@ public:
   void terminate();
 
 public:
+  /// update interval from Teensy (ms)
+  int rateMs = 8;
 //   mutex dataLock; // ensure consistency
   int updateCnt = false;
   UTime encTime, encTimeLast;
   int64_t enc[2] = {0};
 
 private:
+  /**
+   * Send subscription to Teensy (again) */
+  void subscribe();
   void toLog();
   int64_t encLast[2] = {0};
   bool firstEnc = true;
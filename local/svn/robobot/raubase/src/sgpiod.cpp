@@ -25,10 +25,14 @@
 #include <string>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <chrono>
 #include <thread>
 #include <iostream>
 #include "uservice.h"
+#include "uconfig.h"
+#include "uevent.h"
+#include "ureactor.h"
 #include "sgpiod.h"
 
 // inspired from https://github.com/brgl/libgpiod/blob/master/bindings/cxx/gpiod.hpp
@@ -42,20 +46,18 @@ SGpiod gpio;
 
 void SGpiod::setup()
 { // ensure default values
-  if (not ini.has("gpio"))
-  { // no data yet, so generate some default values
-    ini["gpio"]["pins_out"] = "12=0 16=0"; // give value to output pins
-    ini["gpio"]["stop_on_stop"] = "true";
-    ini["gpio"]["blink_period_ms"] = "600"; // ms
-    ini["gpio"]["log"] = "true";
-    ini["gpio"]["print"] = "false";
-  }
+  config.add("gpio", "pins_out", pinsOut, "12=0 16=0", "Output pins and initial value, e.g. '12=0 16=1'");
+  config.add("gpio", "stop_on_stop", stopOnStop, true, "Stop raubase when stop switch is pressed");
+  config.add("gpio", "blink_period_ms", blinkPeriod, 600, 10, 10000, "Blink period (ms)");
+  config.add("gpio", "log", logToFile, true, "Save pin values to log_gpio.txt");
+  config.add("gpio", "print", toConsole, false, "Print pin values to console");
+  config.add("gpio", "debounce_ms", debounceMs, 20, 0, 1000, "Input must be stable this long (ms) to be a change");
   chip = gpiod_chip_open_by_name(chipname);
   if (chip != nullptr)
   { // set output ports
     // set output pins as specified
     int out_pin_value[MAX_PINS] = {0}; /// default value
-    const char * p1 = ini["gpio"]["pins_out"].c_str();
+    const char * p1 = pinsOut.c_str();
     while (*p1 >= ' ')
     { // set output pins and initial value
       int pin = strtol(p1, (char**)&p1, 10);
@@ -70,7 +72,7 @@ void SGpiod::setup()
           v = strtol(++p1, (char**)&p1, 10);
         else
         {
-          printf("# SGpiod::setup: format 'pins_out=[ P=V]*' P=pin number, V=0|1 (found:%s)\n", ini["gpio"]["pins_out"].c_str());
+          printf("# SGpiod::setup: format 'pins_out=[ P=V]*' P=pin number, V=0|1 (found:%s)\n", pinsOut.c_str());
           break;
         }
         out_pinuse[idx] = true;
@@ -102,24 +104,25 @@ void SGpiod::setup()
       }
       else
       {
-        // default is input
+        // default is input, with events on both edges
         err = -1;
         while (err == -1)
         {
-          err = gpiod_line_request_input(pins[i], "raubase_in");
+          err = gpiod_line_request_both_edges_events_flags(pins[i], "raubase_in",
+                                                           GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN);
           if (err == -1)
             usleep(3333);
-          else
-          {
-            err = gpiod_line_set_flags(pins[i], GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN);
-            if (err != 0)
-              printf("#SGpio:: set line pull-down failed\n");
-          }
           if (loop++ > 10)
           { // failed to rerserve GPIO
             printf("# SGpio:: *********** failed to reserve GPIO pin %d\n", pinNumber[i]);
+            break;
           }
         }
+        if (err == 0)
+        { // initial value
+          raw[i] = gpiod_line_get_value(pins[i]) == 1;
+          stable[i] = raw[i];
+        }
       }
     }
   }
@@ -128,13 +131,12 @@ void SGpiod::setup()
     printf("# SGpiod::setup there is no GPIO chip found\n");
   }
   // logfiles
-  toConsole = ini["gpio"]["print"] == "true";
-  if (ini["gpio"]["log"] == "true")
+  if (logToFile)
   { // open logfile
     std::string fn = service.logPath + "log_gpio.txt";
     logfile = fopen(fn.c_str(), "w");
     fprintf(logfile, "%% gpio logfile\n");
-    fprintf(logfile, "%% pins_out %s\n", ini["gpio"]["pins_out"].c_str());
+    fprintf(logfile, "%% pins_out %s\n", pinsOut.c_str());
     fprintf(logfile, "%% 1 \tTime (sec)\n");
 //     fprintf(logfile, "%% 2 \tPin %d (start)\n", pinNumber[0]);
     fprintf(logfile, "%% 2 \tPin %2d (stop)\n", pinNumber[0]);
@@ -145,15 +147,38 @@ void SGpiod::setup()
     fprintf(logfile, "%% 7 \tPin %d\n", pinNumber[5]);
     fprintf(logfile, "%% 8 \tPin %d\n", pinNumber[6]);
   }
-  if (not service.stop)
-    // start listen to the keyboard
-    th1 = new std::thread(runObj, this);
+  // stop switch at once (not debounced),
+  // stop_on_stop is tested here, as it may be changed by a reload
+  onEdge(pinNumber[0], [this](int value, UTime &)
+  {
+    if (value == 1 and stopOnStop)
+      service.stopNow("stop_switch");
+  }, false);
+  if (chip != nullptr)
+  { // listen to the input pins
+    started.now();
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (not out_pinuse[i] and pins[i] != nullptr)
+        reactor.add(gpiod_line_event_get_fd(pins[i]), [this, i](uint32_t){ readEdge(i); });
+    }
+    debounceTimer = reactor.addTimer([this](){ debounce(); });
+    toLog(raw);
+  }
 }
 
 void SGpiod::terminate()
 {
-  if (th1 != nullptr)
-    th1->join();
+  if (chip != nullptr)
+  { // no more events
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (not out_pinuse[i] and pins[i] != nullptr)
+        reactor.remove(gpiod_line_event_get_fd(pins[i]));
+    }
+    reactor.removeTimer(debounceTimer);
+    debounceTimer = -1;
+  }
   if (logfile != nullptr)
   {
     fclose(logfile);
@@ -223,73 +248,134 @@ void SGpiod::setPin(const int pin, bool value)
 }
 
 
-void SGpiod::run()
+void SGpiod::readEdge(int i)
+{
+  struct gpiod_line_event ev;
+  if (gpiod_line_event_read(pins[i], &ev) != 0)
+    return;
+  UTime t = eventTime(ev.ts);
+  raw[i] = ev.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+  edgeTime[i] = t;
+  toLog(raw);
+  if (started.getTimePassed() < 0.1)
+  { // make sure we don't detect a power-on event (first 100ms)
+    stable[i] = raw[i];
+    return;
+  }
+  doCallbacks(i, false, raw[i], t);
+  debounce();
+}
+
+void SGpiod::debounce()
 {
-  bool pv[MAX_PINS] = {false};
-  bool changed = true;
-  int loop = 0;
-  bool stopSwitchPressed = false;
-  auto sampleTime =  1ms;
-  auto loopTime = std::chrono::steady_clock::now() + sampleTime;
-  while (not service.stop and chip != nullptr)
+  float next = -1;
+  for (int i = 0; i < MAX_PINS; i++)
   {
-    loop++;
-    changed = false;
-    for (int i = 0; i < MAX_PINS; i++)
-    {
-      pv[i] = readPin(pinNumber[i]);
-      if (loop < 100)
-        // make sure we don't detect a power-on event (first 100ms)
-        in_pin_value[i] = pv[i];
-      else if (pv[i] != in_pin_value[i])
+    if (raw[i] == stable[i])
+      continue;
+    float wait = debounceMs * 0.001 - edgeTime[i].getTimePassed();
+    if (wait <= 0)
+    { // stable long enough
       {
-        in_pin_value[i] = pv[i];
-        changed = true;
-        // debug
-        // printf("# SGpio:: pin %d(%d) changed (%d)\n",
-        //        i, pinNumber[i], pv[i]);
-        // debug end
-        if (i == 0 and
-            pv[i]==1 and
-            ini["gpio"]["stop_on_stop"] == "true")
-        { // stop switch
-          stopSwitchPressed = true;
-        }
+        std::lock_guard<std::mutex> lock(valueLock);
+        stable[i] = raw[i];
+        changes[i]++;
       }
+      valueChanged.notify_all();
+      events.notify(UEvent::GPIO);
+      doCallbacks(i, true, stable[i], edgeTime[i]);
     }
-    if (changed or loop %20 == 0)
-      toLog(pv);
-    // terminate app
-    if (stopSwitchPressed)
-    {
-      service.stopNow("stop_switch");
-      stopSwitchPressed = false;
-    }
-    //
-    std::this_thread::sleep_until(loopTime);
-    loopTime += sampleTime;
+    else if (next < 0 or wait < next)
+      next = wait;
   }
+  // wake up when next pin is stable (or stop timer)
+  reactor.setTimer(debounceTimer, next > 0 ? next : 0);
 }
 
-int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
+UTime SGpiod::eventTime(const struct timespec & ts)
 {
-  int value = -1;
   UTime t("now");
-  while (true and chip != nullptr)
+  struct timespec mono;
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  // monotonic clock (default)
+  float age = (mono.tv_sec - ts.tv_sec) + (mono.tv_nsec - ts.tv_nsec) * 1e-9;
+  if ((age < 0 or age >= 10) and ts.tv_sec > 1000000000)
+  { // realtime clock (older kernels)
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    age = (real.tv_sec - ts.tv_sec) + (real.tv_nsec - ts.tv_nsec) * 1e-9;
+  }
+  if (age >= 0 and age < 10)
+    // age is real time, now() may be faster (simulation)
+    t -= age * UTime::speedup;
+  return t;
+}
+
+void SGpiod::doCallbacks(int idx, bool debounced, int value, UTime & t)
+{
+  std::lock_guard<std::mutex> lock(callbackLock);
+  for (auto & cb : callbacks)
+  {
+    if (cb.idx == idx and cb.debounced == debounced)
+      cb.fn(value, t);
+  }
+}
+
+bool SGpiod::onEdge(int pin, std::function<void(int value, UTime & time)> callback, bool debounced)
+{
+  int idx = getPinIndex(pin);
+  if (idx < 0 or out_pinuse[idx])
   {
-    int v = readPin(pin);
-    if (v == wait4Value)
+    printf("# SGpiod::onEdge: pin %d is not an input\n", pin);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(callbackLock);
+  callbacks.push_back({idx, debounced, callback});
+  return true;
+}
+
+const bool * SGpiod::debouncedValue(int pin)
+{
+  int idx = getPinIndex(pin);
+  if (idx < 0)
+    return nullptr;
+  return &stable[idx];
+}
+
+int SGpiod::changeCount(int pin)
+{
+  int idx = getPinIndex(pin);
+  if (idx < 0)
+    return -1;
+  return changes[idx];
+}
+
+int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
+{
+  int idx = getPinIndex(pin);
+  if (chip == nullptr or idx < 0)
+    return -1;
+  if (out_pinuse[idx])
+    // no events on output pins
+    return readPin(pin) == wait4Value ? wait4Value : -1;
+  UTime t("now");
+  std::unique_lock<std::mutex> lock(valueLock);
+  while (stable[idx] != bool(wait4Value) and not service.stop)
+  { // wake now and then to see a stop
+    float w = 0.1;
+    if (timeout_ms > 0)
     {
-      value = v;
-      break;
+      w = float(timeout_ms)/1000 - t.getTimePassed();
+      if (w <= 0)
+        break;
+      if (w > 0.1)
+        w = 0.1;
     }
-    usleep(500);
-    float s = t.getTimePassed();
-    float w = float(timeout_ms)/1000;
-    if (s > w)
-      break;
+    valueChanged.wait_for(lock, std::chrono::microseconds(int(w * 1e6)));
   }
-  return value;
+  if (stable[idx] == bool(wait4Value))
+    return wait4Value;
+  return -1;
 }
 
 void SGpiod::toLog(bool pv[])
@@ -24,12 +24,21 @@
 #ifndef SGPIOD_H
 #define SGPIOD_H
 
+#include <string>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <condition_variable>
 #include <gpiod.h>
 #include "utime.h"
 
 
 /**
  * Class to help access to GPIO pins on the Raspberry
+ * Input pins are requested for edge events (both edges),
+ * and the event fds are handled by the reactor (with kernel timestamp).
+ * An input is debounced, i.e. a change is valid when
+ * the pin is stable for debounce_ms.
  *
  * Requires that gpiod and libgpiod-dev are installed
  */
@@ -55,15 +64,30 @@ public:
    * \param pin is one of 13, 6, 12, 16, 19, 26, 21, 20 */
   void setPin(const int pin, bool value);
   /**
-   * Wait for pin to be high or low
+   * Wait for (debounced) input pin to be high or low
    * \param pin - pin to wait for
    * \param timeout - value in ms, 0= wait forever
    * \param wait4Value 1 (default), 0 wait for pin to be low.
    * \return the pin value or -1 on timeout. */
   int wait4Pin(int pin, uint timeout_ms, int wait4Value = 1);
   /**
-  * to listen to pins */
-  void run();
+   * Call a function when an input pin changes.
+   * The function is called by the reactor thread, so it should be short.
+   * \param pin is the input pin
+   * \param callback is called with the new value and time of the edge
+   * \param debounced if true, then when the pin is stable,
+   * else at once at every edge (e.g. stop switch)
+   * \returns false if pin is not a valid input */
+  bool onEdge(int pin, std::function<void(int value, UTime & time)> callback, bool debounced = true);
+  /**
+   * Debounced value of an input pin
+   * \returns nullptr if pin is not valid (can be used as a mission value) */
+  const bool * debouncedValue(int pin);
+  /**
+   * Number of debounced changes of an input pin,
+   * e.g. to detect a button press since last look
+   * \returns -1 if pin is not valid */
+  int changeCount(int pin);
 
 protected:
   int getPinIndex(int pinNumber);
@@ -77,25 +101,59 @@ private:
   //
   // NB pin 13 (start) is not enabled here
   int pinNumber[MAX_PINS] = {6, 12, 16, 19, 26, 21, 20};
-  int in_pin_value[MAX_PINS] = {-1};
   bool out_pinuse[MAX_PINS] = {false};
+  /// last edge value of input pins
+  bool raw[MAX_PINS] = {false};
+  /// debounced value of input pins
+  bool stable[MAX_PINS] = {false};
+  /// time of last edge
+  UTime edgeTime[MAX_PINS];
+  int changes[MAX_PINS] = {0};
+  /// pin must be stable this long (gpio.debounce_ms)
+  int debounceMs = 20;
+  struct Callback
+  {
+    int idx;
+    bool debounced;
+    std::function<void(int value, UTime & time)> fn;
+  };
+  std::vector<Callback> callbacks;
+  std::mutex callbackLock;
+  /// for wait4Pin
+  std::mutex valueLock;
+  std::condition_variable valueChanged;
+  /// reactor timer for debounce
+  int debounceTimer = -1;
+  /// power-on time (first edges are ignored)
+  UTime started;
   bool isOK = false;
+  /// output pins and initial value (gpio.pins_out)
+  std::string pinsOut;
+  /// stop raubase on stop switch
+  bool stopOnStop = true;
+  int blinkPeriod = 600;
   // logfile
+  bool logToFile = true;
   bool toConsole = false;
   FILE * logfile = nullptr;
 
 private:
-  static void runObj(SGpiod * obj)
-  { // called, when thread is started
-      // transfer to the class run() function.
-      obj->run();
-  }
+  /**
+   * Read an edge event (called by the reactor) */
+  void readEdge(int idx);
+  /**
+   * Check for stable pins, and restart the timer if not all are stable */
+  void debounce();
   /**
    * Save pin values to log when there is a change
    * \param pv is an array of current pin values */
   void toLog(bool pv[]);
-  //
-  std::thread * th1;
+  /**
+   * Convert event timestamp to UTime (virtual time in simulation) */
+  UTime eventTime(const struct timespec & ts);
+  /**
+   * Call callbacks for this pin */
+  void doCallbacks(int idx, bool debounced, int value, UTime & t);
 };
 
 /**
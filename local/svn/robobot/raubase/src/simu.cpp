@@ -27,6 +27,8 @@
 #include "simu.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "uconfig.h"
+#include "uevent.h"
 // create value
 SImu imu;
 
@@ -35,7 +37,6 @@ void SImu::setup()
 { // ensure default values
   if (not ini.has("imu"))
   { // no data yet, so generate some default values
-    ini["imu"]["rate_ms"] = "12";
     ini["imu"]["gyro_offset"] = "0 0 0";
     ini["imu"]["log"] = "true";
     ini["imu"]["print_gyro"] = "false";
@@ -43,20 +44,20 @@ void SImu::setup()
   }
   // use values and subscribe to source data
   // like teensy1.send("sub pose 4\n");
-  std::string s = "sub gyro0 " + ini["imu"]["rate_ms"] + "\n";
-  teensy1.send(s.c_str());
-  s = "sub acc0 " + ini["imu"]["rate_ms"] + "\n";
-  teensy1.send(s.c_str());
+  config.add("imu", "rate_ms", rateMs, 12, 1, 1000, "Gyro and accelerometer update interval (ms)");
+  subscribe();
+  // resend, if changed in ini-file
+  config.onChange("imu", [this](){ subscribe(); });
   // gyro offset
   const char * p1 = ini["imu"]["gyro_offset"].c_str();
   gyroOffset[0] = strtof(p1, (char**)&p1);
   gyroOffset[1] = strtof(p1, (char**)&p1);
   gyroOffset[2] = strtof(p1, (char**)&p1);
-  // send calibration values to Teensy
+  // send calibration values to Teensy (also after a reconnect)
   const int MSL = 100;
   char ss[MSL];
   snprintf(ss, MSL, "gyrocal %g %g %g\n", gyroOffset[0], gyroOffset[1], gyroOffset[2]);
-  teensy1.send(ss);
+  teensy1.setInitCommand("gyrocal", ss);
   //
   toConsoleGyro = ini["imu"]["print_gyro"] == "true";
   toConsoleAcc = ini["imu"]["print_acc"] == "true";
@@ -106,6 +107,7 @@ bool SImu::decode(const char* msg, UTime & msgTime)
     acc[2] = strtof(p1, (char**)&p1);
     // notify users of a new update
     updateCnt++;
+    events.notify(UEvent::IMU);
     // save to log
     toLog(true);
   }
@@ -121,6 +123,7 @@ bool SImu::decode(const char* msg, UTime & msgTime)
     gyro[2] = strtof(p1, (char**)&p1);
     // notify users of a new update
     updateCnt++;
+    events.notify(UEvent::IMU);
     // save to log
     toLog(false);
     //
@@ -185,3 +188,9 @@ void SImu::calibrateGyro()
   inCalibration = true;
 }
 
+
+void SImu::subscribe()
+{ // kept by teensy1 and renewed after a reconnect
+  teensy1.subscribe("gyro0", rateMs);
+  teensy1.subscribe("acc0", rateMs);
+}
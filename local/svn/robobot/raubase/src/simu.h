@@ -50,6 +50,8 @@ public:
   void calibrateGyro();
 
 public:
+  /// update interval from Teensy (ms)
+  int rateMs = 12;
 //   mutex dataLock; // ensure consistency
   int updateCnt = false;
   UTime updTime;
@@ -60,6 +62,9 @@ public:
   bool inCalibration = false;
 
 private:
+  /**
+   * Send subscription to Teensy (again) */
+  void subscribe();
   /** save to logfile (and/or console)
    * \param accChanged if new data is from accelerometer, else it is gyro */
   void toLog(bool accChanged);
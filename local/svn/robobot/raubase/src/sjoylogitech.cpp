@@ -31,8 +31,11 @@
 #include <unistd.h>
 #include "sjoylogitech.h"
 #include "uservice.h"
+#include "uconfig.h"
 #include "cmixer.h"
 #include "cservo.h"
+#include "ureactor.h"
+#include "uevent.h"
 
 #define JS_EVENT_BUTTON         0x01    /* button pressed/released */
 #define JS_EVENT_AXIS           0x02    /* joystick moved */
@@ -78,42 +81,26 @@ SJoyLogitech joyLogi;
 
 
 void SJoyLogitech::setup()
-{ // ensure default values
-  if (not ini.has("Joy_Logitech"))
-  { // no data yet, so generate some default values
-    ini["Joy_Logitech"]["log"] = "true";
-    ini["Joy_Logitech"]["print"] = "false";
-    ini["Joy_Logitech"]["device"] = "/dev/input/js0";
-    /// limit in m/s (velocity) and radian/sec (turnrate) and us/sec (servo rate) for max axis
-    ini["Joy_Logitech"]["limit"] = "1.5 1.5 0.1";
-    ini["Joy_Logitech"]["Button_fast"] = "5";
-    ini["Joy_Logitech"]["axis_Vel"] = "4";
-    ini["Joy_Logitech"]["axis_Turn"] = "3";
-    ini["Joy_Logitech"]["slow_factor"] = "0.3";
-    ini["Joy_Logitech"]["axis_Servo"] = "1";
-    ini["Joy_Logitech"]["servo"] = "1"; // servo to control
-    ini["Joy_Logitech"]["log_all"] = "false"; // more entries in log
-  }
-  // Linux device
-  joyDevice = ini["Joy_Logitech"]["device"];
-  buttonFast = strtol(ini["Joy_Logitech"]["Button_fast"].c_str(), nullptr, 10);
-  axisVel = strtol(ini["Joy_Logitech"]["axis_Vel"].c_str(), nullptr, 10);
-  if (axisVel < 0 or axisServo >= 16) axisVel = 4;
-  axisTurn = strtol(ini["Joy_Logitech"]["axis_Turn"].c_str(), nullptr, 10);
-  if (axisTurn < 0 or axisServo >= 16) axisTurn = 3;
-  axisServo = strtol(ini["Joy_Logitech"]["axis_Servo"].c_str(), nullptr, 10);
-  if (axisServo < 0 or axisServo >= 16) axisServo = 1;
-  servoToControl = strtol(ini["Joy_Logitech"]["servo"].c_str(), nullptr, 10);
-  if (servoToControl < 1 or servoToControl > 5)
-    servoToControl = 1;
-  slowFactor = strtod(ini["Joy_Logitech"]["slow_factor"].c_str(), nullptr);
+{ // parameters (default values are added to the ini-file)
+  config.add("Joy_Logitech", "log", logToFile, true, "Save gamepad data to log_joy_logitech.txt");
+  config.add("Joy_Logitech", "print", toConsole, false, "Print gamepad data to console");
+  config.add("Joy_Logitech", "device", joyDevice, "/dev/input/js0", "Linux gamepad device");
+  config.add("Joy_Logitech", "limit", limit, 3, "1.5 1.5 0.1", 0.0, 10.0,
+             "Max velocity (m/s), turnrate (rad/s) and servo rate (us/s) at full axis");
+  config.add("Joy_Logitech", "Button_fast", buttonFast, 5, 0, 15, "Button for full speed");
+  config.add("Joy_Logitech", "axis_Vel", axisVel, 4, 0, 15, "Axis for velocity");
+  config.add("Joy_Logitech", "axis_Turn", axisTurn, 3, 0, 15, "Axis for turnrate");
+  config.add("Joy_Logitech", "slow_factor", slowFactor, 0.3, 0.0, 1.0, "Speed factor, when fast button is not pressed");
+  config.add("Joy_Logitech", "axis_Servo", axisServo, 1, 0, 15, "Axis for servo");
+  config.add("Joy_Logitech", "servo", servoToControl, 1, 1, 5, "Servo to control");
+  config.add("Joy_Logitech", "log_all", logAll, false, "Log all gamepad events (else max 100 per second)");
   // max velocity in m/sec and rad/sec
-  const char * p1 = ini["Joy_Logitech"]["limit"].c_str();
-  maxVel = strtof(p1, (char**)&p1);
-  maxTurn = strtof(p1, (char**)&p1);
+  maxVel = limit[0];
+  maxTurn = limit[1];
   // convertion factors
   velScale = maxVel/32000;
   turnScale = maxTurn/32000;
+  servoScale = limit[2]/32000;
   //
   joyRunning = initJoy();
   if (joyRunning)
@@ -121,8 +108,7 @@ void SJoyLogitech::setup()
     // if joystick available, then start in manual
 //     mixer.setManualOverride(true);
     // start read thread
-    toConsole = ini["Joy_Logitech"]["print"] == "true";
-    if (ini["Joy_Logitech"]["log"] == "true")
+    if (logToFile)
     { // open logfile
       std::string fn = service.logPath + "log_joy_logitech.txt";
       logfile = fopen(fn.c_str(), "w");
@@ -146,8 +132,14 @@ void SJoyLogitech::setup()
       fprintf(logfile, "%% 6-%d \tButtons pressed\n", number_of_buttons + 5);
       fprintf(logfile, "%% %d-%d \tAxis value\n", number_of_buttons + 6, number_of_axes + number_of_buttons + 5);
     }
-    // start listen thread
-    th1 = new std::thread(runObj, this);
+    // handle events in the reactor, after 3 seconds (as the old read thread)
+    logTime.now();
+    startTimer = reactor.addTimer([this]()
+    {
+      if (joyRunning)
+        reactor.add(jDev, [this](uint32_t ready){ onEvent(ready); });
+    });
+    reactor.setTimer(startTimer, 3.0);
     printf("# UJoyLogitech:: joystick found (%s on %s)\n", deviceName.c_str(), joyDevice.c_str());
   }
 //   else
@@ -156,8 +148,9 @@ void SJoyLogitech::setup()
 
 void SJoyLogitech::terminate()
 {
-  if (th1 != nullptr)
-    th1->join();
+  reactor.removeTimer(startTimer);
+  startTimer = -1;
+  closeJoy();
   if (logfile != nullptr)
   {
     fclose(logfile);
@@ -166,56 +159,75 @@ void SJoyLogitech::terminate()
   }
 }
 
-void SJoyLogitech::run()
-{
-  UTime t;
-  t.now();
-  sleep(3);
-  bool automaticMode = true;
-  bool automaticModeOld = false;
-  while (not service.stop and joyRunning)
-  { // handling gamepad events
-    // Device is present
-    bool gotEvent = getNewJsData();
-    if (gotEvent)
-    { //Detect manual override toggling
-      if (joyValues.button[BUTTON_START] == 1)
-        automaticMode = true;
-      if (joyValues.button[BUTTON_BACK] == 1)
-        automaticMode = false;
-      //
-      updTime.now();
-      if (not automaticMode)
-      { // we are in manual mode, so
-        // generate robot control from gamepad
-        joyControl();
-      }
-      //
-      if (t.getTimePassed() > 0.01 or ini["Joy_Logitech"]["log_all"] == "true")
-      { // don't save too fast
-        t.now();
-        toLog();
-      }
+void SJoyLogitech::onEvent(uint32_t ready)
+{ // read all ready events
+  bool axisChanged = false;
+  int type;
+  bool isInit;
+  while (joyRunning and getNewJsData(type, isInit))
+  {
+    if (isInit or service.stop)
+      // initial state of the device, just keep the values
+      continue;
+    if (type == JS_EVENT_BUTTON)
+    { // every press and release (e.g. manual override)
+      update();
+      // axes so far are used too
+      axisChanged = false;
     }
     else
-      usleep(10000);
-    // state change
-    if (automaticMode != automaticModeOld)
-    { // there is a change
-      automaticModeOld = automaticMode;
-      // Tell mixer about the change
-      mixer.setManualControl(not automaticMode, 0, 0);
-      printf("# SJoyLogitech:: state change (auto=%d)\n", automaticMode);
-    }
+      // use last value only
+      axisChanged = true;
   }
-  if (joyRunning)
+  if (axisChanged)
+    update();
+  if (ready & (EPOLLHUP | EPOLLERR))
+  { // device is gone
+    printf("# SJoyLogitech:: device lost\n");
+    closeJoy();
+  }
+}
+
+void SJoyLogitech::update()
+{ //Detect manual override toggling
+  if (joyValues.button[BUTTON_START] == 1)
+    automaticMode = true;
+  if (joyValues.button[BUTTON_BACK] == 1)
+    automaticMode = false;
+  //
+  updTime.now();
+  updateCnt++;
+  events.notify(UEvent::JOY);
+  if (not automaticMode)
+  { // we are in manual mode, so
+    // generate robot control from gamepad
+    joyControl();
+  }
+  //
+  if (logTime.getTimePassed() > 0.01 or logAll)
+  { // don't save too fast
+    logTime.now();
+    toLog();
+  }
+  // state change
+  if (automaticMode != automaticModeOld)
+  { // there is a change
+    automaticModeOld = automaticMode;
+    // Tell mixer about the change
+    mixer.setManualControl(not automaticMode, 0, 0);
+    printf("# SJoyLogitech:: state change (auto=%d)\n", automaticMode);
+  }
+}
+
+void SJoyLogitech::closeJoy()
+{
+  if (jDev >= 0)
   { // close device nicely
-    joyRunning = false;
-    if (jDev >= 0)
-      close(jDev);
-    jDev = -1;
+    reactor.remove(jDev);
+    close(jDev);
   }
-//   printf("# SJoyLogitech:: device closed\n");
+  jDev = -1;
+  joyRunning = false;
 }
 
 bool SJoyLogitech::initJoy()
@@ -247,7 +259,7 @@ bool SJoyLogitech::initJoy()
   return jDev >= 0;
 }
 
-bool SJoyLogitech::getNewJsData()
+bool SJoyLogitech::getNewJsData(int & type, bool & isInit)
 {
   struct js_event jse;
   bool lostConnection = false;
@@ -260,8 +272,7 @@ bool SJoyLogitech::getNewJsData()
     switch (errno)
     { // may be an error, or just nothing send (buffer full)
       case EAGAIN:
-        //not all send - just continue
-        usleep(100);
+        // no more data
         break;
       default:
         perror("UJoy::getNewJsData (other error device error): ");
@@ -271,13 +282,7 @@ bool SJoyLogitech::getNewJsData()
   }
   if (lostConnection)
   {
-    joyRunning = false;
-    if (jDev >= 0)
-    {
-      close(jDev);
-      jDev = -1;
-//       sendJsMessage();
-    }
+    closeJoy();
     printf("UJoy::run: getNewJsData close\n");
   }
   if (joyRunning and bytes > 0)
@@ -290,7 +295,9 @@ bool SJoyLogitech::getNewJsData()
     { //Proper joystick package has been received
       //Joystick package parser
       isOK = true;
-      jse.type &= ~JS_EVENT_INIT; /* ignore synthetic events */
+      isInit = (jse.type & JS_EVENT_INIT) != 0;
+      jse.type &= ~JS_EVENT_INIT; /* synthetic events are initial state */
+      type = jse.type;
       switch(jse.type) {
         // changed axis position
         case JS_EVENT_AXIS:
@@ -368,15 +375,15 @@ void SJoyLogitech::toLog()
     }
     if (toConsole)
     { // save all axis and buttons
-      fprintf(logfile, "%lu.%04ld %d %g %g %g ", updTime.getSec(), updTime.getMicrosec()/100,
+      printf("%lu.%04ld %d %g %g %g ", updTime.getSec(), updTime.getMicrosec()/100,
               not mixer.autonomous(), velocity, turnVelocity, servoPosition
       );
       for (int i = 0; i < number_of_buttons; i++)
-        fprintf(logfile, " %d", joyValues.button[i]);
-      fprintf(logfile, " ");
+        printf(" %d", joyValues.button[i]);
+      printf(" ");
       for (int i = 0; i < number_of_axes; i++)
-        fprintf(logfile, " %5d", joyValues.axes[i]);
-      fprintf(logfile, "\n");
+        printf(" %5d", joyValues.axes[i]);
+      printf("\n");
     }
   }
 }
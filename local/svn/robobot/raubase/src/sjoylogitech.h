@@ -24,20 +24,20 @@
 #ifndef SJOYLOGITECH_H
 #define SJOYLOGITECH_H
 
-#include <thread>
+#include <stdint.h>
 #include "utime.h"
 
 /**
  * Class to allow manual control using a Ligitech gamepad
+ * The device is handled by the reactor, all events ready
+ * are read in one go. Button events are used one by one,
+ * axis events only for the last value.
  */
 class SJoyLogitech
 {
 public:
   /** setup and request data */
   void setup();
-  /**
-   * regular update tick */
-  void run();
   /**
    * terminate */
   void terminate();
@@ -59,14 +59,22 @@ public:
   bool joyRunning = false;
 
 private:
-  /// private stuff
-  static void runObj(SJoyLogitech * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
+  /**
+   * Device is ready (called by the reactor) */
+  void onEvent(uint32_t ready);
+  /**
+   * Use the joystick state (after a button event or axis changes) */
+  void update();
+  /** close and stop using the device */
+  void closeJoy();
   void toLog();
-  std::thread * th1;
+  /// manual override is off (from start and back buttons)
+  bool automaticMode = true;
+  bool automaticModeOld = false;
+  /// last log time
+  UTime logTime;
+  /// reactor timer to start using the device
+  int startTimer = -1;
   bool toConsole = false;
   FILE * logfile = nullptr;
   //
@@ -77,6 +85,11 @@ private:
   int axisServo; // on gamepad
   int servoToControl;  // servo to control [1..5]
   float slowFactor; // when not using fast button
+  /// velocity, turnrate and servo rate at full axis
+  float limit[3];
+  bool logToFile = true;
+  /// log all events (else max 100 per second)
+  bool logAll = false;
   /**
    * Open joustick device,
    * \returns false if device not found */
@@ -84,8 +97,10 @@ private:
   std::string deviceName = "unknown";
   /**
    * Get fresh data from joystick
-   * \return false if device disappeared of received other than event data */
-  bool getNewJsData();
+   * \param type is set to JS_EVENT_BUTTON or JS_EVENT_AXIS
+   * \param isInit is set, if the event is the initial state of the device
+   * \return false if no more data, device disappeared or received other than event data */
+  bool getNewJsData(int & type, bool & isInit);
   void joyControl();
   //
   std::string joyDevice = "/dev/input/js0";
@@ -70,7 +70,8 @@ void SPyVision::setup()
       fprintf(logfile, "%% 1 \tTime (sec)\n");
       fprintf(logfile, "%% 2 \tRx or Tx\n");
       fprintf(logfile, "%% 3 \tRx or Tx message count\n");
-      fprintf(logfile, "%% 4 \tCommand send or string received\n");
+      fprintf(logfile, "%% 4 \tCommand send or (Rx) request ID (0 = not a reply to a request)\n");
+      fprintf(logfile, "%% 5 \tString received\n");
     }
     th1 = new std::thread(runObj, this);
   }
@@ -102,10 +103,29 @@ void SPyVision::terminate()
   }
 }
 
-bool SPyVision::sendCommand(const char* command)
+bool SPyVision::sendCommand(const char* command, bool log)
 {
-  return sock->sendCommand(command);
-  toLogTx(command);
+  bool isOK = sock->sendCommand(command);
+  if (isOK and log)
+    toLogTx(command);
+  return isOK;
+}
+
+int SPyVision::sendRequest(const char* command, int replies)
+{
+  int id = sock->sendRequest(command, replies);
+  if (id > 0)
+    toLogTx(command);
+  return id;
+}
+
+bool SPyVision::waitForRequest(int id, float timeoutMs)
+{ // the socket knows when the replies are received,
+  // but the data is ready when decoded
+  std::unique_lock<std::mutex> lock(decodeLock);
+  decoded.wait_for(lock, std::chrono::microseconds(int(timeoutMs * 1000)),
+                   [this, id]{ return decodedId >= id or not isConnected() or service.stop; });
+  return decodedId >= id and not sock->isExpired(id);
 }
 
 void SPyVision::run()
@@ -113,12 +133,24 @@ void SPyVision::run()
   printf("# SPyVision is running\n");
   while (not service.stop)
   { // wait for reply
-    std::string r = sock->waitForReply(40); // ms
-    if (r.length() > 1)
+    USocket::Line line;
+    if (sock->getLine(line, 100)) // ms
     { // decode the reply
-      toLogRx(r.c_str());
-      decodeReply(r.c_str());
+      if (line.text.length() > 1)
+      {
+        toLogRx(line);
+        decodeReply(line.text.c_str());
+      }
+      if (line.last)
+      { // all replies to this request are decoded
+        std::lock_guard<std::mutex> lock(decodeLock);
+        decodedId = line.id;
+        decoded.notify_all();
+      }
     }
+    else if (not sock->connected)
+      // nothing more will arrive
+      usleep(100000);
   }
   th1 = nullptr;
 }
@@ -133,10 +165,31 @@ void SPyVision::decodeReply(const char* reply)
     aruco_y = strtof(p1, (char**)&p1);
     aruco_h = strtof(p1, (char**)&p1);
     aruco_ID = strtol(p1, (char**)&p1, 10);
+    aruco_updateCnt++;
   }
   else if (strncmp(reply, "golfpos ", 8) == 0)
-  {
-
+  { // one line for each ball: 'golfpos count i x y'
+    const char * p1 = &reply[8];
+    int count = strtol(p1, (char**)&p1, 10);
+    int i = strtol(p1, (char**)&p1, 10);
+    float x = strtof(p1, (char**)&p1);
+    float y = strtof(p1, (char**)&p1);
+    if (i == 0)
+    { // first ball (or no balls)
+      golf_count = count;
+      golf_x.clear();
+      golf_y.clear();
+    }
+    if (count > 0)
+    {
+      golf_x.push_back(x);
+      golf_y.push_back(y);
+    }
+    if (i >= count - 1)
+    { // last ball in this reply
+      golf_valid = count > 0;
+      golf_updateCnt++;
+    }
   }
 }
 
@@ -157,23 +210,23 @@ bool SPyVision::waitForAruco(float timeoutMs)
   return updated;
 }
 
-void SPyVision::toLogRx(const char * got)
+void SPyVision::toLogRx(USocket::Line & got)
 {
   if (service.stop)
     return;
   if (logfile != nullptr)
   {
-    fprintf(logfile, "%lu.%04lu Rx %d %s\n",
-            sock->rxTime.getSec(), sock->rxTime.getMicrosec()/100,
-            sock->replyCnt,
-            got);
+    fprintf(logfile, "%lu.%04lu Rx %d %d %s\n",
+            got.time.getSec(), got.time.getMicrosec()/100,
+            sock->replyCnt, got.id,
+            got.text.c_str());
   }
   if (toConsole)
   {
-    printf("%lu.%04lu Rx %d %s\n",
-           sock->rxTime.getSec(), sock->rxTime.getMicrosec()/100,
-           sock->replyCnt,
-           got);
+    printf("%lu.%04lu Rx %d %d %s\n",
+           got.time.getSec(), got.time.getMicrosec()/100,
+           sock->replyCnt, got.id,
+           got.text.c_str());
   }
 }
 
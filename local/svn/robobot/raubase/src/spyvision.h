@@ -25,6 +25,10 @@
 #define SPYVISION_H
 
 #include <unistd.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "utime.h"
 #include "usocket.h"
@@ -46,8 +50,25 @@ public:
    * Listen to socket from python vision app */
   void run();
   /** send a command to python socket server
+   * \param log if false, the command is not logged (e.g. frame notifications)
    * \returns true if the request is send OK */
-  bool sendCommand(const char* command);
+  bool sendCommand(const char* command, bool log = true);
+  /**
+   * Send a request, where reply lines are expected,
+   * requests may be pipelined.
+   * \param replies is the number of expected reply lines
+   * \returns request ID or 0 if not send */
+  int sendRequest(const char* command, int replies = 1);
+  /**
+   * Wait until all replies to this request are decoded
+   * \returns false on timeout */
+  bool waitForRequest(int id, float timeoutMs);
+  /**
+   * \returns true if connected to the python socket server */
+  bool isConnected()
+  {
+    return sock != nullptr and sock->connected;
+  }
   /**
    * terminate */
   void terminate();
@@ -73,13 +94,15 @@ public: // data reply
   // golf
   bool golf_valid = false;
   int golf_count = 0;
-  // missing a vector of found ball positions
-  // or something similar
+  // ball positions relative to robot (x=forward, y=left)
+  std::vector<float> golf_x;
+  std::vector<float> golf_y;
+  int golf_updateCnt = 0;
 
 private:
   USocket * sock = nullptr;
   //
-  void toLogRx(const char * got);
+  void toLogRx(USocket::Line & got);
   void toLogTx(const char * cmd);
   bool toConsole = false;
   FILE * logfile = nullptr;
@@ -91,6 +114,10 @@ private:
   }
   // support variables
   std::thread * th1 = nullptr;
+  /// all requests up to this ID are decoded
+  int decodedId = 0;
+  std::mutex decodeLock;
+  std::condition_variable decoded;
 
 };
 
@@ -0,0 +1,481 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <fstream>
+#include <sstream>
+#include "ssim.h"
+#include "uservice.h"
+#include "uconfig.h"
+#include "ureactor.h"
+#include "steensy.h"
+#include "medge.h"
+
+// create value
+SSim sim;
+
+/**
+ * Get a value from the ini-file without making the key,
+ * the group is made (with defaults) by its own module later */
+static float iniValue(const char * group, const char * key, float def)
+{
+  std::string v = ini.get(group).get(key);
+  if (v.empty())
+    return def;
+  return strtof(v.c_str(), nullptr);
+}
+
+void SSim::setup(bool force)
+{ // ensure there is default values in ini-file
+  config.add("sim", "enabled", enabled, false, "Simulate the robot instead of using the Teensy (also option --sim)");
+  config.add("sim", "speedup", speedup, 1.0, 0.1, 100.0, "Simulated time runs this factor faster than real time");
+  config.add("sim", "step", stepTime, 0.002, 0.0002, 0.02, "Plant integration step (sec)");
+  config.add("sim", "motor_gain", motorGain, 0.1, 0.001, 10.0, "Wheel velocity per motor voltage (m/s per V)");
+  config.add("sim", "motor_tau", motorTau, 0.06, 0.001, 5.0, "Motor time constant (sec)");
+  config.add("sim", "start", start, 3, "0 0 0", -100, 100, "Start pose x, y (m) and heading (rad)");
+  config.add("sim", "map", mapFile, "", "Track map file (empty is a straight line)");
+  config.add("sim", "line_x", lineX, 0.15, -1.0, 1.0, "Line sensor distance in front of the wheels (m)");
+  config.add("sim", "line_footprint", lineFootprint, 0.008, 0.001, 0.1, "Width of the area seen by one line sensor (m)");
+  config.add("sim", "ir1", irPose[0], 3, "0.15 0 0", -360, 360, "IR sensor 1 position x, y (m) and direction (deg) on the robot");
+  config.add("sim", "ir2", irPose[1], 3, "0.10 0.08 90", -360, 360, "IR sensor 2 position x, y (m) and direction (deg) on the robot");
+  config.add("sim", "ir_max", irMax, 1.5, 0.1, 10.0, "IR sensor range (m)");
+  config.add("sim", "battery", battery, 12.0, 0.0, 20.0, "Battery voltage (V)");
+  config.add("sim", "log", log, true, "Log true robot state to log_sim.txt");
+  enabled |= force;
+  if (not enabled)
+    return;
+  // robot geometry as in MPose
+  float gear = iniValue("pose", "gear", 19.0);
+  float wheelDiameter = iniValue("pose", "wheelDiameter", 0.146);
+  float encTickPerRev = iniValue("pose", "encTickPerRev", 68);
+  wheelBase = iniValue("pose", "wheelBase", 0.243);
+  distPerTick = (wheelDiameter * M_PI) / gear / encTickPerRev;
+  x = start[0];
+  y = start[1];
+  h = start[2];
+  loadMap(mapFile);
+  if (log)
+  { // open logfile
+    std::string fn = service.logPath + "log_sim.txt";
+    logfile = fopen(fn.c_str(), "w");
+    if (logfile != nullptr)
+    {
+      fprintf(logfile, "%% Simulated robot (speedup %g, map '%s')\n", speedup, mapFile.c_str());
+      fprintf(logfile, "%% 1 \tTime (sec, simulated)\n");
+      fprintf(logfile, "%% 2,3 \tTrue position x,y (m)\n");
+      fprintf(logfile, "%% 4 \tTrue heading (rad)\n");
+      fprintf(logfile, "%% 5,6 \tWheel velocity left, right (m/s)\n");
+      fprintf(logfile, "%% 7,8 \tMotor voltage left, right (V)\n");
+      fprintf(logfile, "%% 9 \tMessages not send (socket full)\n");
+    }
+    else
+      printf("# SSim - Failed to create logfile at %s\n", fn.c_str());
+  }
+  // the clock for all modules
+  UTime::setSpeedup(speedup);
+  startTime.now();
+  lastStep = startTime;
+  stepTimer = reactor.addTimer([this](){ step(); });
+  // at high speedup the plant is integrated in more steps per timer event,
+  // as the host can not serve a timer much faster than this
+  float period = fmaxf(stepTime / speedup, 0.0005);
+  reactor.setTimer(stepTimer, period, period);
+  printf("# SSim:: simulating the robot (speedup %g, %d tapes, %d walls)\n",
+         speedup, (int)tapes.size(), (int)walls.size());
+}
+
+void SSim::terminate()
+{
+  reactor.removeTimer(stepTimer);
+  stepTimer = -1;
+  closeConnection();
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+int SSim::open()
+{
+  if (not enabled)
+    return -1;
+  closeConnection();
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0)
+  {
+    perror("# SSim::open: socketpair failed");
+    return -1;
+  }
+  simFd = fds[0];
+  rxCnt = 0;
+  reactor.add(simFd, [this](uint32_t events){ onReadable(events); });
+  return fds[1];
+}
+
+void SSim::closeConnection()
+{
+  if (simFd >= 0)
+  {
+    reactor.remove(simFd);
+    close(simFd);
+    simFd = -1;
+  }
+  // like the Teensy, when the connection is lost
+  subs.clear();
+  motorVoltage[0] = 0;
+  motorVoltage[1] = 0;
+}
+
+void SSim::onReadable(uint32_t)
+{
+  const int MRB = 512;
+  char buf[MRB];
+  int n = read(simFd, buf, MRB);
+  if (n < 0 and errno == EAGAIN)
+    return;
+  if (n <= 0)
+  { // closed by STeensy
+    closeConnection();
+    return;
+  }
+  for (int i = 0; i < n; i++)
+  {
+    if (buf[i] == '\n')
+    { // a command, skip the CRC (';NN')
+      rx[rxCnt] = '\0';
+      const char * p1 = rx;
+      if (rxCnt >= 3 and rx[0] == ';')
+        p1 += 3;
+      if (*p1 == '!')
+      { // queued messages are confirmed
+        const int MSL = MAX_RX_CNT + 10;
+        char s[MSL];
+        snprintf(s, MSL, "confirm %s", p1);
+        reply(s);
+        p1++;
+      }
+      handleCommand(p1);
+      rxCnt = 0;
+    }
+    else if (rxCnt < MAX_RX_CNT - 1)
+      rx[rxCnt++] = buf[i];
+  }
+}
+
+void SSim::handleCommand(const char * cmd)
+{
+  const int MSL = 100;
+  char s[MSL];
+  if (strncmp(cmd, "sub ", 4) == 0)
+  { // e.g. 'sub enc 8'
+    char key[MSL];
+    int ms;
+    if (sscanf(&cmd[4], "%99s %d", key, &ms) == 2)
+    {
+      if (ms > 0)
+      {
+        subs[key].interval = ms * 0.001;
+        subs[key].next.now();
+      }
+      else
+        subs.erase(key);
+    }
+  }
+  else if (strncmp(cmd, "leave", 5) == 0)
+    // stop all subscriptions
+    subs.clear();
+  else if (strncmp(cmd, "motv ", 5) == 0)
+    sscanf(&cmd[5], "%f %f", &motorVoltage[0], &motorVoltage[1]);
+  else if (strncmp(cmd, "stop", 4) == 0)
+  {
+    motorVoltage[0] = 0;
+    motorVoltage[1] = 0;
+  }
+  else if (strncmp(cmd, "servo ", 6) == 0)
+  { // 'servo n position velocity', position 10000 is off
+    int n, pos, vel;
+    if (sscanf(&cmd[6], "%d %d %d", &n, &pos, &vel) == 3 and n >= 1 and n <= 5)
+    {
+      servoState[n - 1][0] = pos != 10000;
+      if (pos != 10000)
+      {
+        servoState[n - 1][1] = pos;
+        servoState[n - 1][2] = vel;
+      }
+    }
+  }
+  else if (strncmp(cmd, "idi", 3) == 0)
+  { // robot type and name
+    std::string type = ini.get("id").get("type");
+    snprintf(s, MSL, "dname %s sim", type.empty() ? "robobot" : type.c_str());
+    reply(s);
+  }
+  // other commands (calibration, display, etc.) need no action
+}
+
+void SSim::reply(const char * msg)
+{
+  if (simFd < 0)
+    return;
+  const int MSL = MAX_RX_CNT + 20;
+  char s[MSL];
+  char crc[4];
+  teensy1.generateCRC(msg, crc);
+  int n = snprintf(s, MSL, "%s%s\n", crc, msg);
+  if (send(simFd, s, n, MSG_NOSIGNAL | MSG_DONTWAIT) != n)
+    dropCnt++;
+}
+
+void SSim::step()
+{
+  UTime now("now");
+  float dt = now - lastStep;
+  lastStep = now;
+  if (dt > 0.5 or dt < 0)
+    // not a time to simulate (time change or debugger)
+    dt = stepTime;
+  while (dt > 1e-6)
+  {
+    float d = fminf(dt, stepTime);
+    move(d);
+    dt -= d;
+  }
+  if (simFd >= 0)
+    sendData(now);
+  toLog(now);
+}
+
+void SSim::move(float dt)
+{
+  float a = fminf(dt / motorTau, 1.0);
+  for (int i = 0; i < 2; i++)
+  { // first order motor (and wheel) response
+    wheelVel[i] += (motorGain * motorVoltage[i] - wheelVel[i]) * a;
+    wheelDist[i] += wheelVel[i] * dt;
+  }
+  // differential drive
+  float v = (wheelVel[0] + wheelVel[1]) / 2.0;
+  float w = (wheelVel[1] - wheelVel[0]) / wheelBase;
+  float hm = h + w * dt / 2.0;
+  x += v * cosf(hm) * dt;
+  y += v * sinf(hm) * dt;
+  h += w * dt;
+  if (h > M_PI)
+    h -= 2 * M_PI;
+  else if (h < -M_PI)
+    h += 2 * M_PI;
+}
+
+void SSim::sendData(UTime & now)
+{
+  const int MSL = 200;
+  char s[MSL];
+  for (auto & sub : subs)
+  {
+    Subscription & d = sub.second;
+    if (now < d.next)
+      continue;
+    d.next += d.interval;
+    if (d.next < now)
+    { // do not catch up after a stall
+      d.next = now;
+      d.next += d.interval;
+    }
+    const std::string & key = sub.first;
+    if (key == "enc")
+    { // left encoder counts backwards
+      snprintf(s, MSL, "enc %lld %lld",
+               -(long long)floor(wheelDist[0] / distPerTick),
+               (long long)floor(wheelDist[1] / distPerTick));
+    }
+    else if (key == "gyro0")
+    {
+      float turnrate = (wheelVel[1] - wheelVel[0]) / wheelBase;
+      snprintf(s, MSL, "gyro0 0 0 %.3f", turnrate * 180 / M_PI);
+    }
+    else if (key == "acc0")
+      snprintf(s, MSL, "acc0 0 0 1");
+    else if (key == "liv")
+    { // sensor 0 is the left-most
+      int n = snprintf(s, MSL, "liv");
+      for (int i = 0; i < 8; i++)
+      {
+        float ly = medge.sensorWidth / 2.0 - i * medge.sensorWidth / 7.0;
+        float px = x + cosf(h) * lineX - sinf(h) * ly;
+        float py = y + sinf(h) * lineX + cosf(h) * ly;
+        float c = lineCoverage(px, py);
+        int raw = medge.calibBlack[i] + int(c * (medge.calibWhite[i] - medge.calibBlack[i]));
+        n += snprintf(&s[n], MSL - n, " %d", raw);
+      }
+    }
+    else if (key == "ir")
+    {
+      float d[2];
+      for (int i = 0; i < 2; i++)
+      {
+        float px = x + cosf(h) * irPose[i][0] - sinf(h) * irPose[i][1];
+        float py = y + sinf(h) * irPose[i][0] + cosf(h) * irPose[i][1];
+        d[i] = rayToWall(px, py, h + irPose[i][2] * M_PI / 180.0);
+      }
+      snprintf(s, MSL, "ir %.3f %.3f 0 0", d[0], d[1]);
+    }
+    else if (key == "hbt")
+    { // time, index, version, battery, state, hardware, load, motor enabled
+      snprintf(s, MSL, "hbt %.4f %d %d %.2f 0 %d 0 1 1", now - startTime,
+               int(iniValue("id", "idx", 0)), int(iniValue("state", "regbot_version", 0)),
+               battery, int(iniValue("teensy", "hardware", 9)));
+    }
+    else if (key == "svo")
+    {
+      int n = snprintf(s, MSL, "svo");
+      for (int i = 0; i < 5; i++)
+        n += snprintf(&s[n], MSL - n, " %d %d %d", servoState[i][0], servoState[i][1], servoState[i][2]);
+    }
+    else
+      // not simulated
+      continue;
+    reply(s);
+  }
+}
+
+float SSim::lineCoverage(float px, float py)
+{
+  float r = lineFootprint / 2.0;
+  float best = 0;
+  for (auto & t : tapes)
+  {
+    for (int i = 0; i + 3 < (int)t.xy.size(); i += 2)
+    { // distance to this segment
+      float x1 = t.xy[i], y1 = t.xy[i + 1];
+      float dx = t.xy[i + 2] - x1, dy = t.xy[i + 3] - y1;
+      float len2 = dx * dx + dy * dy;
+      float u = 0;
+      if (len2 > 0)
+        u = fminf(fmaxf(((px - x1) * dx + (py - y1) * dy) / len2, 0), 1);
+      float d = hypotf(px - (x1 + u * dx), py - (y1 + u * dy));
+      // part of the sensor footprint over the tape
+      float overlap = fminf(d + r, t.width / 2) - fmaxf(d - r, -t.width / 2);
+      if (overlap > 0)
+        best = fmaxf(best, fminf(overlap / lineFootprint, 1.0));
+    }
+  }
+  return best;
+}
+
+float SSim::rayToWall(float px, float py, float ph)
+{
+  float dx = cosf(ph), dy = sinf(ph);
+  float dist = irMax;
+  for (auto & w : walls)
+  {
+    for (int i = 0; i + 3 < (int)w.xy.size(); i += 2)
+    { // ray p + t*d crossing segment a + s*(b - a)
+      float ax = w.xy[i], ay = w.xy[i + 1];
+      float ex = w.xy[i + 2] - ax, ey = w.xy[i + 3] - ay;
+      float den = dx * ey - dy * ex;
+      if (fabsf(den) < 1e-9)
+        // parallel
+        continue;
+      float t = ((ax - px) * ey - (ay - py) * ex) / den;
+      float s = ((ax - px) * dy - (ay - py) * dx) / den;
+      if (t > 0 and s >= 0 and s <= 1 and t < dist)
+        dist = t;
+    }
+  }
+  return dist;
+}
+
+bool SSim::loadMap(const std::string & filename)
+{
+  tapes.clear();
+  walls.clear();
+  if (filename.empty())
+  { // default track
+    Polyline p;
+    p.width = 0.02;
+    p.xy = {0, 0, 3, 0};
+    tapes.push_back(p);
+    p.width = 0;
+    p.xy = {3.5, -1, 3.5, 1};
+    walls.push_back(p);
+    return true;
+  }
+  std::ifstream f(filename);
+  if (not f.is_open())
+  {
+    printf("# SSim::loadMap: failed to open map '%s'\n", filename.c_str());
+    return false;
+  }
+  bool isOK = true;
+  std::string line;
+  int lineNum = 0;
+  while (std::getline(f, line))
+  {
+    lineNum++;
+    size_t c = line.find('#');
+    if (c != std::string::npos)
+      line.erase(c);
+    std::istringstream words(line);
+    std::string kind;
+    if (not (words >> kind))
+      // empty line
+      continue;
+    Polyline p;
+    if (kind == "tape")
+      words >> p.width;
+    else if (kind != "wall")
+    {
+      printf("# SSim::loadMap: %s:%d: unknown '%s' (use 'tape' or 'wall')\n", filename.c_str(), lineNum, kind.c_str());
+      isOK = false;
+      continue;
+    }
+    float v;
+    while (words >> v)
+      p.xy.push_back(v);
+    if (p.xy.size() < 4 or p.xy.size() % 2 != 0 or (kind == "tape" and p.width <= 0))
+    {
+      printf("# SSim::loadMap: %s:%d: need width (tape) and at least two x y points\n", filename.c_str(), lineNum);
+      isOK = false;
+      continue;
+    }
+    if (kind == "tape")
+      tapes.push_back(p);
+    else
+      walls.push_back(p);
+  }
+  return isOK;
+}
+
+void SSim::toLog(UTime & t)
+{
+  if (logfile == nullptr or service.stop)
+    return;
+  fprintf(logfile, "%lu.%04ld %.4f %.4f %.5f %.4f %.4f %.2f %.2f %d\n",
+          t.getSec(), t.getMicrosec()/100, x, y, h,
+          wheelVel[0], wheelVel[1], motorVoltage[0], motorVoltage[1], dropCnt);
+}
@@ -0,0 +1,161 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "utime.h"
+
+/**
+ * Software-in-the-loop simulation of the robot,
+ * the in-process replacement of the Teensy (start with --sim or [sim] enabled).
+ * STeensy gets one end of a socket pair instead of the USB device,
+ * so CRC, confirm, subscriptions and decode are exactly as on the robot.
+ * The simulator answers the Teensy commands (sub, leave, motv, servo, idi)
+ * and sends the subscribed data (enc, gyro0, acc0, liv, ir, hbt, svo).
+ *
+ * The plant:
+ *   motors:      first order wheel velocity response to 'motv' voltage
+ *   drive:       differential drive with the [pose] geometry
+ *   line sensor: 8 sensors (medge sensorWidth) over the tape in the track map,
+ *                raw values from the medge calibration (black to white)
+ *   IR distance: ray to the nearest wall in the track map
+ *   IMU:         gyro is the turnrate (deg/s), acc is gravity only
+ *
+ * Track map file ([sim] map), one polyline per line, '#' is comment:
+ *   tape <width> x1 y1 x2 y2 ...   line (white tape) of this width (m)
+ *   wall x1 y1 x2 y2 ...           wall for the IR sensors
+ * Without a map, the track is a 3m straight tape along the x-axis
+ * with a wall across at x=3.5m.
+ *
+ * With [sim] speedup > 1 the UTime clock runs faster than real time,
+ * and timed waits (UEvent::wait) are shortened by the same factor,
+ * so the plans (UMission) and their timeouts follow the simulated time.
+ * NB! Modules that poll with a fixed usleep (e.g. the vision threads)
+ * still sleep in real time, so they see
+ * fewer updates per (simulated) second as the speedup increases.
+ * The data rates are also limited by how fast the host can run the
+ * plant step and the control chain, so check log_sim.txt
+ * (and the Teensy message rates), when using a high speedup. */
+class SSim
+{
+public:
+  /**
+   * Get configuration, set speedup and start the plant (if enabled)
+   * \param force enables simulation (command line option) */
+  void setup(bool force);
+  /**
+   * terminate */
+  void terminate();
+  /**
+   * Open a new connection (used by STeensy instead of the USB device)
+   * \returns the file descriptor for the Teensy side, or -1 */
+  int open();
+  /// simulation is used
+  bool enabled = false;
+  /// true robot pose (m, rad) and wheel velocity (m/s)
+  float x = 0, y = 0, h = 0;
+  float wheelVel[2] = {0};
+
+private:
+  /** command from STeensy (called by the reactor) */
+  void onReadable(uint32_t events);
+  /** handle one command line (without CRC) */
+  void handleCommand(const char * cmd);
+  /** advance the plant to now and send due data (reactor timer) */
+  void step();
+  /** advance the plant dt seconds */
+  void move(float dt);
+  /** send due subscriptions */
+  void sendData(UTime & now);
+  /** send a message (CRC is added) */
+  void reply(const char * msg);
+  /** close simulator side of connection */
+  void closeConnection();
+  /** load the track map, default track if no file */
+  bool loadMap(const std::string & filename);
+  /**
+   * Line sensor value as black (0) to white (1),
+   * for a sensor at this position in the world */
+  float lineCoverage(float px, float py);
+  /**
+   * Distance to nearest wall from (px, py) in direction ph
+   * \returns max range if no wall */
+  float rayToWall(float px, float py, float ph);
+  /** save true state to log */
+  void toLog(UTime & t);
+  //
+  /// a polyline in the map
+  struct Polyline
+  {
+    float width = 0;
+    std::vector<float> xy;
+  };
+  std::vector<Polyline> tapes;
+  std::vector<Polyline> walls;
+  /// wanted data stream
+  struct Subscription
+  {
+    float interval = 0;
+    UTime next;
+  };
+  std::map<std::string, Subscription> subs;
+  /// simulator side of the socket pair
+  int simFd = -1;
+  int stepTimer = -1;
+  static const int MAX_RX_CNT = 500;
+  char rx[MAX_RX_CNT];
+  int rxCnt = 0;
+  UTime lastStep;
+  UTime startTime;
+  /// motor voltage (from motv)
+  float motorVoltage[2] = {0};
+  /// wheel distance (m) since start
+  double wheelDist[2] = {0};
+  /// servo enabled, position and velocity
+  int servoState[5][3] = {{0}};
+  // configuration
+  float speedup = 1.0;
+  float stepTime = 0.002;
+  float motorGain = 0.1;
+  float motorTau = 0.06;
+  float start[3] = {0};
+  float lineX = 0.15;
+  float lineFootprint = 0.008;
+  float irPose[2][3];
+  float irMax = 1.5;
+  float battery = 12.0;
+  std::string mapFile;
+  // geometry from [pose]
+  float distPerTick = 0;
+  float wheelBase = 0.243;
+  /// messages not send (socket full)
+  int dropCnt = 0;
+  bool log = true;
+  FILE * logfile = nullptr;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern SSim sim;
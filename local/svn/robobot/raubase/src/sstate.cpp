@@ -27,6 +27,7 @@
 #include "steensy.h"
 #include "sstate.h"
 #include "uservice.h"
+#include "uevent.h"
 
 // create the class with received info
 SState state;
@@ -41,7 +42,7 @@ void SState::setup()
     ini["state"]["regbot_version"] = "000";
   }
   toConsole = ini["state"]["print"] == "true";
-  teensy1.send("sub hbt 500\n");
+  teensy1.subscribe("hbt", 500);
   if (ini["state"]["log"] == "true")
   { // open logfile
     std::string fn = service.logPath + "log_hbt.txt";
@@ -124,6 +125,7 @@ bool SState::decode(const char* msg, UTime & msgTime)
     // save to log if file is open
     toLog();
     dataLock.unlock();
+    events.notify(UEvent::STATE);
   }
   else
     used = false;
@@ -33,11 +33,16 @@
 #include <math.h>
 #include <string.h>
 #include <termios.h>
+#include <errno.h>
+#include <sys/eventfd.h>
 
 #include "steensy.h"
+#include "ureactor.h"
+#include "ssim.h"
 #include "uservice.h"
 #include "sstate.h"
 #include "sencoder.h"
+#include "uconfig.h"
 
 using namespace std;
 
@@ -77,6 +82,7 @@ bool UOutQueue::setMessage(const char* message)
 void STeensy::setup()
 {
   teensyConnectionOpen = false;
+  rxCnt = 0;
   if (not ini.has("id"))
   { // no ID group, so make one
     ini["id"]["type"] = "robobot";
@@ -100,6 +106,7 @@ void STeensy::setup()
   encoderReversed = ini["teensy"]["encrev"] != "false";
   if (confirmTimeout < 0.01)
     confirmTimeout = 0.02;
+  config.add("teensy", "sub_check", subCheck, 2.0, 0.0, 60.0, "Check rate of subscribed data with this interval (sec), 0 = no check");
   //
   if (ini["teensy"]["log"] == "true")
   { // open log file and write the header - else no logging
@@ -142,9 +149,20 @@ void STeensy::setup()
     // save to Regbot flash
     teensy1.send("eew\n");
   }
-  // start thread and open teensy connection
-  th1 = new std::thread(runObj, this);
-  // allow thread to open connection
+  // the reactor thread opens the connection and handles the traffic,
+  // a kick is a new message in the queue
+  kickFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  reactor.add(kickFd, [this](uint32_t)
+  {
+    uint64_t cnt;
+    if (read(kickFd, &cnt, sizeof(cnt)) == sizeof(cnt))
+      serviceQueue();
+  });
+  // connection check, open retry and resend
+  tickTimer = reactor.addTimer([this](){ tick(); });
+  tickTime.now();
+  reactor.setTimer(tickTimer, 0.001, 0.01);
+  // allow reactor to open connection
   UTime t("now");
   while (not teensyConnectionOpen and t.getTimePassed() < 10.0)
   {
@@ -163,12 +181,15 @@ void STeensy::terminate()
   UTime t("now");
   while (outQueue.size() > 0 and t.getTimePassed() < 1)
     usleep(1000);
-  stopUSB = true;
-  if (th1 != nullptr)
+  reactor.removeTimer(tickTimer);
+  tickTimer = -1;
+  if (kickFd >= 0)
   {
-    th1->join();
-//     printf("# STeensy:: read thread closed\n");
+    reactor.remove(kickFd);
+    close(kickFd);
+    kickFd = -1;
   }
+  closeUSB();
   // close logfile if open
   if (logfile != nullptr)
   {
@@ -202,11 +223,20 @@ void STeensy::sendToQueue(const char* message)
 //   if (strncmp(message, "sub enc", 7) == 0)
 //     printf("# STeensy 'sub enc' just before queue %s", message);
   // debug end
+  queueLock.lock();
   outQueue.push(UOutQueue(message));
+  // log before the reactor thread can send (and pop) the message
   dataLock.lock(); // ensure consistency
   toLogQu();
 //   printf("# STeensy::sendToQueue: added '%s' tx-queue, now size %d\n", outQueue.back().msg, (int)outQueue.size());
   dataLock.unlock();
+  queueLock.unlock();
+  if (kickFd >= 0)
+  { // tell the reactor thread
+    uint64_t one = 1;
+    if (write(kickFd, &one, sizeof(one)) < 0)
+      perror("# STeensy::sendToQueue: kick failed");
+  }
 }
 
 bool STeensy::generateCRC(const char * cmd, char * crc)
@@ -305,8 +335,8 @@ bool STeensy::sendDirect(const char* message)
       usleep(500);
     }
     if (lostConnection)
-    {
-      closeUSB();
+    { // closed by the reactor thread (on next tick)
+      closeRequest = true;
     }
     else
       lastTxTime.now();
@@ -327,6 +357,10 @@ void STeensy::closeUSB()
 //     printf("# STeensy::run - no relevant activity, shutting down\n");
 //     printf("# STeensy::run but open=%d, gotAct=%d, lastTime=%f, just=%d, justTime=%g\n",
 //           teensyConnectionOpen, gotActivityRecently, lastRxTime.getTimePassed(), justConnected, justConnectedTime.getTimePassed());
+    // no more read events (waits for a running handler, if called from another thread)
+    reactor.remove(usbport);
+    // don't close while sending
+    sendLock.lock();
     // then close the connection (after 100ms)
     usleep(100000);
     close(usbport);
@@ -334,223 +368,199 @@ void STeensy::closeUSB()
     justConnected = false;
     // stop the tx queue and empty any remaining
     confirmSend = false;
+    queueLock.lock();
     while (not outQueue.empty())
       outQueue.pop();
+    queueLock.unlock();
+    sendLock.unlock();
   }
+  closeRequest = false;
 }
 
+void STeensy::tick()
+{ // housekeeping, called by the reactor every 10ms
+  // a long gap is likely a time update (NTP), not a lost connection
+  bool ntpUpdate = tickTime.getTimePassed() > 2.0;
+  if (ntpUpdate)
+  {
+    printf("# NTP update? time glitch of %.3f sec\n", tickTime.getTimePassed());
+    fflush(nullptr);
+  }
+  tickTime.now();
+  if (closeRequest)
+    // write error in sendDirect
+    closeUSB();
+  if ((not ntpUpdate) and
+      (
+        (teensyConnectionOpen and
+          not gotActivityRecently and
+          lastRxTime.getTimePassed() > 10
+        )
+        or
+        ( justConnected and
+          justConnectedTime.getTimePassed() > 20.0
+        )
+      ))
+  { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
+    // - shut down connection and try again
+    closeUSB();
+  }
+  else if (not teensyConnectionOpen)
+  { // try to open the Teensy device (again)
+    if (openTryTime.getTimePassed() > 0.3)
+    {
+      openToTeensy();
+      openTryTime.now();
+    }
+  }
+  else
+  { // we are connected
+    if (justConnected)
+    { // no name is received yet, so try again
+      // justconnected flag is cleared when receiving a 'dname' message from Teensy
+      send("hbti\n", true); // this may be lost - but no problem
+      subLock.lock();
+      send("leave\n", true); // stop any old subscriptions
+      // and request the wanted set
+      sendRegistry();
+      justConnected = false;
+      subLock.unlock();
+      subCheckTime.now();
+    }
+    if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
+    { // are loosing data - may be just temporarily
+      gotActivityRecently = false;
+    }
+    if (subCheck > 0 and subCheckTime.getTimePassed() > subCheck)
+    { // compare data rates with subscriptions
+      checkRates();
+      subCheckTime.now();
+    }
+    // resend if not confirmed in time
+    serviceQueue();
+  }
+}
 
-
-/**
-  * receive thread */
-void STeensy::run()
-{ // read thread for REGBOT messages
-  int n = 0;
-  rxCnt = 0;
-  int readIdleLoops = 0;
-  UTime t, terr;
-  t.now();
-  terr.now();
-  const int MTS = 10;
-  UTime tit[MTS];
-  UTime msgTime;
-  float titsum[MTS] = {0};
-  // get robot name
-  tit[9].now();
-  bool ntpUpdate = false;
-  while (not stopUSB)
-  { // handle Teensy connection
-    if ((not ntpUpdate) and
-        (
-          (teensyConnectionOpen and
-            not gotActivityRecently and
-            lastRxTime.getTimePassed() > 10
-          )
-          or
-          ( justConnected and
-            justConnectedTime.getTimePassed() > 20.0
-          )
-        ))
-    { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
-      // - shut down connection and try another
-      tit[0].now();
-      // close for now
-      closeUSB();
-      // try another device
-//       usbdeviceNum = (usbdeviceNum + 1) % MAX_USB_DEVS;
-      titsum[0] += tit[0].getTimePassed();
+void STeensy::onReadable(uint32_t events)
+{ // data from the Teensy (called by the reactor)
+  const int MRB = 512;
+  char buf[MRB];
+  int n = read(usbport, buf, MRB);
+  if (n < 0 and errno == EAGAIN)
+    // no data
+    return;
+  if (n < 0 or (events & (EPOLLHUP | EPOLLERR)))
+  { // port error (e.g. unplugged) - close connection
+    perror("Teensy::onReadable port error");
+    closeUSB();
+    return;
+  }
+  // assemble to text lines
+  UTime msgTime("now");
+  for (int i = 0; i < n; i++)
+  {
+    char c = buf[i];
+    if (rxCnt == 0 and c != ';')
+      // a message starts with the CRC
+      continue;
+    rx[rxCnt++] = c;
+    if (c == '\n')
+    { // terminate string - end of new line
+      rx[rxCnt] = '\0';
+      handleLine(msgTime);
+      // reset receive buffer
+      rxCnt = 0;
     }
-    else if (not teensyConnectionOpen)
-    { // wait a second (or 2) then try to open the Teensy device
-      tit[1].now();
-//       sleep(1);
-      // then try to connect
-      openToTeensy();
-      titsum[1] += tit[1].getTimePassed();
+    else if (rxCnt >= MAX_RX_CNT - 1)
+    {
+      printf("# STeensy::onReadable: too long message (discarded)\n");
+      rxCnt = 0;
+    }
+  }
+  // a confirm may release the next message
+  serviceQueue();
+}
+
+void STeensy::handleLine(UTime & msgTime)
+{
+  // save to logfile if open
+  dataLock.lock();
+  toLogRx(rx, msgTime);
+  dataLock.unlock();
+  // handle this message line
+  if (crcCheck(rx))
+  { // got (at least) one valid message
+    const char * okMsg = &rx[3];
+    // check if this is a confirm message
+    if (strncmp(okMsg, "confirm", 7) == 0)
+    { // release next message
+      confirmSend = true;
+//       printf("# STeensy::run: received a confirm: '%s'\n", rx);
+      messageConfirmed(rx);
     }
     else
-    { // we are connected
-      //
-      if (justConnected)
-      { // no name is received yet, so try again
-        tit[2].now();
-        // justconnected flag is cleared when receiving a 'dname' message from Teensy
-        send("hbti\n", true); // this may be lost - but no problem
-        send("leave\n", true); // stop any old subscriptions
-        justConnected = false;
-        t.now();
-        titsum[2] += tit[2].getTimePassed();
-      }
-      if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
-      { // are loosing data - may be just temporarily
-        gotActivityRecently = false;
-      }
-      // read from USB
-      tit[3].now();
-      //
-      n = read(usbport, &rx[rxCnt], 1);
-      if (n < 0 and errno == EAGAIN)
-      { // no data
-        n = 0;
-      }
-      else if (n < 0)
-      { // other error - close connection
-        perror("Teensy::run port error");
-        usleep(100000);
-        sendLock.lock();
-        // don't close while sending
-        closeUSB();
-        sendLock.unlock();
-      }
-      titsum[3] += tit[3].getTimePassed();
-      //
-      // got a character - assemble to a text line
-      if (n == 1)
-      { // got a new character
-        tit[4].now(); // timing
-        //
-        if (rxCnt > 0)
-        {
-          rxCnt++;
-        }
-        else if (rx[0] == ';')
-        { // first character in a new message
-          msgTime.now();
-          rxCnt = 1;
-        }
-        // check for end of message, i.e. a new-line
-        if (rx[rxCnt-1] == '\n')
-        { // terminate string - end of new line
-          rx[rxCnt] = '\0';
-          // save to logfile if open
-          dataLock.lock();
-          toLogRx(rx, msgTime);
-          dataLock.unlock();
-          // handle this message line
-          if (crcCheck(rx))
-          { // got (at least) one valid message
-            const char * okMsg = &rx[3];
-            // check if this is a confirm message
-            if (strncmp(okMsg, "confirm", 7) == 0)
-            { // release next message
-              confirmSend = true;
-//               printf("# STeensy::run: received a confirm: '%s'\n", rx);
-              messageConfirmed(rx);
-            }
-            else
-            {
-              decode(okMsg, msgTime);
-            }
-          }
-          else
-            printf("# Teenst message discarded (crc-error) %s\n", rx);
-          // set activity timeer
-          gotActivityRecently = true;
-          lastRxTime.now();
-          // reset receive buffer
-          rxCnt = 0;
-          n = 0;
-          gotCnt++;
-        }
-        titsum[4] += tit[4].getTimePassed();
-      }
-      else if (n == 0)
-      {  // no data, so wait a bit
-        tit[5].now();
-        //
-        usleep(1000);
-        readIdleLoops++;
-        titsum[5] += tit[5].getTimePassed();
+    {
+      decode(okMsg, msgTime);
+    }
+  }
+  else
+    printf("# Teenst message discarded (crc-error) %s\n", rx);
+  // set activity timeer
+  gotActivityRecently = true;
+  lastRxTime.now();
+  gotCnt++;
+}
+
+void STeensy::serviceQueue()
+{
+  if (outQueue.empty() or not teensyConnectionOpen)
+    return;
+  if (outQueue.front().isSend)
+  { // waiting for confirmation - check for too old
+//     printf("# STeensy:: is send - waiting for confirm\n");
+    float dt = outQueue.front().sendAt.getTimePassed();
+    if (dt > confirmTimeout)
+    {
+      // debug
+      const int MSL = 150;
+      char s[MSL];
+      snprintf(s, MSL, "# STeensy::serviceQueue: msg retry after %.5f sec (retry=%d, queue=%d):%s",
+              outQueue.front().sendAt.getTimePassed(),
+              outQueue.front().resendCnt,
+              (int)outQueue.size(),
+              outQueue.front().msg);
+      toLog(s);
+//       printf("%s\n", s);
+      // debug end
+      if (outQueue.front().resendCnt < confirmRetryCntMax)
+      { // just try again
+        outQueue.front().isSend = false;
+        confirmRetryCnt++;
       }
       else
-      { // debug n!= 0 and n!= 1
-        tit[6].now();
-        printf("# Teensy::run: got n=%d chars, when asking for 1!\n", n);
-        fflush(nullptr);
-        titsum[6] += tit[6].getTimePassed();
-      }
-      if (not outQueue.empty())
-      { // got the first confirm
-//         printf("#STeensy:: que not empty\n");
-        tit[7].now();
-        if (not outQueue.front().isSend)
-        { // new message to send
-          sendLock.lock();
-          if (teensyConnectionOpen)
-          { // send queued message to Teensy
-            write(usbport, outQueue.front().msg, outQueue.front().len);
-            outQueue.front().sendAt.now();
-            outQueue.front().isSend = true;
-            outQueue.front().resendCnt++;
-            toLogTx();
-          }
-          sendLock.unlock();
-        }
-        else
-        { // waiting for confirmation - check for too old
-//           printf("# STeensy:: is send - waiting for confirm\n");
-          float dt = outQueue.front().sendAt.getTimePassed();
-          if (dt > confirmTimeout)
-          {
-            // debug
-            const int MSL = 150;
-            char s[MSL];
-            snprintf(s, MSL, "# STeensy::run: msg retry after %.5f sec (retry=%d, queue=%d):%s",
-                    outQueue.front().sendAt.getTimePassed(),
-                    outQueue.front().resendCnt,
-                    (int)outQueue.size(),
-                    outQueue.front().msg);
-            toLog(s);
-//             printf("%s\n", s);
-            // debug end
-            if (outQueue.front().resendCnt < confirmRetryCntMax)
-            { // just try again
-              outQueue.front().isSend = false;
-              confirmRetryCnt++;
-            }
-            else
-            { // remove from queue
-              outQueue.pop();
-              confirmRetryDump++;
-            }
-          }
-        }
-        titsum[7] += tit[7].getTimePassed();
+      { // remove from queue
+        queueLock.lock();
+        outQueue.pop();
+        queueLock.unlock();
+        confirmRetryDump++;
       }
-    } // connected
-    ntpUpdate = false;
-    if (tit[9].getTimePassed() > 2.0)
-    { // likely NTP update received
-      titsum[9]+= tit[9].getTimePassed();
-      // don't close connection based on a NPT update
-      ntpUpdate = true;
-      printf("# NTP update? time glitch of %.3f sec\n", tit[9].getTimePassed());
-      fflush(nullptr);
     }
-    tit[9].now();
   }
-  closeUSB();
-}  
+  if (not outQueue.empty() and not outQueue.front().isSend)
+  { // new message to send
+    sendLock.lock();
+    if (teensyConnectionOpen)
+    { // send queued message to Teensy
+      if (write(usbport, outQueue.front().msg, outQueue.front().len) < 0)
+        perror("# STeensy::serviceQueue: write failed");
+      outQueue.front().sendAt.now();
+      outQueue.front().isSend = true;
+      outQueue.front().resendCnt++;
+      toLogTx();
+    }
+    sendLock.unlock();
+  }
+}
 
 bool STeensy::crcCheck(const char* msg)
 { // not really a standard CRC check, just modulus of all visible characters
@@ -597,7 +607,9 @@ void STeensy::messageConfirmed(const char* confirm)
                   outQueue.front().queuedAt.getTimePassed(),
                   outQueue.front().msg);
         }
+        queueLock.lock();
         outQueue.pop();
+        queueLock.unlock();
       }
       else
       { // no match
@@ -622,7 +634,11 @@ bool STeensy::openToTeensy()
   { // not open already - try
 //     printf("# Teensy::openToTeensy '%s' - opening\n", usbDevName);
     // make reservation
-    usbport = open(usbDevName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+    if (sim.enabled)
+      // simulated robot in this process
+      usbport = sim.open();
+    else
+      usbport = open(usbDevName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
     if (usbport == -1)
     { // open failed
       if (connectErrCnt < 5)
@@ -632,8 +648,7 @@ bool STeensy::openToTeensy()
         snprintf(s, MSL, "# STeensy::openToTeensy open '%s' failed:",  usbDevName.c_str());
         perror(s);
       }
-      // wait a bit before re-connection
-      usleep(300000);
+      // retry is after 0.3 sec (see tick())
       connectErrCnt++;
     }
     else
@@ -643,16 +658,19 @@ bool STeensy::openToTeensy()
       if (-1 == (flags = fcntl(usbport, F_GETFL, 0)))
         flags = 0;
       fcntl(usbport, F_SETFL, flags | O_NONBLOCK);
-  // #ifdef armv7l
-      struct termios options;
-      tcgetattr(usbport, &options);
-      options.c_cflag = B115200 | CS8 | CLOCAL | CREAD; //<Set baud rate
-      options.c_iflag = IGNPAR;
-      options.c_oflag = 0;
-      options.c_lflag = 0;
-      tcsetattr(usbport, TCSANOW, &options);
-  // #endif
-      tcflush(usbport, TCIFLUSH);
+      if (not sim.enabled)
+      { // serial port settings
+    // #ifdef armv7l
+        struct termios options;
+        tcgetattr(usbport, &options);
+        options.c_cflag = B115200 | CS8 | CLOCAL | CREAD; //<Set baud rate
+        options.c_iflag = IGNPAR;
+        options.c_oflag = 0;
+        options.c_lflag = 0;
+        tcsetattr(usbport, TCSANOW, &options);
+    // #endif
+        tcflush(usbport, TCIFLUSH);
+      }
       connectErrCnt = 0;
     }
     teensyConnectionOpen = usbport != -1;
@@ -666,6 +684,8 @@ bool STeensy::openToTeensy()
       usleep(5000);
       teensy1.send("sub hbt 50\n", true);
       usleep(50000);
+      // received data is handled by the reactor
+      reactor.add(usbport, [this](uint32_t events){ onReadable(events); });
       //         initMessageTypes();
       // assume there is activity - in order not to
       // get an error right away
@@ -690,7 +710,8 @@ bool STeensy::decode(const char * msg, UTime & msgTime)
   // debug end
   bool used = true;
   const char * p1 = msg;
-
+  // arrival statistics for subscribed data
+  countArrival(msg);
   if      (service.decode(msg, msgTime))
   { // nothing to do here
   }
@@ -722,9 +743,131 @@ int STeensy::getTeensyCommError(int& retryCnt)
 
 int STeensy::getTeensyCommQueueSize()
 {
+  std::lock_guard<std::mutex> lock(queueLock);
   return outQueue.size();
 }
 
+void STeensy::subscribe(const char* key, int rateMs)
+{
+  const int MSL = 50;
+  char s[MSL];
+  snprintf(s, MSL, "sub %s %d\n", key, rateMs);
+  subLock.lock();
+  Subscription & sub = subscriptions[key];
+  sub.rateMs = rateMs;
+  sub.count = 0;
+  sub.since.now();
+  sub.resendCnt = 0;
+  // if just connected, then the full set is send soon
+  if (teensyConnectionOpen and not justConnected)
+    sendToQueue(s);
+  subLock.unlock();
+}
+
+void STeensy::setInitCommand(const char* key, const char* command)
+{
+  subLock.lock();
+  bool found = false;
+  for (auto & ic : initCommands)
+  {
+    if (ic.first == key)
+    { // replace
+      ic.second = command;
+      found = true;
+      break;
+    }
+  }
+  if (not found)
+    initCommands.push_back({key, command});
+  if (teensyConnectionOpen and not justConnected)
+    sendToQueue(command);
+  subLock.unlock();
+}
+
+void STeensy::sendRegistry()
+{ // subLock is locked by caller
+  const int MSL = 100;
+  char s[MSL];
+  int n = 0;
+  // as one batch, i.e. with nothing else in between
+  queueLock.lock();
+  dataLock.lock();
+  for (auto & ic : initCommands)
+  {
+    outQueue.push(UOutQueue(ic.second.c_str()));
+    toLogQu();
+  }
+  for (auto & [key, sub] : subscriptions)
+  {
+    if (sub.rateMs > 0)
+    {
+      snprintf(s, MSL, "sub %s %d\n", key.c_str(), sub.rateMs);
+      outQueue.push(UOutQueue(s));
+      toLogQu();
+      n++;
+    }
+    sub.count = 0;
+    sub.since.now();
+  }
+  dataLock.unlock();
+  queueLock.unlock();
+  snprintf(s, MSL, "Send %d init commands and %d subscriptions\n", (int)initCommands.size(), n);
+  toLog(s);
+}
+
+void STeensy::countArrival(const char* msg)
+{ // first word is the stream name
+  const char * p1 = strchr(msg, ' ');
+  if (p1 == nullptr)
+    return;
+  std::string key(msg, p1 - msg);
+  subLock.lock();
+  auto it = subscriptions.find(key);
+  if (it != subscriptions.end())
+    it->second.count++;
+  subLock.unlock();
+}
+
+void STeensy::checkRates()
+{
+  if (getTeensyCommQueueSize() > 0)
+    // still sending, subscriptions may be on the way
+    return;
+  const int MSL = 150;
+  char s[MSL];
+  subLock.lock();
+  for (auto & [key, sub] : subscriptions)
+  {
+    float dt = sub.since.getTimePassed();
+    if (sub.rateMs <= 0 or dt * 1000 < sub.rateMs * 3)
+      // stopped, or too early to tell
+      continue;
+    sub.measuredMs = dt * 1000;
+    if (sub.count > 0)
+      sub.measuredMs /= sub.count;
+    // allow a few lost messages and a bit of jitter
+    bool wrong = sub.count == 0 or
+                 sub.measuredMs > sub.rateMs * 1.5 + 2 or
+                 sub.measuredMs < sub.rateMs * 0.5;
+    if (wrong)
+    { // resend this subscription
+      sub.resendCnt++;
+      snprintf(s, MSL, "Subscription '%s' got %d messages in %.2fs (%.1fms), wanted %dms, resend %d\n",
+               key.c_str(), sub.count, dt, sub.measuredMs, sub.rateMs, sub.resendCnt);
+      toLog(s);
+      if (sub.resendCnt <= 3)
+        printf("# STeensy::checkRates: %s", s);
+      snprintf(s, MSL, "sub %s %d\n", key.c_str(), sub.rateMs);
+      sendToQueue(s);
+    }
+    else
+      sub.resendCnt = 0;
+    sub.count = 0;
+    sub.since.now();
+  }
+  subLock.unlock();
+}
+
 void STeensy::toLog(const char* msg)
 {
   UTime t("now");
@@ -25,9 +25,10 @@
 #ifndef SREGBOT_H
 #define SREGBOT_H
 
+#include <map>
 #include <mutex>
 #include <queue>
-#include <thread>
+#include <vector>
 #include <string.h>
 #include <string>
 
@@ -107,6 +108,8 @@ private:
 //   mutex logMtx;
   std::mutex eventUpdate;
   std::mutex sendLock;
+  /// modules may add to the tx queue from more threads
+  std::mutex queueLock;
   // receive buffer
   static const int MAX_RX_CNT = 1000;
   char rx[MAX_RX_CNT];
@@ -124,8 +127,14 @@ private:
   bool justConnected = false;
   bool confirmSend = false;
 //   bool sendDirectFromNowOn = false;
-
-  std::thread * th1;
+  /// eventfd to tell the reactor about a new message in the queue
+  int kickFd = -1;
+  /// reactor timer for connection check and resend
+  int tickTimer = -1;
+  UTime tickTime;
+  UTime openTryTime;
+  /// a send failed, the reactor thread should close the port
+  bool closeRequest = false;
 
   
 public:
@@ -144,11 +153,6 @@ public:
    * \param direct for bypassing the default message queue
    * \returns true if send direct and delivered OK */
   bool send(const char * message, bool direct = false);
-  /**
-   * runs the receive thread 
-   * This run() function is called in a thread after a start() call.
-   * This function will not return until the thread is stopped. */
-  void run();
   /**
   * decode commands potentially for this device */
   bool decode(const char* msg, UTime & msgTime);
@@ -165,6 +169,19 @@ public:
   /**
    * get messages queued, but not send */
   int getTeensyCommQueueSize();
+  /**
+   * Subscribe to a data stream from the Teensy, e.g. subscribe("enc", 8).
+   * The subscription is kept, and is send again (with all other subscriptions)
+   * after every (re)connect, and if the measured rate is wrong.
+   * \param key is the stream name, and the first word in the data messages
+   * \param rateMs is the wanted interval (ms), 0 to stop the stream */
+  void subscribe(const char * key, int rateMs);
+  /**
+   * Send a configuration command (e.g. calibration values) now,
+   * and again after every (re)connect.
+   * \param key identifies the command, a new command with the same key replaces the old
+   * \param command is the message to send (with or without '\n') */
+  void setInitCommand(const char * key, const char * command);
 
 private:
   /**
@@ -186,11 +203,20 @@ private:
     return (usbport >= 0) and gotActivityRecently and not justConnected;
   }
 
-  static void runObj(STeensy * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
+  /**
+   * Read available data from the Teensy (called by the reactor)
+   * \param events is the ready epoll events */
+  void onReadable(uint32_t events);
+  /**
+   * Handle a received line in rx (log, confirm or decode) */
+  void handleLine(UTime & msgTime);
+  /**
+   * Connection timeout, open retry, subscription check and resend,
+   * called by a reactor timer every 10ms */
+  void tick();
+  /**
+   * Send next message in the queue, or resend if not confirmed in time */
+  void serviceQueue();
 
 private:
   /**
@@ -204,6 +230,8 @@ private:
    * Check, and
    * release the next in the queue */
   void messageConfirmed(const char * confirm);
+  /**
+   * Close the port, not to be called while holding sendLock */
   void closeUSB();
   int connectErrCnt = 0;
   ///
@@ -211,7 +239,6 @@ private:
   UTime lastRxTime;
   std::string usbDevName;
   bool initialized = false;
-  bool stopUSB = false;
   /**
    * uotgoing message queue */
   std::queue<UOutQueue> outQueue;
@@ -230,6 +257,38 @@ private:
   void toLogQu();
   /// should logged messages be printed on console too.
   bool toConsole = false;
+  /**
+   * A wanted data stream from the Teensy */
+  struct Subscription
+  {
+    int rateMs = 0;
+    /// messages received since 'since'
+    int count = 0;
+    UTime since;
+    /// measured interval in last check (ms)
+    float measuredMs = 0;
+    /// resend because of wrong rate
+    int resendCnt = 0;
+  };
+  /// wanted data streams, send after every connect
+  std::map<std::string, Subscription> subscriptions;
+  /// configuration commands (key, command), send after every connect
+  std::vector<std::pair<std::string, std::string>> initCommands;
+  std::mutex subLock;
+  /// interval (sec) to check subscription rates, 0 is no check
+  float subCheck = 2.0;
+  UTime subCheckTime;
+  /**
+   * Queue all init commands and subscriptions as one batch,
+   * called when a connection is (re)established */
+  void sendRegistry();
+  /**
+   * Count a received data message, if it is a subscribed stream */
+  void countArrival(const char * msg);
+  /**
+   * Compare arrival rates with the subscribed rates,
+   * and resend subscriptions with a wrong rate */
+  void checkRates();
   /// data io logfile
   FILE * logfile = nullptr;
   std::mutex dataLock; // ensure consistency
@@ -0,0 +1,515 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "uconfig.h"
+#include "uservice.h"
+#include "ureactor.h"
+
+// create value
+UConfig config;
+
+
+void UConfig::add(const char * group, const char * key, int & field, int def, int min, int max, const char * description)
+{
+  Param p;
+  p.group = group;
+  p.key = key;
+  p.def = std::to_string(def);
+  p.description = description;
+  p.type = INT;
+  p.field = &field;
+  p.min = min;
+  p.max = max;
+  addParam(p);
+}
+
+void UConfig::add(const char * group, const char * key, float & field, float def, float min, float max, const char * description)
+{
+  Param p;
+  const int MSL = 30;
+  char s[MSL];
+  snprintf(s, MSL, "%g", def);
+  p.group = group;
+  p.key = key;
+  p.def = s;
+  p.description = description;
+  p.type = FLOAT;
+  p.field = &field;
+  p.min = min;
+  p.max = max;
+  addParam(p);
+}
+
+void UConfig::add(const char * group, const char * key, bool & field, bool def, const char * description)
+{
+  Param p;
+  p.group = group;
+  p.key = key;
+  p.def = def ? "true" : "false";
+  p.description = description;
+  p.type = BOOL;
+  p.field = &field;
+  addParam(p);
+}
+
+void UConfig::add(const char * group, const char * key, std::string & field, const char * def, const char * description)
+{
+  Param p;
+  p.group = group;
+  p.key = key;
+  p.def = def;
+  p.description = description;
+  p.type = STRING;
+  p.field = &field;
+  addParam(p);
+}
+
+void UConfig::add(const char * group, const char * key, int * field, int count, const char * def, int min, int max, const char * description)
+{
+  Param p;
+  p.group = group;
+  p.key = key;
+  p.def = def;
+  p.description = description;
+  p.type = INTS;
+  p.field = field;
+  p.count = count;
+  p.min = min;
+  p.max = max;
+  addParam(p);
+}
+
+void UConfig::add(const char * group, const char * key, float * field, int count, const char * def, float min, float max, const char * description)
+{
+  Param p;
+  p.group = group;
+  p.key = key;
+  p.def = def;
+  p.description = description;
+  p.type = FLOATS;
+  p.field = field;
+  p.count = count;
+  p.min = min;
+  p.max = max;
+  addParam(p);
+}
+
+void UConfig::addParam(Param & p)
+{ // modules may be set up in parallel
+  std::lock_guard<std::mutex> lock(reloadLock);
+  if (not ini[p.group].has(p.key))
+    // not in ini-file, so use default
+    ini[p.group][p.key] = p.def;
+  Param * old = find(p.group.c_str(), p.key.c_str());
+  if (old != nullptr)
+    // setup called again
+    *old = p;
+  else
+    params.push_back(p);
+  load(p);
+}
+
+UConfig::Param * UConfig::find(const char * group, const char * key)
+{
+  for (auto & p : params)
+  { // ini-file keys are not case sensitive
+    if (strcasecmp(p.group.c_str(), group) == 0 and strcasecmp(p.key.c_str(), key) == 0)
+      return &p;
+  }
+  return nullptr;
+}
+
+bool UConfig::load(Param & p)
+{
+  return load(p, ini[p.group][p.key]);
+}
+
+bool UConfig::load(Param & p, const std::string & value)
+{
+  const char * p1 = value.c_str();
+  bool inRange = true;
+  switch (p.type)
+  {
+    case INT:
+    {
+      int v = strtol(p1, nullptr, 10);
+      int lv = std::max(int(p.min), std::min(int(p.max), v));
+      inRange = v == lv;
+      *(int*)p.field = lv;
+      break;
+    }
+    case FLOAT:
+    {
+      float v = strtof(p1, nullptr);
+      float lv = fmaxf(p.min, fminf(p.max, v));
+      inRange = v == lv;
+      *(float*)p.field = lv;
+      break;
+    }
+    case BOOL:
+      *(bool*)p.field = value == "true" or value == "1";
+      break;
+    case STRING:
+      *(std::string*)p.field = value;
+      break;
+    case INTS:
+    { // missing values are taken from the default
+      const char * p2 = p.def.c_str();
+      for (int i = 0; i < p.count; i++)
+      {
+        const char * p3 = p1;
+        int v = strtol(p1, (char**)&p1, 10);
+        int d = strtol(p2, (char**)&p2, 10);
+        if (p1 == p3)
+          v = d;
+        int lv = std::max(int(p.min), std::min(int(p.max), v));
+        inRange &= v == lv;
+        ((int*)p.field)[i] = lv;
+      }
+      break;
+    }
+    case FLOATS:
+    {
+      const char * p2 = p.def.c_str();
+      for (int i = 0; i < p.count; i++)
+      {
+        const char * p3 = p1;
+        float v = strtof(p1, (char**)&p1);
+        float d = strtof(p2, (char**)&p2);
+        if (p1 == p3)
+          v = d;
+        float lv = fmaxf(p.min, fminf(p.max, v));
+        inRange &= v == lv;
+        ((float*)p.field)[i] = lv;
+      }
+      break;
+    }
+  }
+  if (not inRange)
+    printf("# UConfig:: [%s] %s=%s is out of range [%g..%g], limited to %s\n",
+           p.group.c_str(), p.key.c_str(), value.c_str(), p.min, p.max, valueString(p).c_str());
+  return inRange;
+}
+
+std::string UConfig::valueString(Param & p)
+{
+  const int MSL = 300;
+  char s[MSL] = "";
+  int n = 0;
+  switch (p.type)
+  {
+    case INT:
+      snprintf(s, MSL, "%d", *(int*)p.field);
+      break;
+    case FLOAT:
+      snprintf(s, MSL, "%g", *(float*)p.field);
+      break;
+    case BOOL:
+      snprintf(s, MSL, "%s", *(bool*)p.field ? "true" : "false");
+      break;
+    case STRING:
+      return *(std::string*)p.field;
+    case INTS:
+      for (int i = 0; i < p.count and n < MSL; i++)
+        n += snprintf(&s[n], MSL - n, "%s%d", i > 0 ? " " : "", ((int*)p.field)[i]);
+      break;
+    case FLOATS:
+      for (int i = 0; i < p.count and n < MSL; i++)
+        n += snprintf(&s[n], MSL - n, "%s%g", i > 0 ? " " : "", ((float*)p.field)[i]);
+      break;
+  }
+  return s;
+}
+
+void UConfig::print(FILE * f)
+{
+  const char * typeName[] = {"int", "float", "bool", "string", "int[]", "float[]"};
+  std::string group;
+  for (auto & p : params)
+  {
+    if (p.group != group)
+    {
+      fprintf(f, "[%s]\n", p.group.c_str());
+      group = p.group;
+    }
+    fprintf(f, "  %-20s = %-16s ; %s", p.key.c_str(), valueString(p).c_str(), typeName[p.type]);
+    if (p.type == INT or p.type == FLOAT or p.type == INTS or p.type == FLOATS)
+      fprintf(f, " [%g..%g]", p.min, p.max);
+    fprintf(f, " (default %s) %s\n", p.def.c_str(), p.description.c_str());
+  }
+}
+
+bool UConfig::valid(Param & p, const std::string & value)
+{
+  const char * p1 = value.c_str();
+  bool isOK = true;
+  int n = 1;
+  switch (p.type)
+  {
+    case BOOL:
+      isOK = value == "true" or value == "false" or value == "1" or value == "0";
+      break;
+    case STRING:
+      break;
+    case INTS:
+    case FLOATS:
+      n = p.count;
+      // fall through
+    case INT:
+    case FLOAT:
+      for (int i = 0; i < n and isOK; i++)
+      {
+        const char * p2 = p1;
+        float v;
+        if (p.type == INT or p.type == INTS)
+        { // an integer, e.g. not 1.5 (that load() would truncate)
+          v = strtol(p1, (char**)&p1, 10);
+          isOK = *p1 == '\0' or isspace(*p1);
+        }
+        else
+          v = strtof(p1, (char**)&p1);
+        // all values must be there
+        isOK &= p1 != p2 and v >= p.min and v <= p.max;
+      }
+      break;
+  }
+  if (not isOK)
+    printf("# UConfig::reload: [%s] %s=%s is not valid (range [%g..%g])\n",
+           p.group.c_str(), p.key.c_str(), value.c_str(), p.min, p.max);
+  return isOK;
+}
+
+void UConfig::setup()
+{
+  add("config", "watch", watch, true, "Reload ini-file, when it is saved");
+  // the file as loaded
+  service.iniFile->read(fileIni);
+  if (not watch)
+    return;
+  // watch the directory, as editors often save by renaming a new file
+  std::string dir = ".";
+  watchName = service.iniFileName;
+  size_t n = watchName.rfind('/');
+  if (n != std::string::npos)
+  {
+    dir = watchName.substr(0, n);
+    watchName = watchName.substr(n + 1);
+  }
+  watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watchFd < 0 or inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+  {
+    perror("# UConfig::setup: failed to watch ini-file");
+    if (watchFd >= 0)
+      close(watchFd);
+    watchFd = -1;
+    return;
+  }
+  reloadTimer = reactor.addTimer([this]()
+  { // skip events from the rest of the save
+    const int MBL = 4096;
+    char buf[MBL];
+    while (read(watchFd, buf, MBL) > 0) {}
+    if (not service.stop)
+      reload();
+  });
+  reactor.add(watchFd, [this](uint32_t){ onWatch(); });
+}
+
+void UConfig::terminate()
+{
+  reactor.removeTimer(reloadTimer);
+  reloadTimer = -1;
+  if (watchFd >= 0)
+  {
+    reactor.remove(watchFd);
+    close(watchFd);
+    watchFd = -1;
+  }
+}
+
+bool UConfig::reload()
+{
+  std::lock_guard<std::mutex> lock(reloadLock);
+  mINI::INIStructure newIni;
+  if (not service.iniFile->read(newIni))
+  {
+    printf("# UConfig::reload: failed to read %s\n", service.iniFileName.c_str());
+    return false;
+  }
+  // find changed values (compared to the file, not to values changed by raubase)
+  std::vector<std::pair<std::string, std::string>> changedKeys;
+  bool isOK = true;
+  for (auto const & group : newIni)
+  {
+    for (auto const & item : group.second)
+    {
+      if (fileIni.has(group.first) and fileIni[group.first].has(item.first) and
+          fileIni[group.first][item.first] == item.second)
+        continue;
+      changedKeys.push_back({group.first, item.first});
+      Param * p = find(group.first.c_str(), item.first.c_str());
+      if (p != nullptr)
+        isOK &= valid(*p, item.second);
+    }
+  }
+  for (auto & c : checks)
+  { // values that depend on each other
+    bool isChanged = false;
+    for (auto & k : changedKeys)
+      isChanged |= strcasecmp(c.first.c_str(), k.first.c_str()) == 0;
+    if (isChanged)
+      isOK &= c.second(newIni);
+  }
+  if (not isOK)
+  {
+    printf("# UConfig::reload: nothing changed\n");
+    return false;
+  }
+  if (changedKeys.empty())
+    return true;
+  // apply all
+  std::vector<std::string> groups;
+  int gen = generation + 1;
+  for (auto & k : changedKeys)
+  {
+    const std::string & value = newIni[k.first][k.second];
+    Param * p = find(k.first.c_str(), k.second.c_str());
+    if (p == nullptr)
+    { // read from ini by other threads, so ini is not changed
+      printf("# UConfig::reload: [%s] %s=%s is ignored (used after restart only)\n",
+             k.first.c_str(), k.second.c_str(), value.c_str());
+      continue;
+    }
+    // the key exists (added by addParam()), so no map is changed,
+    // and the module uses the field, not this string (saved at exit)
+    ini[p->group][p->key] = value;
+    if (p->owner != nullptr)
+    { // the module applies the value in its loop
+      printf("# UConfig::reload: [%s] %s=%s\n", k.first.c_str(), k.second.c_str(), value.c_str());
+      p->pending = value;
+      p->hasPending = true;
+    }
+    else
+    {
+      printf("# UConfig::reload: [%s] %s=%s\n", k.first.c_str(), k.second.c_str(), value.c_str());
+      load(*p, value);
+    }
+    groupGeneration[k.first] = gen;
+    if (groups.empty() or groups.back() != k.first)
+      groups.push_back(k.first);
+  }
+  // remember the file as now used
+  fileIni.clear();
+  for (auto const & group : newIni)
+    for (auto const & item : group.second)
+      fileIni[group.first][item.first] = item.second;
+  // now modules may use the new values
+  generation = gen;
+  for (auto & cb : callbacks)
+  {
+    for (auto & g : groups)
+    {
+      if (strcasecmp(cb.first.c_str(), g.c_str()) == 0)
+      {
+        cb.second();
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+void UConfig::onChange(const char * group, std::function<void()> callback)
+{
+  std::lock_guard<std::mutex> lock(reloadLock);
+  callbacks.push_back({group, callback});
+}
+
+bool UConfig::changed(const char * group, int & gen, const void * owner)
+{
+  if (gen == generation)
+    // nothing is reloaded
+    return false;
+  std::lock_guard<std::mutex> lock(reloadLock);
+  std::string g = group;
+  for (auto & c : g)
+    c = tolower(c);
+  bool isChanged = false;
+  auto it = groupGeneration.find(g);
+  if (it != groupGeneration.end())
+    isChanged = it->second > gen;
+  if (owner != nullptr)
+  { // safe point for the owner to get the new values
+    for (auto & p : params)
+    {
+      if (p.owner == owner and p.hasPending and strcasecmp(p.group.c_str(), group) == 0)
+      {
+        load(p, p.pending);
+        p.hasPending = false;
+        isChanged = true;
+      }
+    }
+  }
+  gen = generation;
+  return isChanged;
+}
+
+void UConfig::staged(const char * group, const void * owner, size_t size)
+{
+  std::lock_guard<std::mutex> lock(reloadLock);
+  const char * first = (const char *)owner;
+  for (auto & p : params)
+  {
+    const char * f = (const char *)p.field;
+    if (f >= first and f < first + size and strcasecmp(p.group.c_str(), group) == 0)
+      p.owner = owner;
+  }
+}
+
+void UConfig::check(const char * group, std::function<bool(mINI::INIStructure & newIni)> check)
+{
+  std::lock_guard<std::mutex> lock(reloadLock);
+  checks.push_back({group, check});
+}
+
+void UConfig::onWatch()
+{
+  const int MBL = 4096;
+  char buf[MBL] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  bool isIni = false;
+  int len = read(watchFd, buf, MBL);
+  for (char * p = buf; p < buf + len; )
+  {
+    struct inotify_event * ev = (struct inotify_event *)p;
+    if (ev->len > 0 and watchName == ev->name)
+      isIni = true;
+    p += sizeof(struct inotify_event) + ev->len;
+  }
+  if (isIni)
+    // wait for the editor to finish
+    reactor.setTimer(reloadTimer, 0.1);
+}
@@ -0,0 +1,185 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdio.h>
+#include "uini.h"
+
+using namespace std;
+
+/**
+ * Typed configuration parameters.
+ * A module declares each parameter once (in its setup()) with
+ * type, default, range and description, and the value
+ * is then read from the ini-file into the bound field.
+ * If the ini-file has no value, the default is added to the ini-file.
+ * Loops then use the (typed) field and never the ini-file strings.
+ *
+ * The ini-file can be reloaded while running (when the file is saved,
+ * or by the 'reload' command). Changed values are validated
+ * and then applied to the bound fields, before
+ * the generation is incremented. Fields used in a module loop
+ * are marked as staged (staged(group, this)), and these get the new value
+ * only when the module calls changed(group, generation, this)
+ * at a safe point in its loop, where also derived values
+ * (e.g. a PID controller) are updated. Callbacks (onChange) can e.g. resend
+ * subscriptions to the Teensy.
+ * Values in the ini-file that are not registered (still read directly from ini)
+ * are reported as ignored until restart.
+ * */
+class UConfig
+{
+public:
+  enum Type {INT, FLOAT, BOOL, STRING, INTS, FLOATS};
+  /**
+   * A registered parameter */
+  struct Param
+  {
+    std::string group;
+    std::string key;
+    std::string def;
+    std::string description;
+    Type type;
+    /// bound field (or first element of array)
+    void * field;
+    /// number of values (arrays)
+    int count = 1;
+    float min = 0;
+    float max = 0;
+    /// module that applies a new value in its own loop (staged), nullptr if applied by reload
+    const void * owner = nullptr;
+    /// new value waiting for the owner
+    bool hasPending = false;
+    std::string pending;
+  };
+  /**
+   * Add a parameter and load its value into field
+   * \param group is the ini-file section
+   * \param key is the ini-file key
+   * \param field is the variable that gets the value
+   * \param def is the default value
+   * \param min,max is the allowed range (value is limited to this range)
+   * \param description is used in the parameter list (--params) */
+  void add(const char * group, const char * key, int & field, int def, int min, int max, const char * description);
+  void add(const char * group, const char * key, float & field, float def, float min, float max, const char * description);
+  void add(const char * group, const char * key, bool & field, bool def, const char * description);
+  void add(const char * group, const char * key, std::string & field, const char * def, const char * description);
+  /**
+   * Add a parameter with a number of space separated values
+   * \param count is number of values in field array */
+  void add(const char * group, const char * key, int * field, int count, const char * def, int min, int max, const char * description);
+  void add(const char * group, const char * key, float * field, int count, const char * def, float min, float max, const char * description);
+  /**
+   * Start watching the ini-file for changes (config.watch) */
+  void setup();
+  /**
+   * Stop watching the ini-file */
+  void terminate();
+  /**
+   * Re-read the ini-file, and apply values that are changed in the file.
+   * All changed values are validated first.
+   * \returns false if a value is invalid (then nothing is changed) */
+  bool reload();
+  /**
+   * Call this function after a reload, where
+   * a value in this group has changed (called by the reactor thread, or a 'reload' command) */
+  void onChange(const char * group, std::function<void()> callback);
+  /**
+   * Test for changes in a group, to be called at a safe point in a module loop.
+   * \param generation is the generation last seen by the caller, and is updated.
+   * \param owner is the module, staged values for fields in this module are applied now.
+   * \returns true if a value in group is changed since this generation */
+  bool changed(const char * group, int & generation, const void * owner = nullptr);
+  /**
+   * Mark parameters in this group, that are bound to fields in owner, as staged,
+   * i.e. a reloaded value is applied by the owner in changed(group, generation, owner).
+   * To be called in setup() after the parameters are added. */
+  template <class T>
+  void staged(const char * group, T * owner)
+  {
+    staged(group, owner, sizeof(T));
+  }
+  void staged(const char * group, const void * owner, size_t size);
+  /**
+   * Add a check of the new values in a group (e.g. values that depend on each other),
+   * called before a reload is applied.
+   * \param check gets the new ini-file content and returns false if not valid
+   *              (then nothing is changed) */
+  void check(const char * group, std::function<bool(mINI::INIStructure & newIni)> check);
+  /// incremented after each applied reload
+  std::atomic<int> generation = 0;
+  /**
+   * Load value from ini-file into the field
+   * \returns false if a value was out of range */
+  bool load(Param & p);
+  /**
+   * Load this value into the field
+   * \returns false if a value was out of range */
+  bool load(Param & p, const std::string & value);
+  /**
+   * Print all registered parameters with value and description */
+  void print(FILE * f);
+  /**
+   * Find a parameter
+   * \returns nullptr if not registered */
+  Param * find(const char * group, const char * key);
+
+  std::vector<Param> params;
+
+private:
+  /**
+   * Check that this value can be used for this parameter
+   * \returns false if not a number or out of range */
+  bool valid(Param & p, const std::string & value);
+  /**
+   * Directory event (called by the reactor),
+   * a reload is started, when the ini-file is saved */
+  void onWatch();
+  bool watch = true;
+  /// inotify fd for the ini-file directory
+  int watchFd = -1;
+  /// reactor timer to reload, when the editor is finished
+  int reloadTimer = -1;
+  std::string watchName;
+  /// ini-file content at last (re)load
+  mINI::INIStructure fileIni;
+  /// generation of last change for each group
+  std::map<std::string, int> groupGeneration;
+  std::vector<std::pair<std::string, std::function<void()>>> callbacks;
+  std::vector<std::pair<std::string, std::function<bool(mINI::INIStructure &)>>> checks;
+  std::mutex reloadLock;
+  /** register (or replace) and load */
+  void addParam(Param & p);
+  /** value to string (for the parameter list) */
+  std::string valueString(Param & p);
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UConfig config;
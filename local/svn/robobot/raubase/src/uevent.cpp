@@ -0,0 +1,74 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <chrono>
+#include "utime.h"
+#include "uevent.h"
+
+UEvent events;
+
+
+void UEvent::notify(int topics)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < TOPICS; i++)
+    {
+      if (topics & (1 << i))
+        cnt[i]++;
+    }
+  }
+  cv.notify_all();
+}
+
+void UEvent::current(Seen & seen)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (int i = 0; i < TOPICS; i++)
+    seen.cnt[i] = cnt[i];
+}
+
+int UEvent::updated(int mask, Seen & seen)
+{
+  int topics = 0;
+  for (int i = 0; i < TOPICS; i++)
+  {
+    if ((mask & (1 << i)) and seen.cnt[i] != cnt[i])
+    {
+      topics |= 1 << i;
+      seen.cnt[i] = cnt[i];
+    }
+  }
+  return topics;
+}
+
+int UEvent::wait(int mask, Seen & seen, float timeout)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  int topics = updated(mask, seen);
+  if (topics == 0 and timeout > 0)
+  { // timeout is in (UTime) clock seconds, that may run faster in simulation
+    cv.wait_for(guard, std::chrono::microseconds(int(timeout / UTime::speedup * 1e6)),
+                [&]{ topics = updated(mask, seen); return topics != 0; });
+  }
+  return topics;
+}
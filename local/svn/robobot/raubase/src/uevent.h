@@ -0,0 +1,84 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+/**
+ * Notification of data updates, so that a user (e.g. a mission)
+ * can sleep until something relevant is updated, rather than polling.
+ * Each topic has an update count, the producer calls notify(topic)
+ * after the data is updated (just after updateCnt++). */
+class UEvent
+{
+public:
+  enum Topic
+  {
+    POSE = 0x001,
+    EDGE = 0x002,
+    LINE = 0x004,
+    DIST = 0x008,
+    IMU = 0x010,
+    ENCODER = 0x020,
+    STATE = 0x040,
+    BALL = 0x080,
+    GPIO = 0x100,
+    JOY = 0x200,
+    USER = 0x400,
+    ARUCO = 0x800,
+    ALL = 0xfff
+  };
+  static const int TOPICS = 12;
+  /**
+   * Update count for all topics, as seen by a user */
+  struct Seen
+  {
+    uint32_t cnt[TOPICS] = {0};
+  };
+  /**
+   * Data for these topics are updated
+   * \param topics is one or more Topic values */
+  void notify(int topics);
+  /**
+   * Get the current update counts, e.g. before first wait */
+  void current(Seen & seen);
+  /**
+   * Wait until one of the topics in mask is updated
+   * (since the counts in seen), or timeout.
+   * \param mask is the topics of interest
+   * \param seen is the update counts seen, updated on return
+   * \param timeout is max wait time in seconds (UTime seconds, see UTime::speedup)
+   * \returns the updated topics (0 if timeout) */
+  int wait(int mask, Seen & seen, float timeout);
+
+private:
+  /** topics with new data since seen (lock must be held) */
+  int updated(int mask, Seen & seen);
+  std::mutex lock;
+  std::condition_variable cv;
+  uint32_t cnt[TOPICS] = {0};
+};
+
+extern UEvent events;
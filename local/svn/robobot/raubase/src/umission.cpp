@@ -0,0 +1,225 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <stdio.h>
+#include "umission.h"
+#include "uservice.h"
+#include "cmixer.h"
+
+
+UMission::UMission(const char * missionName, FILE * missionLog, bool print)
+{
+  name = missionName;
+  logfile = missionLog;
+  toConsole = print;
+  // default is to stop
+  lostAction = []()
+  {
+    mixer.setVelocity(0);
+    mixer.setTurnrate(0);
+  };
+}
+
+UMission::~UMission()
+{
+  join();
+}
+
+void UMission::wakeOn(int wakeTopics)
+{
+  topics |= wakeTopics;
+}
+
+void UMission::state(int id, const char * stateName, Action entry)
+{
+  states[id].name = stateName;
+  states[id].entry = entry;
+}
+
+void UMission::when(int from, Guard guard, int to, const char * note, Action action)
+{
+  Transition t;
+  t.guard = guard;
+  t.to = to;
+  t.note = note;
+  t.action = action;
+  states[from].transitions.push_back(t);
+}
+
+void UMission::after(int from, float seconds, int to, const char * note, Action action)
+{
+  Transition t;
+  t.after = seconds;
+  t.to = to;
+  t.note = note;
+  t.action = action;
+  states[from].transitions.push_back(t);
+}
+
+void UMission::onLost(Action action)
+{
+  lostAction = action;
+}
+
+float UMission::stateTime()
+{
+  return stateStart.getTimePassed();
+}
+
+void UMission::enter(int id)
+{
+  current = id;
+  stateStart.now();
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "state %d '%s'", id, states[id].name.c_str());
+  toLog(s);
+  if (states[id].entry)
+    states[id].entry();
+}
+
+UMission::Transition * UMission::test()
+{
+  float dt = stateTime();
+  for (auto & t : states[current].transitions)
+  {
+    if (t.after >= 0)
+    {
+      if (dt >= t.after)
+        return &t;
+    }
+    else if (t.guard and t.guard())
+      return &t;
+  }
+  return nullptr;
+}
+
+float UMission::nextTimer()
+{ // wake up now and then anyhow, to detect a stop
+  float wait = 0.1;
+  float dt = stateTime();
+  for (auto & t : states[current].transitions)
+  {
+    if (t.after >= 0 and t.after - dt < wait)
+      wait = t.after - dt;
+  }
+  if (wait < 0.0005)
+    wait = 0.0005;
+  return wait;
+}
+
+bool UMission::run(int firstState)
+{
+  const int MSL = 300;
+  char s[MSL];
+  if (states.count(firstState) == 0)
+  {
+    snprintf(s, MSL, "%s has no state %d", name.c_str(), firstState);
+    toLog(s);
+    return false;
+  }
+  snprintf(s, MSL, "%s started", name.c_str());
+  toLog(s);
+  UEvent::Seen seen;
+  events.current(seen);
+  int end = 0;
+  enter(firstState);
+  while (not service.stop)
+  {
+    Transition * t = test();
+    if (t == nullptr)
+    { // sleep until relevant data or timer
+      events.wait(topics, seen, nextTimer());
+      continue;
+    }
+    snprintf(s, MSL, "%s (after %.3f sec)", t->note.c_str(), stateTime());
+    toLog(s);
+    if (t->action)
+      t->action();
+    if (t->to < 0)
+    {
+      end = t->to;
+      break;
+    }
+    if (states.count(t->to) == 0)
+    {
+      snprintf(s, MSL, "no state %d - lost", t->to);
+      toLog(s);
+      end = LOST;
+      break;
+    }
+    enter(t->to);
+  }
+  if (end == FINISHED)
+  {
+    snprintf(s, MSL, "%s finished", name.c_str());
+    toLog(s);
+  }
+  else
+  {
+    if (end == LOST)
+      snprintf(s, MSL, "%s got lost - stopping", name.c_str());
+    else
+      snprintf(s, MSL, "%s stopped", name.c_str());
+    toLog(s);
+    if (lostAction)
+      lostAction();
+  }
+  return end == FINISHED;
+}
+
+void UMission::start(int firstState)
+{
+  first = firstState;
+  if (th1 == nullptr)
+    th1 = new std::thread(runObj, this);
+}
+
+bool UMission::join()
+{
+  if (th1 != nullptr)
+  {
+    th1->join();
+    delete th1;
+    th1 = nullptr;
+  }
+  return finished;
+}
+
+void UMission::toLog(const char* message)
+{
+  if (service.stop)
+    return;
+  UTime t("now");
+  if (logfile != nullptr)
+  {
+    fprintf(logfile, "%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
+            current,
+            message);
+  }
+  if (toConsole)
+  {
+    printf("%lu.%04ld %d %% %s\n", t.getSec(), t.getMicrosec()/100,
+           current,
+           message);
+  }
+}
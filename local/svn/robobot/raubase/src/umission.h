@@ -0,0 +1,144 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include "utime.h"
+#include "uevent.h"
+
+/**
+ * A mission as a state machine, with states, guards and actions.
+ * The mission sleeps until a topic it depends on (wakeOn) is updated,
+ * or a timer expires, then the transitions from the current state are tested
+ * in the order they are added; the first that is true is taken.
+ * All transitions are logged with time and time in state.
+ *
+ * Missions run in sequence by calling run() for each,
+ * or in parallel by start() for each, and then join().
+ *
+ * Example:
+ *   UMission m("plan40", logfile, true);
+ *   m.wakeOn(UEvent::POSE | UEvent::DIST);
+ *   m.state(10, "forward", [](){ mixer.setVelocity(0.2); });
+ *   m.when(10, [](){ return pose.dist > 1.0; }, 20, "driven 1m");
+ *   m.after(10, 10, UMission::LOST, "too slow");
+ *   m.run(10);
+ * */
+class UMission
+{
+public:
+  /// target states that ends the mission
+  static const int FINISHED = -1;
+  static const int LOST = -2;
+  typedef std::function<bool()> Guard;
+  typedef std::function<void()> Action;
+  /**
+   * \param name is used in the log
+   * \param logfile is the mission logfile (may be nullptr)
+   * \param toConsole prints the log to console too */
+  UMission(const char * name, FILE * logfile, bool toConsole);
+  /** waits for the thread (if started) */
+  ~UMission();
+  /**
+   * Topics that may change a guard (UEvent::Topic values) */
+  void wakeOn(int topics);
+  /**
+   * Add a state
+   * \param id is the state number (used in log)
+   * \param entry is called when the state is entered */
+  void state(int id, const char * name, Action entry = nullptr);
+  /**
+   * Add a transition, taken when the guard is true
+   * \param action is called before the next state is entered */
+  void when(int from, Guard guard, int to, const char * note, Action action = nullptr);
+  /**
+   * Add a transition, taken after some time in the state */
+  void after(int from, float seconds, int to, const char * note, Action action = nullptr);
+  /**
+   * Action when the mission is lost, default is to stop the robot */
+  void onLost(Action action);
+  /**
+   * Run the mission (blocking)
+   * \param first is the first state
+   * \returns true if finished (not lost or stopped) */
+  bool run(int first);
+  /**
+   * Run the mission in its own thread */
+  void start(int first);
+  /**
+   * Wait for a started mission to end
+   * \returns true if finished */
+  bool join();
+  /**
+   * Time (sec) in current state */
+  float stateTime();
+  /**
+   * Write a timestamped message to the mission log */
+  void toLog(const char * message);
+  /// current state
+  int current = 0;
+
+private:
+  struct Transition
+  {
+    Guard guard;
+    /// timer transition, if >= 0
+    float after = -1;
+    int to;
+    std::string note;
+    Action action;
+  };
+  struct State
+  {
+    std::string name;
+    Action entry;
+    std::vector<Transition> transitions;
+  };
+  /**
+   * Test transitions from current state
+   * \returns the transition to take, or nullptr */
+  Transition * test();
+  /**
+   * Time until next timer transition in current state
+   * \returns max wait time (sec) */
+  float nextTimer();
+  void enter(int id);
+  std::string name;
+  std::map<int, State> states;
+  int topics = 0;
+  Action lostAction;
+  UTime stateStart;
+  FILE * logfile;
+  bool toConsole;
+  bool finished = false;
+  std::thread * th1 = nullptr;
+  int first = 0;
+  static void runObj(UMission * obj)
+  {
+    obj->finished = obj->run(obj->first);
+  }
+};
@@ -0,0 +1,177 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "ureactor.h"
+
+UReactor reactor;
+
+
+void UReactor::setup()
+{
+  if (th1 != nullptr)
+    return;
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epfd < 0 or stopFd < 0)
+  {
+    perror("# UReactor::setup: failed");
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = stopFd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &ev);
+  stopped = false;
+  th1 = new std::thread(runObj, this);
+}
+
+void UReactor::terminate()
+{
+  if (th1 != nullptr)
+  {
+    stopped = true;
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0)
+      perror("# UReactor::terminate: wake failed");
+    th1->join();
+    th1 = nullptr;
+  }
+  if (stopFd >= 0)
+    close(stopFd);
+  if (epfd >= 0)
+    close(epfd);
+  stopFd = -1;
+  epfd = -1;
+  if (not handlers.empty())
+    printf("# UReactor::terminate: %d fds not removed\n", (int)handlers.size());
+  handlers.clear();
+}
+
+bool UReactor::add(int fd, Handler handler, uint32_t events)
+{
+  if (epfd < 0 or fd < 0)
+    return false;
+  std::lock_guard<std::recursive_mutex> lock(dispatchLock);
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    perror("# UReactor::add: epoll_ctl failed");
+    return false;
+  }
+  handlers[fd] = std::make_shared<Handler>(handler);
+  return true;
+}
+
+void UReactor::remove(int fd)
+{
+  std::lock_guard<std::recursive_mutex> lock(dispatchLock);
+  if (handlers.erase(fd) > 0 and epfd >= 0)
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int UReactor::addTimer(std::function<void()> fn)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+  {
+    perror("# UReactor::addTimer: failed");
+    return -1;
+  }
+  bool ok = add(fd, [fd, fn](uint32_t)
+  {
+    uint64_t expired;
+    if (read(fd, &expired, sizeof(expired)) == sizeof(expired))
+      fn();
+  });
+  if (not ok)
+  {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void UReactor::setTimer(int timer, float delay, float period)
+{
+  if (timer < 0)
+    return;
+  struct itimerspec ts;
+  ts.it_value.tv_sec = int(delay);
+  ts.it_value.tv_nsec = long((delay - int(delay)) * 1e9);
+  if (delay > 0 and ts.it_value.tv_sec == 0 and ts.it_value.tv_nsec == 0)
+    // a zero value would stop the timer
+    ts.it_value.tv_nsec = 1;
+  ts.it_interval.tv_sec = int(period);
+  ts.it_interval.tv_nsec = long((period - int(period)) * 1e9);
+  timerfd_settime(timer, 0, &ts, nullptr);
+}
+
+void UReactor::removeTimer(int timer)
+{
+  if (timer < 0)
+    return;
+  remove(timer);
+  close(timer);
+}
+
+void UReactor::run()
+{
+  const int MEV = 32;
+  struct epoll_event evs[MEV];
+  while (not stopped)
+  {
+    int n = epoll_wait(epfd, evs, MEV, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("# UReactor::run: epoll_wait failed");
+      break;
+    }
+    wakeCnt++;
+    for (int i = 0; i < n; i++)
+    {
+      int fd = evs[i].data.fd;
+      if (fd == stopFd)
+      {
+        stopped = true;
+        break;
+      }
+      std::lock_guard<std::recursive_mutex> lock(dispatchLock);
+      // may be removed by an earlier handler in this batch
+      auto h = handlers.find(fd);
+      if (h == handlers.end())
+        continue;
+      // keep the handler, even if it removes itself
+      std::shared_ptr<Handler> handler = h->second;
+      (*handler)(evs[i].events);
+      dispatchCnt++;
+    }
+  }
+}
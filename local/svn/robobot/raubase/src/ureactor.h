@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <sys/epoll.h>
+
+/**
+ * One thread that waits (in epoll) for all file descriptors
+ * (devices, sockets, timers) and calls the handler for the ready ones.
+ * A handler should be short (read what is ready and return),
+ * heavy work belongs in a thread of its own (e.g. vision).
+ * Handlers may add and remove fds (also their own).
+ * remove() from another thread waits until a running handler is finished,
+ * so the fd can be closed right after. */
+class UReactor
+{
+public:
+  /// called with the ready epoll events (EPOLLIN, EPOLLHUP, ...)
+  typedef std::function<void(uint32_t events)> Handler;
+  /**
+   * Create the epoll set and start the thread */
+  void setup();
+  /**
+   * Stop the thread, all modules should have removed their fds */
+  void terminate();
+  /**
+   * Add a file descriptor
+   * \param events is the epoll events to wait for
+   * \returns false if not added */
+  bool add(int fd, Handler handler, uint32_t events = EPOLLIN);
+  /**
+   * Remove a file descriptor (the fd is not closed) */
+  void remove(int fd);
+  /**
+   * Create a timer (not started)
+   * \param fn is called when the timer expires
+   * \returns timer id, or -1 on error */
+  int addTimer(std::function<void()> fn);
+  /**
+   * Start or stop a timer
+   * \param delay is time (sec) to first call, 0 stops the timer
+   * \param period is time between calls (sec), 0 is one call only */
+  void setTimer(int timer, float delay, float period = 0);
+  /**
+   * Remove and close a timer */
+  void removeTimer(int timer);
+  /// number of wake-ups and handler calls
+  int wakeCnt = 0;
+  int dispatchCnt = 0;
+
+private:
+  void run();
+  static void runObj(UReactor * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  int epfd = -1;
+  /// to wake the thread at terminate
+  int stopFd = -1;
+  bool stopped = false;
+  std::map<int, std::shared_ptr<Handler>> handlers;
+  /// held while a handler runs (recursive, as handlers may add and remove)
+  std::recursive_mutex dispatchLock;
+  std::thread * th1 = nullptr;
+};
+
+extern UReactor reactor;
@@ -0,0 +1,439 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "userver.h"
+#include "uservice.h"
+#include "mpose.h"
+#include "medge.h"
+#include "simu.h"
+#include "cmotor.h"
+#include "cmixer.h"
+#include "uconfig.h"
+#include "ureactor.h"
+
+// create value
+UServer server;
+
+static const char * topicNames[UServer::T_COUNT] = {"pose", "edge", "imu", "motor", "mixer"};
+
+
+void UServer::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("server"))
+  { // no data yet, so generate some default values
+    ini["server"]["enabled"] = "true";
+    ini["server"]["port"] = "24001";
+    ini["server"]["localOnly"] = "true"; // accept from this host only
+    ini["server"]["unix"] = ""; // unix socket path, e.g. /tmp/raubase.sock
+    ini["server"]["maxClients"] = "5";
+    ini["server"]["allowDrive"] = "false"; // accept vel, turnrate, edge commands (opt-in)
+    ini["server"]["log"] = "true";
+    ini["server"]["print"] = "false";
+  }
+  if (ini["server"]["enabled"] != "true")
+    return;
+  maxClients = strtol(ini["server"]["maxClients"].c_str(), nullptr, 10);
+  allowDrive = ini["server"]["allowDrive"] == "true";
+  toConsole = ini["server"]["print"] == "true";
+  int port = strtol(ini["server"]["port"].c_str(), nullptr, 10);
+  tcpFd = openTcp(port, ini["server"]["localOnly"] == "true");
+  unixPath = ini["server"]["unix"];
+  if (not unixPath.empty())
+    unixFd = openUnix(unixPath.c_str());
+  if (ini["server"]["log"] == "true")
+  {
+    std::string fn = service.logPath + "log_server.txt";
+    logfile = fopen(fn.c_str(), "w");
+    fprintf(logfile, "%% Telemetry and command server (port %d, unix '%s')\n", port, unixPath.c_str());
+    fprintf(logfile, "%% 1 \tTime (sec)\n");
+    fprintf(logfile, "%% 2 \tClient (file descriptor)\n");
+    fprintf(logfile, "%% 3 \tEvent or command\n");
+  }
+  // accept, receive and topic send are handled by the reactor thread
+  if (tcpFd >= 0)
+    reactor.add(tcpFd, [this](uint32_t){ acceptClient(tcpFd); });
+  if (unixFd >= 0)
+    reactor.add(unixFd, [this](uint32_t){ acceptClient(unixFd); });
+  // started when a client is connected
+  topicTimer = reactor.addTimer([this](){ sendAll(); });
+}
+
+void UServer::terminate()
+{
+  reactor.removeTimer(topicTimer);
+  topicTimer = -1;
+  while (not clients.empty())
+    dropClient(clients.back().fd);
+  if (tcpFd >= 0)
+  {
+    reactor.remove(tcpFd);
+    close(tcpFd);
+  }
+  if (unixFd >= 0)
+  {
+    reactor.remove(unixFd);
+    close(unixFd);
+    unlink(unixPath.c_str());
+  }
+  tcpFd = -1;
+  unixFd = -1;
+  if (logfile != nullptr)
+  {
+    fclose(logfile);
+    logfile = nullptr;
+  }
+}
+
+int UServer::openTcp(int port, bool localOnly)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    perror("# UServer::openTcp: socket");
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(localOnly ? INADDR_LOOPBACK : INADDR_ANY);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 or listen(fd, 5) < 0)
+  {
+    printf("# UServer::openTcp: failed to listen on port %d: %s\n", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  printf("# UServer:: listening on port %d\n", port);
+  return fd;
+}
+
+int UServer::openUnix(const char * path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    perror("# UServer::openUnix: socket");
+    return -1;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  // remove old socket file (if any)
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 or listen(fd, 5) < 0)
+  {
+    printf("# UServer::openUnix: failed to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  printf("# UServer:: listening on %s\n", path);
+  return fd;
+}
+
+void UServer::onClient(int fd)
+{
+  for (auto & c : clients)
+  {
+    if (c.fd == fd)
+    {
+      if (not receive(c))
+        // gone or quit
+        dropClient(fd);
+      break;
+    }
+  }
+}
+
+void UServer::dropClient(int fd)
+{
+  reactor.remove(fd);
+  close(fd);
+  for (int i = clients.size() - 1; i >= 0; i--)
+  {
+    if (clients[i].fd == fd)
+      clients.erase(clients.begin() + i);
+  }
+  clientCnt = clients.size();
+  if (clientCnt == 0)
+    // no topics to send
+    reactor.setTimer(topicTimer, 0);
+}
+
+void UServer::sendAll()
+{
+  UTime now("now");
+  for (auto & c : clients)
+  {
+    flush(c);
+    sendTopics(c, now);
+  }
+}
+
+void UServer::acceptClient(int listenFd)
+{
+  int fd = accept(listenFd, nullptr, nullptr);
+  if (fd < 0)
+    return;
+  if ((int)clients.size() >= maxClients)
+  {
+    const char * msg = "# too many clients\n";
+    send(fd, msg, strlen(msg), MSG_NOSIGNAL);
+    close(fd);
+    return;
+  }
+  // the server must never wait for a slow client
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  Client c;
+  c.fd = fd;
+  clients.push_back(c);
+  clientCnt = clients.size();
+  reactor.add(fd, [this, fd](uint32_t){ onClient(fd); });
+  if (clientCnt == 1)
+    // often enough for the highest topic rate (100Hz)
+    reactor.setTimer(topicTimer, 0.01, 0.01);
+  sendLine(clients.back(), "# raubase telemetry server (send 'help')");
+  const int MSL = 50;
+  char s[MSL];
+  snprintf(s, MSL, "%d connected", fd);
+  toLog(s);
+}
+
+bool UServer::receive(Client & c)
+{
+  const int MRB = 1024;
+  char buf[MRB];
+  int n = recv(c.fd, buf, MRB, 0);
+  if (n == 0 or (n < 0 and errno != EAGAIN))
+  {
+    const int MSL = 50;
+    char s[MSL];
+    snprintf(s, MSL, "%d disconnected", c.fd);
+    toLog(s);
+    return false;
+  }
+  for (int i = 0; i < n; i++)
+  {
+    if (buf[i] == '\n')
+    {
+      handleCommand(c, c.rx.c_str());
+      c.rx.clear();
+      if (c.quit)
+        return false;
+    }
+    else if (buf[i] >= ' ' or buf[i] == '\t')
+    {
+      if (c.rx.size() < 500)
+        c.rx += buf[i];
+    }
+  }
+  return true;
+}
+
+void UServer::handleCommand(Client & c, const char * line)
+{
+  const int MSL = 200;
+  char s[MSL];
+  char cmd[MSL] = "";
+  char arg[MSL] = "";
+  float v1 = 0;
+  // e.g. 'sub pose 10', 'vel 0.2' or 'edge left 0.01'
+  int n = sscanf(line, "%199s %199s %f", cmd, arg, &v1);
+  if (n <= 0)
+    return;
+  snprintf(s, MSL, "%d %s", c.fd, line);
+  toLog(s);
+  bool isOK = true;
+  bool drive = strcmp(cmd, "vel") == 0 or strcmp(cmd, "turnrate") == 0 or
+               strcmp(cmd, "edge") == 0 or strcmp(cmd, "stop") == 0;
+  if (drive and not allowDrive)
+  {
+    sendLine(c, "# drive commands are not allowed (server.allowDrive)");
+    return;
+  }
+  if (strcmp(cmd, "sub") == 0 or strcmp(cmd, "unsub") == 0)
+  { // subscribe: sub topic rate
+    float rate = 0;
+    if (cmd[0] == 's')
+      rate = fminf(v1, 100);
+    bool found = false;
+    for (int i = 0; i < T_COUNT; i++)
+    {
+      if (strcmp(arg, topicNames[i]) == 0 or strcmp(arg, "all") == 0)
+      {
+        c.interval[i] = rate > 0 ? 1.0 / rate : 0;
+        found = true;
+      }
+    }
+    isOK = found;
+  }
+  else if (strcmp(cmd, "vel") == 0)
+    mixer.setVelocity(strtof(arg, nullptr));
+  else if (strcmp(cmd, "turnrate") == 0)
+    mixer.setTurnrate(strtof(arg, nullptr));
+  else if (strcmp(cmd, "edge") == 0)
+  { // edge left|right offset
+    isOK = strcmp(arg, "left") == 0 or strcmp(arg, "right") == 0;
+    if (isOK)
+      mixer.setEdgeMode(arg[0] == 'l', v1);
+  }
+  else if (strcmp(cmd, "stop") == 0)
+  {
+    mixer.setVelocity(0);
+    mixer.setTurnrate(0);
+  }
+  else if (strcmp(cmd, "reload") == 0)
+    isOK = config.reload();
+  else if (strcmp(cmd, "quit") == 0)
+  { // closed after this line
+    c.quit = true;
+    return;
+  }
+  else if (strcmp(cmd, "help") == 0)
+  {
+    sendLine(c, "# raubase telemetry server commands:");
+    sendLine(c, "#   sub topic rate  Subscribe to topic at rate (Hz, max 100)");
+    sendLine(c, "#                   topics: pose, edge, imu, motor, mixer (or all)");
+    sendLine(c, "#   unsub topic     Stop subscription");
+    sendLine(c, "#   vel v           Set linear velocity (m/s)");
+    sendLine(c, "#   turnrate r      Set turnrate (rad/s)");
+    sendLine(c, "#   edge left|right offset  Follow line edge");
+    sendLine(c, "#   stop            Set velocity and turnrate to zero");
+    sendLine(c, "#   reload          Apply changed values in the ini-file");
+    sendLine(c, "#   quit            Close connection");
+    sendLine(c, "# topic formats:");
+    sendLine(c, "#   pose  time x y h dist turned vel turnrate");
+    sendLine(c, "#   edge  time valid left right width trackValid trackCenter trackWidth crossing");
+    sendLine(c, "#   imu   time gx gy gz ax ay az");
+    sendLine(c, "#   motor time refLeft refRight velLeft velRight uLeft uRight limited");
+    sendLine(c, "#   mixer time autonomous headingMode desiredHeading");
+    return;
+  }
+  else
+    isOK = false;
+  snprintf(s, MSL, "%s %s", isOK ? "ok" : "# failed", line);
+  sendLine(c, s);
+}
+
+void UServer::sendTopics(Client & c, UTime & now)
+{
+  const int MSL = 300;
+  char s[MSL];
+  for (int i = 0; i < T_COUNT; i++)
+  {
+    if (c.interval[i] > 0 and now - c.lastSend[i] >= c.interval[i])
+    {
+      topicLine(i, s, MSL);
+      sendLine(c, s);
+      // keep the rate, but do not catch up after a stall
+      c.lastSend[i] += c.interval[i];
+      if (now - c.lastSend[i] > c.interval[i])
+        c.lastSend[i] = now;
+    }
+  }
+}
+
+void UServer::topicLine(int topic, char * s, int sCnt)
+{
+  UTime t("now");
+  int n = snprintf(s, sCnt, "%s %lu.%04ld", topicNames[topic], t.getSec(), t.getMicrosec()/100);
+  s += n;
+  sCnt -= n;
+  switch (topic)
+  {
+    case T_POSE:
+      snprintf(s, sCnt, " %.3f %.3f %.4f %.3f %.4f %.3f %.4f",
+               pose.x, pose.y, pose.h, pose.dist, pose.turned, pose.robVel, pose.turnrate);
+      break;
+    case T_EDGE:
+      snprintf(s, sCnt, " %d %.4f %.4f %.4f %d %.4f %.4f %d",
+               medge.edgeValid, medge.leftEdge, medge.rightEdge, medge.width,
+               medge.trackValid, medge.trackCenter, medge.trackWidth, medge.crossing);
+      break;
+    case T_IMU:
+      snprintf(s, sCnt, " %.3f %.3f %.3f %.3f %.3f %.3f",
+               imu.gyro[0], imu.gyro[1], imu.gyro[2], imu.acc[0], imu.acc[1], imu.acc[2]);
+      break;
+    case T_MOTOR:
+    {
+      float * ref = mixer.getWheelVelocityArray();
+      snprintf(s, sCnt, " %.3f %.3f %.3f %.3f %.2f %.2f %d",
+               ref[0], ref[1], pose.wheelVel[0], pose.wheelVel[1],
+               motor.getMotorVoltage(0), motor.getMotorVoltage(1), motor.limited);
+      break;
+    }
+    case T_MIXER:
+      snprintf(s, sCnt, " %d %d %.4f",
+               mixer.autonomous(), mixer.headingMode, mixer.desiredHeading);
+      break;
+    default:
+      break;
+  }
+}
+
+void UServer::sendLine(Client & c, const char * line)
+{
+  if (c.fd < 0)
+    return;
+  if (c.tx.size() > 65000)
+  { // client is not reading fast enough
+    c.dropCnt++;
+    return;
+  }
+  c.tx += line;
+  c.tx += '\n';
+  flush(c);
+}
+
+void UServer::flush(Client & c)
+{
+  if (c.fd < 0 or c.tx.empty())
+    return;
+  int n = send(c.fd, c.tx.c_str(), c.tx.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (n > 0)
+    c.tx.erase(0, n);
+}
+
+void UServer::toLog(const char * msg)
+{
+  if (service.stop)
+    return;
+  UTime t("now");
+  if (logfile != nullptr)
+    fprintf(logfile, "%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, msg);
+  if (toConsole)
+    printf("%lu.%04ld %s\n", t.getSec(), t.getMicrosec()/100, msg);
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include "utime.h"
+
+using namespace std;
+
+/**
+ * Telemetry and command server (TCP and optionally a unix socket).
+ * A client (dashboard, test script, etc.) can subscribe to topics
+ * at a rate, and get one text line per sample, e.g.
+ *   sub pose 10
+ * gives 10 lines per second, like
+ *   pose 1700000000.1234 x y h dist turned vel turnrate
+ * Commands can set velocity, turnrate and edge mode,
+ * send 'help' for the list.
+ * NB! 'stop' stops the robot, not raubase. */
+class UServer
+{
+public:
+  /** setup and start listening (if enabled) */
+  void setup();
+  /**
+   * terminate */
+  void terminate();
+  /// topics that can be subscribed
+  enum Topic {T_POSE, T_EDGE, T_IMU, T_MOTOR, T_MIXER, T_COUNT};
+  /// number of connected clients
+  int clientCnt = 0;
+
+private:
+  /**
+   * A connected client */
+  struct Client
+  {
+    int fd = -1;
+    /// partial received line
+    std::string rx;
+    /// subscription interval (sec), 0 = not subscribed
+    float interval[T_COUNT] = {0};
+    UTime lastSend[T_COUNT];
+    /// not send yet (client socket buffer full)
+    std::string tx;
+    /// lines not send, as client did not read fast enough
+    int dropCnt = 0;
+    /// client send 'quit'
+    bool quit = false;
+  };
+  /** data from a client (called by the reactor) */
+  void onClient(int fd);
+  /** remove from reactor, close and delete a client */
+  void dropClient(int fd);
+  /** flush and send due topics to all clients (reactor timer) */
+  void sendAll();
+  /** open a listening socket
+   * \returns file descriptor or -1 */
+  int openTcp(int port, bool localOnly);
+  int openUnix(const char * path);
+  /** accept a new client from this listen socket */
+  void acceptClient(int listenFd);
+  /**
+   * read from client and handle complete lines
+   * \returns false if the client is gone */
+  bool receive(Client & c);
+  /** handle a command line from a client */
+  void handleCommand(Client & c, const char * line);
+  /** send topics that are due */
+  void sendTopics(Client & c, UTime & now);
+  /** format a topic line */
+  void topicLine(int topic, char * s, int sCnt);
+  /** send a line to a client (dropped if the client is too slow) */
+  void sendLine(Client & c, const char * line);
+  /** send as much as possible of the pending data */
+  void flush(Client & c);
+  /** write to server log */
+  void toLog(const char * msg);
+  //
+  /// reactor timer for topic send, running while there are clients
+  int topicTimer = -1;
+  int tcpFd = -1;
+  int unixFd = -1;
+  std::string unixPath;
+  std::vector<Client> clients;
+  int maxClients = 5;
+  /// allow commands that move the robot
+  bool allowDrive = false;
+  FILE * logfile = nullptr;
+  bool toConsole = false;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UServer server;
@@ -24,6 +24,9 @@
 
 #include <stdio.h>
 #include <signal.h>
+#include <unistd.h>
+#include <thread>
+#include <sys/signalfd.h>
 #include "CLI/CLI.hpp"
 #include <filesystem>
 
@@ -36,6 +39,13 @@
 #include "medge.h"
 #include "mpose.h"
 #include "maruco.h"
+#include "mball.h"
+#include "mhistline.h"
+#include "ushmframes.h"
+#include "userver.h"
+#include "uconfig.h"
+#include "ustartup.h"
+#include "ureactor.h"
 #include "scam.h"
 #include "sdist.h"
 #include "sedge.h"
@@ -44,6 +54,7 @@
 #include "simu.h"
 #include "sjoylogitech.h"
 #include "spyvision.h"
+#include "ssim.h"
 #include "sstate.h"
 #include "steensy.h"
 #include "uservice.h"
@@ -62,13 +73,16 @@ void signal_callback_handler(int signum)
 }
 
 bool UService::setup(int argc,char **argv)
-{ // Interrupt signal handler for most common signals
-  signal(SIGINT, signal_callback_handler); // 2 normal ctrl-C
-//   signal(SIGKILL, signal_callback_handler); // 9
-  signal(SIGQUIT, signal_callback_handler); // 3
-  signal(SIGHUP, signal_callback_handler); // 1
-  signal(SIGPWR, signal_callback_handler); // 30
-  signal(SIGTERM, signal_callback_handler); // 15 (pkill default)
+{ // Interrupt signals for most common signals are received
+  // by the reactor (signalfd), so they are blocked in all threads.
+  // This must be done before any thread is started.
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT); // 2 normal ctrl-C
+  sigaddset(&stopSignals, SIGQUIT); // 3
+  sigaddset(&stopSignals, SIGHUP); // 1
+  sigaddset(&stopSignals, SIGPWR); // 30
+  sigaddset(&stopSignals, SIGTERM); // 15 (pkill default)
+  pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
   //
   bool teensyConnect = true;
   CLI::App cli{"ROBOBOT app"};
@@ -105,6 +119,15 @@ bool UService::setup(int argc,char **argv)
   // print 4x4_100 ArUco code
   int arucoID = -1;
   cli.add_option("-a,--aruco", arucoID, "Save an image with an ArUco number [0..249]");
+  // measure vision timing
+  std::string bench;
+  cli.add_option("-B,--bench", bench, "Measure vision timing on the images in camera image path [aruco, ball, histline]");
+  // list configuration parameters
+  bool params{false};
+  cli.add_flag("-P,--params", params, "List configuration parameters with value, range and description");
+  // simulation
+  bool simulate{false};
+  cli.add_flag("-S,--sim", simulate, "Simulate the robot (no Teensy or GPIO), see [sim] in ini-file");
   // Parse for command line options
   cli.allow_windows_style_options();
   theEnd = true;
@@ -150,7 +173,8 @@ bool UService::setup(int argc,char **argv)
     ini["service"]["logpath"] = "log_%d/";
     ini["service"]["; The '%d' will be replaced with date and timestamp (Must end with a '/')."] = "";
   }
-  teensyConnect = not (camImg or camCal or ini["service"]["use_robot_hardware"] == "false");
+  bool toolOnly = camImg or camCal or not bench.empty() or params;
+  teensyConnect = not (toolOnly or ini["service"]["use_robot_hardware"] == "false");
   //
   if (arucoID >= 0)
   { // just save an image with an ArUco code
@@ -177,44 +201,77 @@ bool UService::setup(int argc,char **argv)
     { // failed (probably: path exist already)
       std::perror("#*** UService:: Failed to create log path:");
     }
+    // modules are set up in parallel, when they do not depend on each other
+    if (not ini["service"].has("parallelStartup"))
+      ini["service"]["parallelStartup"] = "true";
+    // device and socket events are handled by one thread
+    reactor.setup();
+    signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    reactor.add(signalFd, [this](uint32_t)
+    {
+      struct signalfd_siginfo si;
+      if (read(signalFd, &si, sizeof(si)) == sizeof(si))
+        shutdown(si.ssi_signo);
+    });
+    // a simulated robot replaces the Teensy
+    sim.setup(simulate);
+    if (sim.enabled and not toolOnly)
+      teensyConnect = true;
+    UStartup startup;
     if (teensyConnect)
     { // open the main data source
-      printf("# UService::setup: open to Teensy\n");
-      teensy1.setup();
-      state.setup();
-      //
-      // wait for base setup to finish
-      if (teensy1.teensyConnectionOpen)
-      { // wait for initial setup
-        usleep(10000);
-        while (teensy1.getTeensyCommQueueSize() > 0 and t.getTimePassed() < 5.0)
+      startup.add("teensy", [this, &t]()
+      {
+        printf("# UService::setup: open to Teensy\n");
+        teensy1.setup();
+        state.setup();
+        // wait for base setup to finish
+        if (teensy1.teensyConnectionOpen)
+        { // wait for initial setup
           usleep(10000);
-        if (t.getTimePassed() >= 5.0)
-          printf("# UService::setup - waited %g sec for initial Teensy setup\n", t.getTimePassed());
-      }
+          while (teensy1.getTeensyCommQueueSize() > 0 and t.getTimePassed() < 5.0)
+            usleep(10000);
+          if (t.getTimePassed() >= 5.0)
+            printf("# UService::setup - waited %g sec for initial Teensy setup\n", t.getTimePassed());
+        }
+      }, {}, {"teensy", "state", "id"});
       // setup and initialize all modules
-      encoder.setup();
-      pose.setup();
-      sedge.setup();
-      servo.setup();
-      imu.setup();
-      motor.setup();
-      gpio.setup();
+      startup.add("encoder", [](){ encoder.setup(); }, {"teensy"}, {"encoder"});
+      startup.add("pose", [](){ pose.setup(); }, {"teensy"}, {"pose"});
+      startup.add("sedge", [](){ sedge.setup(); }, {"teensy"}, {"edge"});
+      startup.add("servo", [](){ servo.setup(); }, {"teensy"}, {"servo"});
+      startup.add("imu", [](){ imu.setup(); }, {"teensy"}, {"imu"});
+      startup.add("motor", [](){ motor.setup(); }, {"encoder"}, {"motor"});
+      startup.add("dist", [](){ dist.setup(); }, {"teensy"}, {"dist"});
+      if (not sim.enabled)
+        startup.add("gpio", [](){ gpio.setup(); }, {}, {"gpio"});
     }
     else
       printf("# UService::setup: Ignoring robot hardware (Regbot and GPIO)\n");
     //
     // setup of all that do not directly interact with the robot
-    medge.setup();
-    cedge.setup();
-    mixer.setup();
-    heading.setup();
-    pyvision.setup();
-    dist.setup();
-    joyLogi.setup();
-    cam.setup();
-    aruco.setup();
+    startup.add("medge", [](){ medge.setup(); }, {"sedge"}, {"edge"});
+    startup.add("cedge", [](){ cedge.setup(); }, {"medge"});
+    startup.add("heading", [](){ heading.setup(); }, {"encoder"}, {"heading"});
+    startup.add("mixer", [](){ mixer.setup(); }, {"pose", "heading"}, {"mixer"});
+    startup.add("pyvision", [](){ pyvision.setup(); }, {}, {"pyvision"});
+    startup.add("joystick", [](){ joyLogi.setup(); }, {"mixer"}, {"Joy_Logitech"});
+    startup.add("camera", [](){ cam.setup(); }, {}, {"camera"});
+    startup.add("aruco", [](){ aruco.setup(); }, {"camera"}, {"aruco"});
+    startup.add("ball", [](){ ball.setup(); }, {"camera"}, {"ball"});
+    startup.add("histline", [](){ histline.setup(); }, {"camera"}, {"histline"});
+    startup.add("shm", [](){ shmFrames.setup(); }, {"camera", "pyvision"}, {"shm"});
+    startup.add("server", [](){ server.setup(); }, {"mixer", "cedge"}, {"server"});
+    bool setupOK = startup.run(ini["service"]["parallelStartup"] == "true");
+    startup.toLog(logPath + "log_startup.txt");
+    // watch ini-file, when all parameters are known
+    config.setup();
     setupComplete = true;
+    if (not setupOK)
+    { // do not run with a module missing
+      printf("#*** UService:: setup failed (see above), terminating\n");
+      theEnd = true;
+    }
     usleep(2000);
     //
   }
@@ -225,6 +282,16 @@ bool UService::setup(int argc,char **argv)
       cam.saveImage();
     else if (camCal)
       cam.calibrate();
+    else if (bench == "aruco")
+      aruco.bench();
+    else if (bench == "ball")
+      ball.bench();
+    else if (bench == "histline")
+      histline.bench();
+    else if (not bench.empty())
+      printf("# UService:: unknown bench '%s'\n", bench.c_str());
+    else if (params)
+      config.print(stdout);
     else
       theEnd = false;
   }
@@ -259,8 +326,13 @@ bool UService::setup(int argc,char **argv)
   }
   if (not theEnd)
   { // start listen to the keyboard
-    th1 = new std::thread(runObj, this);
-    th2 = new std::thread(runObj2, this);
+    gotKeyInput = false;
+    if (not asDaemon and not reactor.add(STDIN_FILENO, [this](uint32_t){ onKeyboard(); }))
+      printf("# UService:: keyboard (stdin) is not available\n");
+    listenToKeyboard = not asDaemon;
+    if (stopNowRequest)
+      // stop switch during setup
+      shutdown(-1);
   }
   // wait for optional tasks that require system to run.
   if ((calibBlack or
@@ -308,6 +380,21 @@ void UService::stopNow(const char * who)
 { // request a terminate and exit
   printf("# UService:: %s say stop now\n", who);
   stopNowRequest = true;
+  shutdown(-1);
+}
+
+void UService::shutdown(int signum)
+{
+  if (not setupComplete)
+  { // nothing to terminate yet (a stop request is handled at the end of setup)
+    if (signum > 0)
+      signal_callback_handler(signum);
+    return;
+  }
+  if (exitStarted.exchange(true))
+    return;
+  // terminate stops the reactor, so it can not be done by the reactor thread
+  std::thread(signal_callback_handler, signum).detach();
 }
 
 
@@ -321,6 +408,12 @@ void UService::terminate()
   stop = true; // stop all threads, when finished current activity
   //
   usleep(100000);
+  // no more remote commands or reload
+  if (listenToKeyboard)
+    reactor.remove(STDIN_FILENO);
+  listenToKeyboard = false;
+  server.terminate();
+  config.terminate();
   joyLogi.terminate();
   encoder.terminate();
   pose.terminate();
@@ -337,9 +430,17 @@ void UService::terminate()
   dist.terminate();
   // terminate sensors before Teensy
   teensy1.terminate();
+  sim.terminate();
+  // uses camera and python vision
+  shmFrames.terminate();
   pyvision.terminate();
   cam.terminate();
   aruco.terminate();
+  ball.terminate();
+  histline.terminate();
+  // all fds should be removed by now
+  reactor.remove(signalFd);
+  reactor.terminate();
   // service must be the last to close
   if (not ini.has("ini"))
   {
@@ -365,31 +466,34 @@ std::string UService::getVersionString()
   return part;
 }
 
-void UService::run()
-{
-  gotKeyInput = false;
-  while (not stop)
-  {
-    if (not asDaemon)
-    {
-      cin >> keyString;
-      if (keyString == "stop")
-        signal_callback_handler(-1);
-      else
-        gotKeyInput = true;
-    }
+void UService::onKeyboard()
+{ // keyboard input (called by the reactor), split into words
+  const int MRB = 200;
+  char buf[MRB];
+  int n = read(STDIN_FILENO, buf, MRB);
+  if (n <= 0)
+  { // end of input (or error) - no more keyboard
+    reactor.remove(STDIN_FILENO);
+    listenToKeyboard = false;
+    return;
   }
-}
-
-void UService::run2()
-{
-  while (not stop)
-  { // e.g. using the stop switch
-    if (stopNowRequest)
+  for (int i = 0; i < n; i++)
+  {
+    if (not isspace(buf[i]))
     {
-      signal_callback_handler(-1);
+      keyWord += buf[i];
+      continue;
     }
-    usleep(50000);
+    if (keyWord.empty())
+      continue;
+    keyString = keyWord;
+    keyWord.clear();
+    if (keyString == "stop")
+      shutdown(-1);
+    else if (keyString == "reload")
+      config.reload();
+    else
+      gotKeyInput = true;
   }
 }
 
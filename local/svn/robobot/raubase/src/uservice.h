@@ -24,7 +24,8 @@
 #pragma once
 
 #include <string>
-#include <thread>
+#include <atomic>
+#include <signal.h>
 #include "utime.h"
 #include "uini.h"
 
@@ -48,13 +49,17 @@ public:
      * \param who is a string to identify from where the stop order came
      * */
     void stopNow(const char * who);
+    /**
+     * Terminate and exit (in a thread of its own),
+     * used for signals, the stop switch and the 'stop' key command.
+     * \param signum is the signal number (exit value), -1 if not a signal */
+    void shutdown(int signum);
     /**
      * shut down and save ini-file - but do not exit */
     void terminate();
     /**
-    * thread to listen to keyboard */
-    void run();
-    void run2(); // and terminate request
+    * Keyboard input is ready (called by the reactor) */
+    void onKeyboard();
     /**
      * Got keyboard input - e.g. enter */
     bool gotKey();
@@ -78,18 +83,15 @@ public:
     bool asDaemon = false;
 
 private:
-    static void runObj(UService * obj)
-    { // called, when thread is started
-        // transfer to the class run() function.
-        obj->run();
-    }
-    std::thread * th1;
-    static void runObj2(UService * obj)
-    { // called, when thread is started
-        // transfer to the class run() function.
-        obj->run2();
-    }
-    std::thread * th2;
+    /// signals (ctrl-C etc.) are received as events through this fd
+    sigset_t stopSignals;
+    int signalFd = -1;
+    /// stdin is in the reactor
+    bool listenToKeyboard = false;
+    /// word being typed
+    std::string keyWord;
+    /// terminate thread is started
+    std::atomic<bool> exitStarted = false;
     //
     bool terminating = false;
     bool setupComplete = false;
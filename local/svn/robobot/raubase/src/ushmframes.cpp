@@ -0,0 +1,174 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ushmframes.h"
+#include "uservice.h"
+#include "scam.h"
+#include "spyvision.h"
+
+// create value
+UShmFrames shmFrames;
+
+// layout is shared with socket-base-py/shmframes.py
+static_assert(sizeof(UShmFrames::Header) == 32);
+static_assert(sizeof(UShmFrames::Slot) == 64);
+
+
+void UShmFrames::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("shm"))
+  { // no data yet, so generate some default values
+    ini["shm"]["enabled"] = "false"; // publish camera frames in shared memory
+    ini["shm"]["name"] = "/raubase_frames"; // in /dev/shm
+    ini["shm"]["slots"] = "3";
+    ini["shm"]["maxBytes"] = "2764800"; // per frame (1280x720x3)
+    ini["shm"]["notify"] = "true"; // send 'frame seq slot' to python vision
+  }
+  if (ini["shm"]["enabled"] != "true" or not cam.isOpen())
+    return;
+  name = ini["shm"]["name"];
+  notify = ini["shm"]["notify"] == "true";
+  int n = strtol(ini["shm"]["slots"].c_str(), nullptr, 10);
+  if (n < 2)
+    n = 2;
+  uint32_t slotBytes = strtol(ini["shm"]["maxBytes"].c_str(), nullptr, 10);
+  // data starts at a page boundary
+  uint32_t dataOffset = ((sizeof(Header) + n * sizeof(Slot)) / 4096 + 1) * 4096;
+  shmSize = dataOffset + size_t(n) * slotBytes;
+  fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0666);
+  if (fd < 0 or ftruncate(fd, shmSize) < 0)
+  {
+    perror("# UShmFrames::setup: failed to create shared memory");
+    return;
+  }
+  void * p = mmap(nullptr, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+  {
+    perror("# UShmFrames::setup: failed to map shared memory");
+    close(fd);
+    fd = -1;
+    return;
+  }
+  shm = (uint8_t*)p;
+  header = (Header*)shm;
+  slots = (Slot*)(shm + sizeof(Header));
+  memset(shm, 0, dataOffset);
+  header->version = 1;
+  header->slots = n;
+  header->dataOffset = dataOffset;
+  header->slotBytes = slotBytes;
+  header->newest = 0;
+  // valid from now
+  __atomic_store_n(&header->magic, 0x52464252, __ATOMIC_RELEASE); // 'RBFR'
+  printf("# UShmFrames:: publishing frames in /dev/shm%s (%d slots of %u bytes)\n",
+         name.c_str(), n, slotBytes);
+  cam.subscribe();
+  th1 = new std::thread(runObj, this);
+}
+
+void UShmFrames::terminate()
+{
+  if (th1 != nullptr)
+  {
+    th1->join();
+    th1 = nullptr;
+    cam.unsubscribe();
+  }
+  if (shm != nullptr)
+  {
+    munmap(shm, shmSize);
+    shm = nullptr;
+    shm_unlink(name.c_str());
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void UShmFrames::run()
+{
+  int seq = 0;
+  while (not service.stop)
+  {
+    UCamFrame f;
+    // every frame, also when publish is slower than the camera
+    if (cam.waitForNext(f, seq, 0.5, true))
+    {
+      seq = f.seq;
+      if (publish(f.img, f.time) and notify and pyvision.isConnected())
+      {
+        const int MSL = 50;
+        char s[MSL];
+        snprintf(s, MSL, "frame %lu %u\n", (unsigned long)header->seq, header->newest);
+        // not logged, this is at camera frame rate
+        pyvision.sendCommand(s, false);
+      }
+    }
+  }
+}
+
+bool UShmFrames::publish(const cv::Mat & img, UTime & t)
+{
+  size_t bytes = img.total() * img.elemSize();
+  if (bytes > header->slotBytes)
+  {
+    if (not tooBigReported)
+      printf("# UShmFrames::publish: frame of %lu bytes is too big (shm.maxBytes=%u)\n",
+             (unsigned long)bytes, header->slotBytes);
+    tooBigReported = true;
+    return false;
+  }
+  uint32_t i = (header->newest + 1) % header->slots;
+  Slot & s = slots[i];
+  uint8_t * data = shm + header->dataOffset + size_t(i) * header->slotBytes;
+  // odd while writing
+  __atomic_store_n(&s.lock, s.lock + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  s.seq = published + 1;
+  s.sec = t.getSec();
+  s.usec = t.getMicrosec();
+  s.format = img.channels() == 1 ? 0x59415247 : 0x33524742; // 'GRAY' or 'BGR3'
+  s.width = img.cols;
+  s.height = img.rows;
+  s.stride = img.cols * img.elemSize();
+  s.bytes = bytes;
+  if (img.isContinuous())
+    memcpy(data, img.data, bytes);
+  else
+  {
+    for (int r = 0; r < img.rows; r++)
+      memcpy(data + r * s.stride, img.ptr(r), s.stride);
+  }
+  // even when done
+  __atomic_store_n(&s.lock, s.lock + 1, __ATOMIC_RELEASE);
+  published++;
+  header->newest = i;
+  __atomic_store_n(&header->seq, published, __ATOMIC_RELEASE);
+  return true;
+}
@@ -0,0 +1,108 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <thread>
+#include <stdint.h>
+#include <opencv2/core.hpp>
+#include "utime.h"
+
+using namespace std;
+
+/**
+ * Publish camera frames in a POSIX shared memory ring,
+ * so that other processes (e.g. the python vision server)
+ * can use the camera images without a copy.
+ * Layout (little endian):
+ *   header (32 bytes): magic 'RBFR', version, slots, dataOffset,
+ *                      slotBytes, newest slot, newest sequence (uint64)
+ *   slot headers (64 bytes each): lock (uint64, odd while writing),
+ *                      sequence (uint64), time sec (uint64), usec, format
+ *                      (fourcc 'BGR3' or 'GRAY'), width, height, stride, bytes
+ *   slot data at dataOffset + slot * slotBytes.
+ * A reader should read lock before and after the data, and
+ * use the data only if both are equal and even (seqlock).
+ * */
+class UShmFrames
+{
+public:
+  /** setup and start publishing (if enabled) */
+  void setup();
+  /**
+   * terminate and remove the shared memory */
+  void terminate();
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t dataOffset;
+    uint32_t slotBytes;
+    uint32_t newest;
+    uint64_t seq;
+  };
+  struct Slot
+  {
+    uint64_t lock;
+    uint64_t seq;
+    uint64_t sec;
+    uint32_t usec;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t bytes;
+    uint8_t reserved[16];
+  };
+  /// number of frames published
+  int published = 0;
+
+private:
+  /**
+   * Copy this frame to the next slot
+   * \returns false if the frame is too big */
+  bool publish(const cv::Mat & img, UTime & t);
+  /**
+   * thread - publish all camera frames */
+  void run();
+  static void runObj(UShmFrames * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  std::thread * th1 = nullptr;
+  std::string name;
+  int fd = -1;
+  uint8_t * shm = nullptr;
+  size_t shmSize = 0;
+  Header * header = nullptr;
+  Slot * slots = nullptr;
+  /// tell python vision server about new frames
+  bool notify = true;
+  bool tooBigReported = false;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UShmFrames shmFrames;
@@ -24,14 +24,16 @@
 
 #include <string>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include "usocket.h"
+#include "ureactor.h"
 #include <stdio.h>
 
 
 USocket::USocket(const char * host, const char * port)
 { // set parameters
-//   std::string portStr = std::to_string(port);
   // create client to vision server in python
   int res;
   if ((res = getaddrinfo(host, port, nullptr, &servinfo)) != 0)
@@ -45,27 +47,41 @@ USocket::USocket(const char * host, const char * port)
       fprintf(stderr,"# Failed socket creation to %s:%s\n", host, port);
     }
     // try to connect
-    if (connect(sockfd, servinfo->ai_addr, servinfo->ai_addrlen) == -1)
+    else if (connect(sockfd, servinfo->ai_addr, servinfo->ai_addrlen) == -1)
     { // failed
-  //     std::perror("# USocket:: connect failed");
       connected = false;
       close(sockfd);
-      th1 = nullptr;
+      sockfd = -1;
     }
     else
     { // connection established
+      // reads are non-blocking, the reactor thread waits in epoll
+      fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
       connected = true;
-      // start read thread
-      th1 = new std::thread(runObj, this);
+      reactor.add(sockfd, [this](uint32_t events){ onReadable(events); }, EPOLLIN | EPOLLRDHUP);
     }
   }
 }
 
 void USocket::terminate()
-{ // wait for receive thread to finish
+{ // no more receive events
   stop = true;
-  if (th1 != nullptr)
-    th1->join();
+  if (sockfd >= 0)
+    reactor.remove(sockfd);
+  closeSocket();
+  // release anybody waiting
+  lineReady.notify_all();
+}
+
+void USocket::closeSocket()
+{
+  std::lock_guard<std::mutex> lock(txLock);
+  if (sockfd >= 0)
+  {
+    connected = false;
+    close(sockfd);
+    sockfd = -1;
+  }
 }
 
 bool USocket::sendCommand(std::string command)
@@ -75,9 +91,24 @@ bool USocket::sendCommand(std::string command)
   {
     if (not command.ends_with('\n'))
       command += '\n';
+    std::lock_guard<std::mutex> lock(txLock);
+    const char * p = command.c_str();
     int n = command.size();
-    int m = send(sockfd, command.c_str(), n, 0);
-    if (n == m)
+    while (n > 0)
+    { // the socket is non-blocking, so
+      // a long command may be send in parts
+      int m = send(sockfd, p, n, MSG_NOSIGNAL);
+      if (m < 0 and errno == EAGAIN)
+      {
+        usleep(200);
+        continue;
+      }
+      if (m <= 0)
+        break;
+      p += m;
+      n -= m;
+    }
+    if (n == 0)
     {
       sendOk = true;
       txCnt++;
@@ -87,80 +118,169 @@ bool USocket::sendCommand(std::string command)
   return sendOk;
 }
 
-void USocket::run()
+int USocket::sendRequest(std::string command, int replies, float timeout)
 {
-  const int MAX_RX_CNT = 2000;
-  char rxBuf[MAX_RX_CNT];
-  int rxCnt = 0;
-  while (connected and not stop)
-  { // receive 1 character
-    char recvChar;
-    int e = recv(sockfd, &recvChar, 1, MSG_DONTWAIT);
-    if (e == 1)
-    { /// got a character
-      // Check accepted chars
-      if (recvChar >=' ' or recvChar == '\n' or recvChar == '\t')
-      { // collect to a string (a fixed array of characters for speed)
-        rxBuf[rxCnt] = recvChar;
-        // If the line ends, terminate string and decode
-        if (rxBuf[rxCnt] == '\n')
-        { // terminate string (replacing the newline '\n')
+  int id = 0;
+  if (connected)
+  { // register before sending, the reply may be fast
+    std::unique_lock<std::mutex> lock(lineLock);
+    id = ++requestId;
+    Request r;
+    r.id = id;
+    r.replies = replies;
+    r.deadline.now();
+    r.deadline += timeout;
+    pending.push_back(r);
+    lock.unlock();
+    if (not sendCommand(command))
+    { // not send, so no reply, other requests may be added meanwhile
+      lock.lock();
+      for (auto it = pending.begin(); it != pending.end(); it++)
+      {
+        if (it->id == id)
+        {
+          pending.erase(it);
+          break;
+        }
+      }
+      id = 0;
+    }
+  }
+  return id;
+}
+
+void USocket::addLine(const char * text)
+{
+  std::lock_guard<std::mutex> lock(lineLock);
+  Line line;
+  line.text = text;
+  line.time.now();
+  // requests without a reply in time are given up
+  while (not pending.empty() and pending.front().deadline < line.time)
+  {
+    doneId = pending.front().id;
+    expired.push_back(doneId);
+    if (expired.size() > 20)
+      expired.pop_front();
+    pending.pop_front();
+  }
+  if (not pending.empty())
+  { // reply to oldest request
+    line.id = pending.front().id;
+    if (--pending.front().replies <= 0)
+    {
+      doneId = line.id;
+      line.last = true;
+      pending.pop_front();
+    }
+  }
+  if ((int)lines.size() >= MAX_LINES)
+  { // nobody is reading, discard the oldest
+    lines.pop_front();
+    dropCnt++;
+  }
+  lines.push_back(line);
+  reply = line.text;
+  rxTime = line.time;
+  replyCnt++;
+  lineReady.notify_all();
+}
+
+void USocket::onReadable(uint32_t events)
+{ // called by the reactor
+  bool hangup = events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+  const int MRB = 4096;
+  char buf[MRB];
+  while (not stop)
+  { // get all available data
+    int e = recv(sockfd, buf, MRB, 0);
+    if (e > 0)
+    {
+      for (int i = 0; i < e; i++)
+      {
+        char c = buf[i];
+        if (c == '\n')
+        { // a complete line
           rxBuf[rxCnt] = '\0';
-          // unpack this line
-          reply = rxBuf;
-          // mark command as handled
-          cmdSend = false;
-          replyCnt++;
-          rxTime.now();
-          // ready for next message
+          addLine(rxBuf);
           rxCnt = 0;
         }
-        else if (rxCnt < MAX_RX_CNT)
-        { // Increment string length
-          rxCnt++;
-        }
-        else
-        { // Buffer overflow
-          printf("USocket:: Listen loop overflow (discards the buffer)\n");
-          rxCnt = 0;
+        else if (c >= ' ' or c == '\t')
+        { // collect to a string (a fixed array of characters for speed)
+          if (rxCnt < MAX_RX_CNT - 1)
+            rxBuf[rxCnt++] = c;
+          else
+          { // Buffer overflow
+            printf("USocket:: Listen loop overflow (discards the buffer)\n");
+            rxCnt = 0;
+          }
         }
       }
     }
-    else if (e < 0 and errno != EAGAIN)
-    { // lost connection with hardware
-      // shut down
-      printf("### lost hardware connection (errno=%d) ###\n", errno);
-      connected = false;
-      close(sockfd);
+    else if (e == 0 or errno != EAGAIN)
+    { // closed by server or error
+      hangup = true;
+      break;
     }
     else
-    { // no data, wait a bit
-      usleep(900);
-    }
+      // all read
+      break;
   }
-  if (connected)
-  {
-    connected = false;
-    close(sockfd);
+  if (hangup and not stop)
+  { // lost connection
+    printf("### USocket:: lost connection (errno=%d) ###\n", errno);
+    reactor.remove(sockfd);
+    closeSocket();
+    // release waiting threads
+    lineReady.notify_all();
   }
 }
 
+bool USocket::getLine(Line & line, float timeoutMs)
+{
+  std::unique_lock<std::mutex> lock(lineLock);
+  bool got = lineReady.wait_for(lock, std::chrono::microseconds(int(timeoutMs * 1000)),
+                                [this]{ return not lines.empty() or not connected or stop; });
+  if (got and not lines.empty())
+  {
+    line = lines.front();
+    lines.pop_front();
+    return true;
+  }
+  return false;
+}
 
 std::string USocket::waitForReply(float timeoutMs)
 {
-  std::string r = "";
-  UTime t;
-  t.now();
-  while (replyCnt == replyCntLast and t.getTimePassed() < timeoutMs/1000.0)
-  { // wait a ms
-    usleep(1000);
-  }
-  if (replyCnt != replyCntLast)
-  { // got a reply
-    r = reply;
-    replyCntLast = replyCnt;
-  }
-  return r;
+  Line line;
+  if (getLine(line, timeoutMs))
+    return line.text;
+  if (not connected)
+    // avoid a busy loop in callers
+    usleep(int(timeoutMs * 1000));
+  return "";
+}
+
+bool USocket::waitForRequest(int id, float timeoutMs)
+{
+  std::unique_lock<std::mutex> lock(lineLock);
+  lineReady.wait_for(lock, std::chrono::microseconds(int(timeoutMs * 1000)),
+                     [this, id]{ return doneId >= id or not connected or stop; });
+  return doneId >= id and not expiredLocked(id);
 }
 
+bool USocket::isExpired(int id)
+{
+  std::lock_guard<std::mutex> lock(lineLock);
+  return expiredLocked(id);
+}
 
+bool USocket::expiredLocked(int id)
+{
+  for (int e : expired)
+  {
+    if (e == id)
+      return true;
+  }
+  return false;
+}
@@ -24,69 +24,123 @@
 #ifndef USOCKET_H
 #define USOCKET_H
 
-// #include <iostream>
-// #include <sys/time.h>
-// #include <cstdlib>
 #include <sys/types.h>
-// #include <mutex>
-// #include <condition_variable>
-#include <sys/types.h>
-// #include <sys/stat.h>
 #include <unistd.h>
-// #include <math.h>
 #include <sys/socket.h>
-#include <sys/types.h>
 #include <netdb.h>
-#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
 
 #include "utime.h"
 
 using namespace std;
-// forward declaration
 
+/**
+ * Line based client connection (e.g. to the python vision server).
+ * The reactor thread reads all available data
+ * and queues complete lines (newline terminated).
+ * Requests can be pipelined, replies are assumed to
+ * arrive in the order the requests were send (FIFO), and a reply line
+ * is tagged with the request ID it belongs to. */
 class USocket
 {
 public:
   USocket(const char * host, const char * port);
   /**
-   * Listen to socket from python vision app */
-  void run();
-  /** decode an unpacked incoming messages
+   * Read all available data and queue complete lines (called by the reactor)
+   * \param events is the ready epoll events */
+  void onReadable(uint32_t events);
+  /** send a command, where no reply is expected
    * \returns true if the request is send OK */
   bool sendCommand(std::string command);
+  /**
+   * Send a request, where a number of reply lines are expected.
+   * \param replies is the number of reply lines expected
+   * \param timeout is max time (sec) to wait for the replies
+   * \returns request ID (> 0) or 0 if not send */
+  int sendRequest(std::string command, int replies = 1, float timeout = 1.0);
   /**
    * terminate */
   void terminate();
   /**
-   * Wait for a reply from vision
-   * */
+   * A received line */
+  struct Line
+  {
+    std::string text;
+    UTime time;
+    /// request ID, 0 if not a reply to a request
+    int id = 0;
+    /// last reply line to this request
+    bool last = false;
+  };
+  /**
+   * Get the next received line (blocking)
+   * \param timeoutMs is max wait time
+   * \returns false if no line within the timeout */
+  bool getLine(Line & line, float timeoutMs);
+  /**
+   * Wait for next received line
+   * \returns the line or an empty string on timeout */
   std::string waitForReply(float timeoutMs);
+  /**
+   * Wait for all replies to this request
+   * (the lines are still available with getLine())
+   * \returns false if the request timed out */
+  bool waitForRequest(int id, float timeoutMs);
+  /**
+   * \returns true if this request is given up (no reply in time) */
+  bool isExpired(int id);
 
 public:
   int txCnt = 0;
   int replyCnt = 0;
+  /// lines discarded because the queue was full
+  int dropCnt = 0;
   UTime txTime, rxTime;
   bool connected = false;
+  /// last line received
   std::string reply;
 
 
 private:
+  /** test for expired request (lineLock must be locked) */
+  bool expiredLocked(int id);
+  /** add a complete line to the queue */
+  void addLine(const char * text);
   std::string host;
   int port;
   addrinfo * servinfo = nullptr; /// socket info
-  int sockfd; /// Socket file descriptor
-  //
-  std::string command;
-  int replyCntLast = 0;
-  bool cmdSend = false;
+  int sockfd = -1; /// Socket file descriptor
+  /// partial received line
+  static const int MAX_RX_CNT = 2000;
+  char rxBuf[MAX_RX_CNT];
+  int rxCnt = 0;
   //
-  static void runObj(USocket * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
+  struct Request
+  {
+    int id;
+    int replies;
+    UTime deadline;
+  };
+  /// requests waiting for a reply (oldest first)
+  std::deque<Request> pending;
+  /// all requests up to this ID are finished
+  int doneId = 0;
+  /// most recent requests given up (no reply in time)
+  std::deque<int> expired;
+  int requestId = 0;
+  /// received lines, not yet used
+  std::deque<Line> lines;
+  static const int MAX_LINES = 200;
+  std::mutex lineLock;
+  std::condition_variable lineReady;
+  /// one command at a time on the socket
+  std::mutex txLock;
+  /** close the socket (not while sending) */
+  void closeSocket();
   // support variables
-  std::thread * th1;
   bool stop = false;
 };
 
@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <future>
+#include <stdexcept>
+#include <stdio.h>
+#include "ustartup.h"
+#include "uservice.h"
+
+
+void UStartup::add(const char * name, std::function<void()> setup,
+                   std::vector<std::string> after,
+                   std::vector<std::string> groups)
+{
+  Module m;
+  m.name = name;
+  m.setup = setup;
+  m.groups = groups;
+  for (auto & a : after)
+  {
+    for (int i = 0; i < (int)modules.size(); i++)
+    {
+      if (modules[i].name == a)
+        m.after.push_back(i);
+    }
+  }
+  modules.push_back(m);
+}
+
+void UStartup::setupModule(Module & m)
+{ // a module is not set up, if a module it depends on failed
+  for (int a : m.after)
+  {
+    if (not modules[a].error.empty())
+    {
+      m.error = "not set up, as '" + modules[a].name + "' failed";
+      return;
+    }
+  }
+  m.started = startTime.getTimePassed();
+  try
+  {
+    m.setup();
+  }
+  catch (const std::exception & e)
+  {
+    m.error = e.what();
+  }
+  catch (...)
+  {
+    m.error = "unknown exception";
+  }
+  m.finished = startTime.getTimePassed();
+}
+
+bool UStartup::run(bool parallel)
+{
+  wasParallel = parallel;
+  startTime.now();
+  // create ini groups, so that no module adds
+  // a group, while others use the ini structure
+  for (auto & m : modules)
+    for (auto & g : m.groups)
+      ini[g];
+  if (parallel)
+  { // start all, each waits for the modules it depends on
+    std::vector<std::shared_future<void>> done;
+    for (int i = 0; i < (int)modules.size(); i++)
+    {
+      std::vector<std::shared_future<void>> wait;
+      for (int a : modules[i].after)
+        wait.push_back(done[a]);
+      Module * m = &modules[i];
+      done.push_back(std::async(std::launch::async, [this, m, wait]()
+      {
+        for (auto & w : wait)
+          w.wait();
+        setupModule(*m);
+      }).share());
+    }
+    for (int i = 0; i < (int)done.size(); i++)
+    { // setup exceptions are caught in setupModule, but get() would tell the rest
+      try
+      {
+        done[i].get();
+      }
+      catch (const std::exception & e)
+      {
+        modules[i].error = e.what();
+      }
+    }
+  }
+  else
+  {
+    for (auto & m : modules)
+      setupModule(m);
+  }
+  total = startTime.getTimePassed();
+  float sum = 0;
+  int failed = 0;
+  for (auto & m : modules)
+  {
+    sum += m.finished - m.started;
+    if (not m.error.empty())
+    {
+      printf("#*** UStartup:: module '%s' failed: %s\n", m.name.c_str(), m.error.c_str());
+      failed++;
+    }
+  }
+  printf("# UStartup:: %d modules set up in %.3f sec (%.3f sec in sum), %d failed\n",
+         (int)modules.size() - failed, total, sum, failed);
+  return failed == 0;
+}
+
+void UStartup::toLog(const std::string & filename)
+{
+  FILE * f = fopen(filename.c_str(), "w");
+  if (f == nullptr)
+    return;
+  fprintf(f, "%% Module startup timing (%s) %lu.%04ld\n",
+          wasParallel ? "parallel" : "serial", startTime.getSec(), startTime.getMicrosec()/100);
+  fprintf(f, "%% total %.4f sec\n", total);
+  fprintf(f, "%% 1 \tModule\n");
+  fprintf(f, "%% 2 \tStarted (sec after start)\n");
+  fprintf(f, "%% 3 \tFinished (sec after start)\n");
+  fprintf(f, "%% 4 \tSetup time (sec)\n");
+  fprintf(f, "%% 5 \tDepends on\n");
+  for (auto & m : modules)
+  {
+    fprintf(f, "%-12s %.4f %.4f %.4f", m.name.c_str(), m.started, m.finished, m.finished - m.started);
+    for (int a : m.after)
+      fprintf(f, " %s", modules[a].name.c_str());
+    if (not m.error.empty())
+      fprintf(f, " (failed: %s)", m.error.c_str());
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
@@ -0,0 +1,82 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "utime.h"
+
+using namespace std;
+
+/**
+ * Module startup, where modules without dependencies
+ * are set up in parallel (each in its own thread).
+ * A module is started, when the modules it depends on are finished.
+ * NB! the ini structure is not thread safe, so modules started in
+ * parallel must not add to the same ini group, the groups used
+ * are therefore created before starting. */
+class UStartup
+{
+public:
+  /**
+   * Add a module setup
+   * \param name is the module name (used in dependencies)
+   * \param setup is the setup function
+   * \param after is the modules that must be finished first
+   * (modules not added are ignored, they must be added before this module)
+   * \param groups is the ini groups this module uses */
+  void add(const char * name, std::function<void()> setup,
+           std::vector<std::string> after = {},
+           std::vector<std::string> groups = {});
+  /**
+   * Set up all modules and wait for them to finish.
+   * A module that throws an exception in setup is reported as failed,
+   * and modules that depend on it are not set up.
+   * \param parallel if false, then in the order added
+   * \returns false if a module failed */
+  bool run(bool parallel);
+  /**
+   * Save timing for each module to a logfile */
+  void toLog(const std::string & filename);
+
+private:
+  struct Module
+  {
+    std::string name;
+    std::function<void()> setup;
+    std::vector<int> after;
+    std::vector<std::string> groups;
+    /// relative to start of run
+    float started = 0;
+    float finished = 0;
+    /// reason, if setup failed
+    std::string error;
+  };
+  /** set up one module (if the modules it depends on did not fail) */
+  void setupModule(Module & m);
+  std::vector<Module> modules;
+  UTime startTime;
+  float total = 0;
+  bool wasParallel = true;
+};
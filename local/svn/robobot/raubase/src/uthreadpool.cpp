@@ -0,0 +1,85 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "uthreadpool.h"
+
+
+UThreadPool::~UThreadPool()
+{
+  terminate();
+}
+
+void UThreadPool::setup(int threads)
+{
+  terminate();
+  if (threads < 1)
+    threads = 1;
+  stopPool = false;
+  for (int i = 0; i < threads; i++)
+    workers.push_back(std::thread(&UThreadPool::run, this));
+}
+
+void UThreadPool::terminate()
+{
+  {
+    std::lock_guard<std::mutex> lock(queueLock);
+    stopPool = true;
+  }
+  queueReady.notify_all();
+  for (auto & w : workers)
+    w.join();
+  workers.clear();
+}
+
+std::future<void> UThreadPool::add(std::function<void()> task)
+{
+  auto t = std::make_shared<std::packaged_task<void()>>(task);
+  std::future<void> f = t->get_future();
+  if (workers.empty())
+    // no workers, so do it now
+    (*t)();
+  else
+  {
+    std::lock_guard<std::mutex> lock(queueLock);
+    queue.push_back(t);
+    queueReady.notify_one();
+  }
+  return f;
+}
+
+void UThreadPool::run()
+{
+  while (true)
+  {
+    std::shared_ptr<std::packaged_task<void()>> t;
+    {
+      std::unique_lock<std::mutex> lock(queueLock);
+      queueReady.wait(lock, [this]{ return stopPool or not queue.empty(); });
+      if (queue.empty())
+        // stopPool and nothing more to do
+        break;
+      t = queue.front();
+      queue.pop_front();
+    }
+    (*t)();
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <memory>
+
+/**
+ * Simple pool of worker threads.
+ * Tasks are queued and executed by the first idle worker,
+ * the returned future is ready when the task is finished. */
+class UThreadPool
+{
+public:
+  /** stop all workers */
+  ~UThreadPool();
+  /**
+   * (Re)start with this number of worker threads
+   * \param threads is number of workers (at least 1) */
+  void setup(int threads);
+  /**
+   * Stop workers, after queued tasks are finished */
+  void terminate();
+  /**
+   * Add a task to the queue
+   * \param task is a function (or lambda) with no parameters and no return value
+   * \returns a future that is ready when the task is done */
+  std::future<void> add(std::function<void()> task);
+  /**
+   * Number of worker threads */
+  int size()
+  {
+    return workers.size();
+  }
+
+private:
+  /** worker thread loop */
+  void run();
+  std::vector<std::thread> workers;
+  std::deque<std::shared_ptr<std::packaged_task<void()>>> queue;
+  std::mutex queueLock;
+  std::condition_variable queueReady;
+  bool stopPool = false;
+};
@@ -30,6 +30,10 @@
 #include <math.h>
 #include "utime.h"
 
+float UTime::speedup = 1.0;
+timeval UTime::realOrigin;
+timeval UTime::virtualOrigin;
+
 /////////////////////////////////////////
 
 UTime::UTime()
@@ -48,6 +52,30 @@ UTime::~UTime()
 {
 }
 
+/////////////////////////////////////////////
+
+void UTime::setSpeedup(float factor)
+{
+  if (factor <= 0.0)
+    return;
+  UTime t("now");
+  virtualOrigin = t.time;
+  gettimeofday(&realOrigin, nullptr);
+  speedup = factor;
+}
+
+/////////////////////////////////////////////
+
+void UTime::toVirtual()
+{ // virtual = virtualOrigin + (real - realOrigin) * speedup
+  double dt = (time.tv_sec - realOrigin.tv_sec) + (time.tv_usec - realOrigin.tv_usec) * 1e-6;
+  dt *= speedup;
+  long sec = long(floor(dt));
+  long usec = virtualOrigin.tv_usec + long((dt - sec) * 1e6);
+  time.tv_sec = virtualOrigin.tv_sec + sec + usec / 1000000;
+  time.tv_usec = usec % 1000000;
+}
+
 /////////////////////////////////////////
 
 void UTime::clear()
@@ -67,9 +67,25 @@ public:
   Get time past since this time in seconds */
   float getTimePassed();
   /**
-  Set time value to system time now using gettimeofday() */
+  Set time value to system time now using gettimeofday(),
+  or to the virtual time, if the clock is speeded up (simulation) */
   inline void now()
-  { gettimeofday(&time, nullptr); valid = true; }
+  {
+    gettimeofday(&time, nullptr);
+    valid = true;
+    if (speedup != 1.0)
+      toVirtual();
+  }
+  /**
+   * Let now() run faster (or slower) than real time, e.g. for simulation.
+   * The clock is continuous at the change.
+   * Should be set before other threads use the time.
+   * A real time interval (e.g. age of a kernel timestamp) must be
+   * multiplied by speedup, before it is subtracted from now().
+   * \param factor is virtual seconds per real second (1.0 is real time) */
+  static void setSpeedup(float factor);
+  /// virtual seconds per real second
+  static float speedup;
   /**
   Set time from a timeval structure */
   void setTime(timeval iTime);
@@ -235,6 +251,14 @@ public:
   /**
   A valid flag, that are used when setting the time */
   bool valid;
+
+private:
+  /**
+  Convert a real time (from gettimeofday) to virtual time */
+  void toVirtual();
+  /// real and virtual time at last speedup change
+  static timeval realOrigin;
+  static timeval virtualOrigin;
 };
 
 
@@ -0,0 +1,292 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "uv4l2.h"
+
+
+UV4l2::~UV4l2()
+{
+  close();
+}
+
+int UV4l2::xioctl(int fd, unsigned long request, void * arg)
+{
+  int r;
+  do
+    r = ioctl(fd, request, arg);
+  while (r == -1 and errno == EINTR);
+  return r;
+}
+
+bool UV4l2::open(int device, int w, int h, int framerate, uint32_t format, int bufferCount)
+{
+  const int MSL = 50;
+  char s[MSL];
+  snprintf(s, MSL, "/dev/video%d", device);
+  fd = ::open(s, O_RDWR | O_NONBLOCK);
+  if (fd < 0)
+  {
+    printf("# UV4l2::open: failed to open %s: %s\n", s, strerror(errno));
+    return false;
+  }
+  struct v4l2_capability cap;
+  memset(&cap, 0, sizeof(cap));
+  if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 or
+      not (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) or
+      not (cap.capabilities & V4L2_CAP_STREAMING))
+  {
+    printf("# UV4l2::open: %s is not a streaming capture device\n", s);
+    close();
+    return false;
+  }
+  // image format
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  fmt.fmt.pix.width = w;
+  fmt.fmt.pix.height = h;
+  fmt.fmt.pix.pixelformat = format;
+  fmt.fmt.pix.field = V4L2_FIELD_ANY;
+  if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0)
+  {
+    printf("# UV4l2::open: format not accepted: %s\n", strerror(errno));
+    close();
+    return false;
+  }
+  // the driver may adjust the format
+  width = fmt.fmt.pix.width;
+  height = fmt.fmt.pix.height;
+  fourcc = fmt.fmt.pix.pixelformat;
+  // frame rate
+  struct v4l2_streamparm parm;
+  memset(&parm, 0, sizeof(parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  parm.parm.capture.timeperframe.numerator = 1;
+  parm.parm.capture.timeperframe.denominator = framerate;
+  if (xioctl(fd, VIDIOC_S_PARM, &parm) == 0 and parm.parm.capture.timeperframe.numerator > 0)
+    fps = parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+  else
+    fps = framerate;
+  // driver buffers
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = bufferCount;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 or req.count < 2)
+  {
+    printf("# UV4l2::open: failed to get buffers: %s\n", strerror(errno));
+    close();
+    return false;
+  }
+  pool = std::make_shared<Pool>();
+  pool->fd = fd;
+  std::vector<Buffer> & buffers = pool->buffers;
+  buffers.resize(req.count);
+  for (int i = 0; i < (int)req.count; i++)
+  { // map and queue all buffers
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0)
+    {
+      printf("# UV4l2::open: failed to query buffer %d\n", i);
+      close();
+      return false;
+    }
+    buffers[i].length = buf.length;
+    buffers[i].start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+    if (buffers[i].start == MAP_FAILED)
+    {
+      buffers[i].start = nullptr;
+      printf("# UV4l2::open: failed to map buffer %d: %s\n", i, strerror(errno));
+      close();
+      return false;
+    }
+    if (xioctl(fd, VIDIOC_QBUF, &buf) < 0)
+    {
+      printf("# UV4l2::open: failed to queue buffer %d\n", i);
+      close();
+      return false;
+    }
+  }
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+  {
+    printf("# UV4l2::open: failed to start stream: %s\n", strerror(errno));
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool UV4l2::grab(Frame & frame, int timeoutMs)
+{
+  if (fd < 0)
+    return false;
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  int n = poll(&pfd, 1, timeoutMs);
+  if (n <= 0)
+    // timeout or interrupted
+    return false;
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0)
+  { // EAGAIN is no buffer ready (yet)
+    if (errno != EAGAIN)
+      printf("# UV4l2::grab: failed to get buffer: %s\n", strerror(errno));
+    return false;
+  }
+  int index = buf.index;
+  if (buf.flags & V4L2_BUF_FLAG_ERROR)
+  { // corrupted frame - give it back
+    requeue(fd, index);
+    return false;
+  }
+  void * start;
+  {
+    std::lock_guard<std::mutex> lock(pool->lock);
+    pool->buffers[index].held = true;
+    start = pool->buffers[index].start;
+  }
+  // the buffer is queued again, when the last user releases the frame,
+  // the pool is kept alive by the frame, also after close()
+  std::shared_ptr<Pool> p = pool;
+  frame.hold = std::shared_ptr<void>(start, [p, index](void *) { release(*p, index); });
+  frame.data = (const uchar *)start;
+  frame.bytes = buf.bytesused;
+  frame.width = width;
+  frame.height = height;
+  frame.fourcc = fourcc;
+  frame.sequence = buf.sequence;
+  // timestamp
+  frame.time.now();
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+  { // kernel timestamp is monotonic clock, convert to time of day
+    struct timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    float age = (mono.tv_sec - buf.timestamp.tv_sec) +
+                (mono.tv_nsec / 1000 - buf.timestamp.tv_usec) * 1e-6;
+    if (age > 0.0 and age < 10.0)
+      // age is real time, now() may be faster (simulation)
+      frame.time -= age * UTime::speedup;
+  }
+  return true;
+}
+
+void UV4l2::release(Pool & pool, int index)
+{
+  std::lock_guard<std::mutex> lock(pool.lock);
+  Buffer & b = pool.buffers[index];
+  b.held = false;
+  if (pool.fd >= 0)
+    requeue(pool.fd, index);
+  else if (b.start != nullptr)
+  { // device is closed, the last user is done with the buffer
+    munmap(b.start, b.length);
+    b.start = nullptr;
+  }
+}
+
+bool UV4l2::requeue(int fd, int index)
+{
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
+  bool isOK = xioctl(fd, VIDIOC_QBUF, &buf) == 0;
+  if (not isOK)
+    printf("# UV4l2::requeue: failed to queue buffer %d: %s\n", index, strerror(errno));
+  return isOK;
+}
+
+void UV4l2::close()
+{
+  if (pool != nullptr)
+  { // no more requeue from released frames
+    std::lock_guard<std::mutex> lock(pool->lock);
+    if (fd >= 0)
+    {
+      enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      xioctl(fd, VIDIOC_STREAMOFF, &type);
+    }
+    pool->fd = -1;
+    int held = 0;
+    for (auto & b : pool->buffers)
+    {
+      if (b.held)
+        // unmapped when the frame is released
+        held++;
+      else if (b.start != nullptr)
+      {
+        munmap(b.start, b.length);
+        b.start = nullptr;
+      }
+    }
+    if (held > 0)
+      printf("# UV4l2::close: %d frame(s) still in use, unmapped when released\n", held);
+    pool.reset();
+  }
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool UV4l2::Frame::decode(cv::Mat & bgr) const
+{
+  if (empty() or bytes <= 0)
+    return false;
+  if (fourcc == V4L2_PIX_FMT_MJPEG or fourcc == V4L2_PIX_FMT_JPEG)
+  { // decode directly from the driver buffer
+    cv::Mat jpg(1, bytes, CV_8UC1, (void*)data);
+    bgr = cv::imdecode(jpg, cv::IMREAD_COLOR);
+  }
+  else if (fourcc == V4L2_PIX_FMT_YUYV)
+  {
+    cv::Mat yuyv(height, width, CV_8UC2, (void*)data);
+    cv::cvtColor(yuyv, bgr, cv::COLOR_YUV2BGR_YUYV);
+  }
+  else
+    return false;
+  return not bgr.empty();
+}
@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright © 2024 DTU, Christian Andersen jcan@dtu.dk
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+
+/**
+ * Camera capture directly from V4L2 (video4linux)
+ * using memory mapped driver buffers.
+ * A captured buffer is handed out as a reference counted frame,
+ * and is queued back to the driver, when the last reference is released,
+ * i.e. no data is copied until the frame is decoded. */
+class UV4l2
+{
+public:
+  /**
+   * A captured frame, the data is in the driver buffer */
+  struct Frame
+  {
+    /// holds the driver buffer until released
+    std::shared_ptr<void> hold;
+    /// image data (MJPEG or YUYV as captured)
+    const uchar * data = nullptr;
+    int bytes = 0;
+    int width = 0;
+    int height = 0;
+    uint32_t fourcc = 0;
+    /// capture time (from driver timestamp)
+    UTime time;
+    /// driver frame sequence number
+    uint32_t sequence = 0;
+    bool empty() const
+    {
+      return hold == nullptr;
+    }
+    /**
+     * Decode to a BGR image (the only place with a copy)
+     * \returns false if the format is not supported or decode failed */
+    bool decode(cv::Mat & bgr) const;
+    /** release the buffer to the driver */
+    void release()
+    {
+      hold.reset();
+      data = nullptr;
+    }
+  };
+  /** close device (if open) */
+  ~UV4l2();
+  /**
+   * Open and start streaming
+   * \param device is the number in /dev/videoN
+   * \param fourcc is the pixel format, e.g. MJPG or YUYV
+   * \param bufferCount is number of driver buffers to use
+   * \returns true if streaming */
+  bool open(int device, int width, int height, int fps, uint32_t fourcc, int bufferCount = 4);
+  /**
+   * Wait for next frame (blocking in poll())
+   * \param frame is set to the new frame
+   * \param timeoutMs is max wait time
+   * \returns false on timeout or error */
+  bool grab(Frame & frame, int timeoutMs);
+  /**
+   * Stop streaming and release buffers.
+   * Buffers still held by a frame stay mapped until that frame is released,
+   * they are then unmapped instead of queued to the (closed) device. */
+  void close();
+  bool isOpened()
+  {
+    return fd >= 0;
+  }
+  /// actual format after open
+  int width = 0;
+  int height = 0;
+  int fps = 0;
+  uint32_t fourcc = 0;
+
+private:
+  struct Buffer
+  {
+    void * start = nullptr;
+    size_t length = 0;
+    /// handed out in a frame, and not released yet
+    bool held = false;
+  };
+  /**
+   * Driver buffers shared with the frames handed out,
+   * so that a frame released after close() finds the pool */
+  struct Pool
+  {
+    std::mutex lock;
+    /// device handle, -1 when closed
+    int fd = -1;
+    std::vector<Buffer> buffers;
+  };
+  /**
+   * Frame released, queue the buffer back to the driver,
+   * or unmap it if the device is closed */
+  static void release(Pool & pool, int index);
+  /** queue buffer to the driver */
+  static bool requeue(int fd, int index);
+  /** ioctl that retry on interrupt */
+  static int xioctl(int fd, unsigned long request, void * arg);
+  std::shared_ptr<Pool> pool;
+  int fd = -1;
+};
@@ -0,0 +1,110 @@
+ #/***************************************************************************
+ #*   Copyright (C) 2023 by DTU
+ #*   jca@elektro.dtu.dk
+ #*
+ #*
+ #* The MIT License (MIT)  https://mit-license.org/
+ #*
+ #* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ #* and associated documentation files (the “Software”), to deal in the Software without restriction,
+ #* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ #* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ #* is furnished to do so, subject to the following conditions:
+ #*
+ #* The above copyright notice and this permission notice shall be included in all copies
+ #* or substantial portions of the Software.
+ #*
+ #* THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ #* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ #* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ #* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ #* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ #* THE SOFTWARE. */
+
+#
+# Read camera frames published by raubase in shared memory
+# (ini-file [shm] enabled=true).
+# The image is a numpy array directly in the shared memory (no copy),
+# so it is valid until raubase writes to the slot again,
+# use isValid() after the analysis, or copy the image.
+#
+
+import mmap
+import struct
+import time
+import numpy as np
+
+class ShmFrames:
+  HEADER = struct.Struct('<IIIIIIQ')   # magic, version, slots, dataOffset, slotBytes, newest, seq
+  SLOT = struct.Struct('<QQQIIIIII')   # lock, seq, sec, usec, format, width, height, stride, bytes
+  SLOT_SIZE = 64
+  MAGIC = 0x52464252                   # 'RBFR'
+  FORMAT_BGR = 0x33524742              # 'BGR3'
+  FORMAT_GRAY = 0x59415247             # 'GRAY'
+  mm = None
+  lastSlot = 0
+  lastLock = -1
+  #
+  def open(self, name = "/raubase_frames"):
+    # name as in raubase ini-file [shm] name
+    try:
+      f = open("/dev/shm" + name, "rb")
+      self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+      f.close()
+    except OSError as e:
+      print("# ShmFrames:: failed to open shared memory {}: {}".format(name, e))
+      return False
+    magic, version, self.slots, self.dataOffset, self.slotBytes, newest, seq = self.HEADER.unpack_from(self.mm, 0)
+    if magic != self.MAGIC or version != 1:
+      print("# ShmFrames:: {} is not a raubase frame ring".format(name))
+      self.close()
+      return False
+    return True
+  #
+  def close(self):
+    if self.mm is not None:
+      self.mm.close()
+      self.mm = None
+  #
+  def newest(self):
+    # returns (sequence, slot) of the newest published frame
+    h = self.HEADER.unpack_from(self.mm, 0)
+    return h[6], h[5]
+  #
+  def lock(self, slot):
+    return struct.unpack_from('<Q', self.mm, self.HEADER.size + slot * self.SLOT_SIZE)[0]
+  #
+  def get(self, slot = None, retries = 3):
+    # get frame from this slot (default newest)
+    # returns (seq, time, image) or (0, 0, None) if not available
+    for i in range(retries):
+      s = slot
+      if s is None or i > 0:
+        # newest may have changed while trying
+        newest, s = self.newest()
+        if newest == 0:
+          return 0, 0, None
+      base = self.HEADER.size + s * self.SLOT_SIZE
+      lock, seq, sec, usec, fmt, w, h, stride, n = self.SLOT.unpack_from(self.mm, base)
+      if lock % 2 == 1 or seq == 0:
+        # being written
+        time.sleep(0.001)
+        continue
+      channels = 3 if fmt == self.FORMAT_BGR else 1
+      offset = self.dataOffset + s * self.slotBytes
+      # raubase writes rows without padding (stride = width * channels)
+      img = np.frombuffer(self.mm, dtype=np.uint8, count=h * stride, offset=offset)
+      if channels > 1:
+        img = img.reshape(h, w, channels)
+      else:
+        img = img.reshape(h, w)
+      if self.lock(s) == lock:
+        self.lastSlot = s
+        self.lastLock = lock
+        return seq, sec + usec * 1e-6, img
+    return 0, 0, None
+  #
+  def isValid(self):
+    # true if the last image from get() is not overwritten (yet)
+    return self.lock(self.lastSlot) == self.lastLock
+  pass
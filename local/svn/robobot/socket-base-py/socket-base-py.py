@@ -31,6 +31,7 @@ import sys
 import threading
 import time
 import select
+from shmframes import ShmFrames
 #from netifaces import interfaces, ifaddresses, AF_INET
 #import netifaces
 
@@ -74,7 +75,9 @@ class MyTCPHandler(socketserver.StreamRequestHandler):
                 self.data = self.rfile.readline().strip()
                 try:
                     got = str(self.data, 'utf-8')
-                    print("{} wrote: '{}'".format(self.client_address[0], got))
+                    if not got.startswith("frame"):
+                      # frame notifications are too frequent to print
+                      print("{} wrote: '{}'".format(self.client_address[0], got))
                 except:
                     got = "invalid string"
                 # split into individual words/numbers (space separated)
@@ -91,12 +94,15 @@ class MyTCPHandler(socketserver.StreamRequestHandler):
                         self.arucoRequest(gg)
                     elif gg[0] == "golf":
                         self.golfRequest(gg)
+                    elif gg[0] == "frame":
+                        self.frameNotify(gg)
                     elif gg[0] == "help":
                         self.send("python vision server")
                         self.send("  quit:  Closes this connection to server")
                         self.send("  off:   Server shutdown")
                         self.send("  aruco: Report any visible ArUco codes (not implemented)")
                         self.send("  golf:  Report any visible golf balls in image (not implemented)")
+                        self.send("  frame seq slot: New camera frame in shared memory (from raubase, no reply)")
                         self.send("  help:  This message")
                     else:
                         self.send(str(self.data.upper()) + ", try again, got " + got)
@@ -138,6 +144,19 @@ class MyTCPHandler(socketserver.StreamRequestHandler):
           for i in range(0,found):
             self.send("golfpos {} {} {} {}".format(found, i, x[i],y[i]))
 
+    def frameNotify(self, gg):
+        # raubase has published a new frame in shared memory
+        if len(gg) < 3:
+          return
+        if server.frames.mm is None and not server.frames.open():
+          return
+        seq, t, img = server.frames.get(int(gg[2]))
+        if img is not None:
+          server.frameSeq = seq
+          server.frameTime = t
+          # analyse img here (no copy, use server.frames.isValid() after analysis)
+          pass
+
 
 #################################################################
 #################################################################
@@ -157,6 +176,10 @@ class UServer:
   socserver = []
   stop = False
   port = 25001
+  # camera frames from raubase (shared memory)
+  frames = ShmFrames()
+  frameSeq = 0
+  frameTime = 0
   #
   def run(self):
     # open server on then local network where the hostname is registered.